@@ -1,55 +1,173 @@
+#define _GNU_SOURCE // mremap()
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
-#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "mymalloc.h"
 
 #define SIZE_HEADER_SIZE sizeof(size_t)
 #define CHUNK_OVERHEAD (SIZE_HEADER_SIZE + SIZE_HEADER_SIZE) // size header and footer
-#define ALIGN_8(x) ((((x-1) >> 3) << 3) + 8)
+#define ALIGN_16(x) ((((x-1) >> 4) << 4) + 16) // glibc guarantees 16 byte alignment, so programs rely on it
+#define ALIGN_UP(x, a) (((x) + (a) - 1) & ~((a) - 1))
 #define FREE_FLAG 1
+#define MMAP_FLAG 2 // chunk has its own mapping and isn't part of the heap
+#define RELEASED_FLAG 4 // free chunk whose inner pages were already given back with madvise()
+#define FLAGS_MASK (FREE_FLAG | MMAP_FLAG | RELEASED_FLAG)
 
 typedef struct chunk_header {
     size_t size;
     struct chunk_header* prev; // relevant only for free chunks
-    struct chunk_header* next; // relevant only for free chunks
+    struct chunk_header* next; // relevant only for free chunks (and chunks sitting in a thread cache)
 } chunk_header;
 
 #define MIN_FREE_CHUNK_SIZE (sizeof(chunk_header) + sizeof(size_t)) // chunk_header + footer size header
+#define MIN_PAYLOAD_SIZE (MIN_FREE_CHUNK_SIZE - CHUNK_OVERHEAD) // room for the free list pointers
+#define MAX_PAYLOAD_SIZE (SIZE_MAX / 2)
 
-chunk_header* free_list_head = NULL;
+// payloads are kept 16 byte aligned: chunk sizes are multiples of 16 and every chunk header sits 8 bytes
+// below a 16 byte boundary
 
-void* heap_base = NULL; 
+// every heap segment starts with a prologue (an allocated chunk with an empty payload) and ends with an
+// epilogue (a lone allocated size header), so coalescing never walks past the memory we got from sbrk()
+#define SEGMENT_OVERHEAD (CHUNK_OVERHEAD + SIZE_HEADER_SIZE)
 
-#define CHUNK_SIZE(c) ((c)->size & ~(FREE_FLAG))
+#define CHUNK_SIZE(c) ((c)->size & ~(FLAGS_MASK))
 #define IS_FREE(c) ((c)->size & FREE_FLAG)
 #define SET_FREE(c) ((c)->size |= FREE_FLAG)
-#define SET_ALLOCATED(c) ((c)->size &= ~FREE_FLAG)
+#define SET_ALLOCATED(c) ((c)->size &= ~(FREE_FLAG | RELEASED_FLAG))
+#define IS_MMAPPED(c) ((c)->size & MMAP_FLAG)
+#define IS_RELEASED(c) ((c)->size & RELEASED_FLAG)
+
+#define CHUNK_PAYLOAD(c) ((void*) (((char*) (c)) + SIZE_HEADER_SIZE))
+#define PAYLOAD_CHUNK(p) ((chunk_header*) (((char*) (p)) - SIZE_HEADER_SIZE))
+#define NEXT_CHUNK(c) ((chunk_header*) (((char*) (c)) + CHUNK_SIZE(c) + CHUNK_OVERHEAD))
 
 // #define CHUNK_FOOTER(c) (*(size_t*)(((char*) (c)) + SIZE_HEADER_SIZE + CHUNK_SIZE(c)))
 
-void *mymalloc(size_t size);
-void myfree(void *ptr);
+
+// Giving memory back to the OS
+// * requests of at least MMAP_THRESHOLD bytes get their own mapping, which is unmapped on free. The word before
+//   the header of such a chunk holds its offset from the start of the mapping
+// * when the free chunk at the top of the heap grows to TRIM_THRESHOLD bytes, the heap is shrunk with sbrk()
+// * free chunks of at least RELEASE_MIN_SIZE bytes that stay free for a whole release interval (RELEASE_INTERVAL
+//   frees into the arena) get their inner pages released with madvise(MADV_DONTNEED)
+#define MMAP_THRESHOLD (128 * 1024)
+#define TRIM_THRESHOLD (128 * 1024)
+#define RELEASE_MIN_SIZE (64 * 1024)
+#define RELEASE_INTERVAL 4096
+
+// epoch of the release interval in which a large chunk was freed; stored in its payload, after the free list pointers
+#define FREE_EPOCH(c) (*(unsigned long*) (((char*) (c)) + sizeof(chunk_header)))
+
+#define MMAP_OFFSET(c) (*(size_t*) (((char*) (c)) - SIZE_HEADER_SIZE))
+
+
+// Thread cache (tcache)
+// Each thread keeps small freed chunks in per-size singly linked bins, so a malloc/free pair of a small
+// size never touches the arena lock. Cached chunks stay marked as allocated, so they never get coalesced.
+#define TCACHE_MAX_SIZE 1024 // largest payload size kept in a thread cache
+#define TCACHE_NUM_BINS ((TCACHE_MAX_SIZE - MIN_PAYLOAD_SIZE) / 16 + 1)
+#define TCACHE_BIN(size) (((size) - MIN_PAYLOAD_SIZE) >> 4)
+#define TCACHE_BIN_MAX 64 // when a bin is full, half of it is flushed back to the arena
+
+typedef struct tcache {
+    chunk_header *bins[TCACHE_NUM_BINS];
+    unsigned int counts[TCACHE_NUM_BINS];
+    int initialized;
+    int disabled; // set once the thread's cache has been torn down on thread exit
+} tcache;
+
+// initial-exec, so that a preloaded build never calls into the dynamic TLS allocator (which uses malloc)
+static __thread tcache thread_cache __attribute__((tls_model("initial-exec")));
+
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+
+
+// Arena
+// The free lists and the heap segments are shared by all threads and guarded by arena_mtx.
+// The lock is taken only when a thread cache misses (refill) or overflows (flush), and for large chunks.
+static pthread_mutex_t arena_mtx = PTHREAD_MUTEX_INITIALIZER;
+
+// free chunks are kept in one list per power of two size class (the classes mymalloc_stats() reports);
+// bit i of nonempty_classes is set while free_lists[i] has chunks
+#define NUM_SIZE_CLASSES MYMALLOC_NUM_SIZE_CLASSES
+
+static chunk_header* free_lists[NUM_SIZE_CLASSES];
+static unsigned long nonempty_classes = 0;
+
+static size_t* heap_end = NULL; // epilogue of the most recent heap segment
+
+static unsigned long release_epoch = 0;
+static unsigned long frees_in_epoch = 0;
+
+static size_t page_size = 0;
+
+// Statistics, kept up to date as chunks move so mymalloc_stats() doesn't have to walk the heap.
+// All but mmapped_size are guarded by arena_mtx; mapped chunks never take the lock, so it is updated atomically
+static size_t heap_size = 0;
+static size_t mmapped_size = 0;
+static size_t free_bytes = 0;
+static size_t free_chunks = 0;
+static size_t class_free_bytes[NUM_SIZE_CLASSES];
+static size_t class_free_chunks[NUM_SIZE_CLASSES];
+
+// largest free chunk of each size class, and how many free chunks of the class have that size. Only when the
+// last of those leaves the list is the class's largest unknown: bit i of stale_class_max is set, class_max[i]
+// stays an upper bound, and a query rescans the class - if it is the highest non-empty one, as that holds the
+// largest free chunk of all
+static size_t class_max[NUM_SIZE_CLASSES];
+static size_t class_max_count[NUM_SIZE_CLASSES];
+static unsigned long stale_class_max = 0;
+
+// MYMALLOC_STATS_INTERVAL=<seconds> dumps the statistics to stderr at most once per interval, from arena calls
+static long stats_interval = 0;
+static time_t last_stats_dump = 0;
+
+#define PAGE_ALIGN_UP(x) (((x) + page_size - 1) & ~(page_size - 1))
+#define PAGE_ALIGN_DOWN(x) ((x) & ~(page_size - 1))
+
 
 static void
 set_chunk_size_headers(chunk_header *chunk, size_t size)
 {
     chunk->size = size;
-    
+
     // set footer size header
     size_t *footer = (size_t*) (((char*) chunk) + size + SIZE_HEADER_SIZE);
     *footer = size;
 }
 
+static int
+size_class(size_t size)
+{
+    // class i holds sizes in [16 << i, 32 << i)
+    int class = (int) (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(size) - 4;
+    return class < NUM_SIZE_CLASSES ? class : NUM_SIZE_CLASSES - 1;
+}
+
 static chunk_header *
 find_free_chunk(size_t size)
 {
-    chunk_header* current = free_list_head;
-    while (current) {
+    // first fit within the request's own size class, where a chunk may still be too small
+    int class = size_class(size);
+    for (chunk_header* current = free_lists[class]; current; current = current->next) {
         if (CHUNK_SIZE(current) >= size) {
             return current;
         }
-        current = current->next;
+    }
+
+    // any chunk of a higher class is big enough
+    unsigned long higher = nonempty_classes & ~((2UL << class) - 1);
+    if (higher) {
+        return free_lists[__builtin_ctzl(higher)];
     }
     return NULL;
 }
@@ -57,43 +175,97 @@ find_free_chunk(size_t size)
 static chunk_header *
 expand_heap(size_t size)
 {
-    // init
-    if (heap_base == NULL) {
-        heap_base = sbrk(0);  // initialize heap_base to the current break address
-    }
-
-    // align requested size to a multiply of 8
     size_t total_size = size + CHUNK_OVERHEAD;
-    chunk_header* chunk = (chunk_header*) sbrk(total_size);
-    if (chunk == (void*) -1) {
+    char *p = sbrk(total_size);
+    if (p == (void*) -1) {
         return NULL; // sbrk failed
     }
+
+    chunk_header* chunk;
+    if (heap_end != NULL && p == ((char*) heap_end) + SIZE_HEADER_SIZE) {
+        // heap is still contiguous, the new chunk takes over the old epilogue
+        chunk = (chunk_header*) heap_end;
+    } else {
+        // first expansion, or someone else (e.g. glibc malloc) moved the program break since the last one.
+        // start a new segment; the space we just got becomes its prologue and chunk, plus room for the epilogue
+        // and for padding the prologue so the chunk is aligned
+        size_t pad = (SIZE_HEADER_SIZE - (uintptr_t) p) & 15;
+        if (sbrk(pad + SEGMENT_OVERHEAD) != p + total_size) {
+            return NULL; // lost another race for the program break; the space above is leaked
+        }
+        set_chunk_size_headers((chunk_header*) (p + pad), 0); // prologue
+        chunk = (chunk_header*) (p + pad + CHUNK_OVERHEAD);
+        heap_size += pad + SEGMENT_OVERHEAD;
+    }
+    heap_size += total_size;
+
     set_chunk_size_headers(chunk, size);
+    heap_end = (size_t*) (((char*) chunk) + size + CHUNK_OVERHEAD);
+    *heap_end = 0; // epilogue
     return chunk;
 }
 
+// a chunk must be removed with the size it was added with
 static void
 remove_from_free_list(chunk_header *chunk)
 {
+    size_t size = CHUNK_SIZE(chunk);
+    int class = size_class(size);
+
     if (chunk->prev) {
         chunk->prev->next = chunk->next;
     } else {
-        free_list_head = chunk->next;
+        free_lists[class] = chunk->next;
+        if (!chunk->next) {
+            nonempty_classes &= ~(1UL << class);
+        }
     }
     if (chunk->next) {
         chunk->next->prev = chunk->prev;
     }
+
+    free_bytes -= size;
+    free_chunks--;
+    class_free_bytes[class] -= size;
+    if (--class_free_chunks[class] == 0) {
+        class_max[class] = 0;
+        class_max_count[class] = 0;
+        stale_class_max &= ~(1UL << class);
+    } else if (size == class_max[class] && !(stale_class_max & (1UL << class)) && --class_max_count[class] == 0) {
+        stale_class_max |= 1UL << class;
+    }
 }
 
 static void
 add_to_free_list(chunk_header *chunk)
 {
-    chunk->next = free_list_head;
-    if (free_list_head) {
-        free_list_head->prev = chunk;
+    size_t size = CHUNK_SIZE(chunk);
+    int class = size_class(size);
+
+    chunk->next = free_lists[class];
+    if (free_lists[class]) {
+        free_lists[class]->prev = chunk;
     }
-    free_list_head = chunk;
+    free_lists[class] = chunk;
     chunk->prev = NULL;
+    nonempty_classes |= 1UL << class;
+
+    free_bytes += size;
+    free_chunks++;
+    class_free_bytes[class] += size;
+    class_free_chunks[class]++;
+    if (size > class_max[class] || (size == class_max[class] && (stale_class_max & (1UL << class)))) {
+        // a stale maximum is an upper bound that no chunk left on the list reaches
+        class_max[class] = size;
+        class_max_count[class] = 1;
+        stale_class_max &= ~(1UL << class);
+    } else if (size == class_max[class]) {
+        class_max_count[class]++;
+    }
+
+    if (size >= RELEASE_MIN_SIZE) {
+        FREE_EPOCH(chunk) = release_epoch;
+    }
 }
 
 static void
@@ -102,14 +274,14 @@ split_chunk(chunk_header *chunk, size_t size)
     size_t chunk_size_with_headers = size + CHUNK_OVERHEAD;
     if (CHUNK_SIZE(chunk) >= chunk_size_with_headers + MIN_FREE_CHUNK_SIZE) {
         // there's enough space for both the new chunk including headers and at least a minimal free chunk
-        
+
         size_t remaining_size = CHUNK_SIZE(chunk) - chunk_size_with_headers;
 
         chunk_header *new_chunk = (chunk_header*)(((char*) chunk) + chunk_size_with_headers);
         set_chunk_size_headers(new_chunk, remaining_size);
         SET_FREE(new_chunk);
         add_to_free_list(new_chunk);
-        
+
         set_chunk_size_headers(chunk, size);
     }
 }
@@ -117,30 +289,26 @@ split_chunk(chunk_header *chunk, size_t size)
 static chunk_header *
 get_prev_chunk(chunk_header *chunk)
 {
-    chunk_header* prev_chunk_footer = (chunk_header*) (((char*) chunk) - sizeof(size_t));
-    if (((void*) prev_chunk_footer) < heap_base) {
-        return NULL;
-    }
-
-    size_t prev_chunk_size = CHUNK_SIZE(prev_chunk_footer);
+    // there's always a footer before a chunk - at worst the one of the segment prologue
+    size_t prev_chunk_size = *(size_t*) (((char*) chunk) - SIZE_HEADER_SIZE);
     return (chunk_header*) (((char*) chunk) - prev_chunk_size - CHUNK_OVERHEAD);
-
 }
 
-static void
+// merge a chunk that is being freed (and isn't on a free list yet) with its free neighbours
+static chunk_header *
 coalesce(chunk_header *chunk)
 {
-    chunk_header* next_chunk = (chunk_header*)(((char*) chunk) + CHUNK_SIZE(chunk) + CHUNK_OVERHEAD);
+    chunk_header* next_chunk = NEXT_CHUNK(chunk);
     if (IS_FREE(next_chunk)) {
         remove_from_free_list(next_chunk);
         set_chunk_size_headers(chunk, CHUNK_SIZE(chunk)
          + CHUNK_OVERHEAD // absorbed chunk header now becomes part of the space of the coalesced chunk
          + CHUNK_SIZE(next_chunk));
     }
-    
+
     chunk_header* prev_chunk = get_prev_chunk(chunk);
-    if (prev_chunk && IS_FREE(prev_chunk)) {
-        remove_from_free_list(chunk);
+    if (IS_FREE(prev_chunk)) {
+        remove_from_free_list(prev_chunk);
         set_chunk_size_headers(prev_chunk, CHUNK_SIZE(prev_chunk)
          + CHUNK_OVERHEAD // absorbed chunk header now becomes part of the space of the coalesced chunk
          + CHUNK_SIZE(chunk));
@@ -148,29 +316,420 @@ coalesce(chunk_header *chunk)
         // update the current chunk to the previous chunk after merging
         chunk = prev_chunk;
     }
+
+    SET_FREE(chunk);
+    return chunk;
 }
 
-void *
-mymalloc(size_t size)
+static void
+init_page_size(void)
+{
+    if (page_size == 0) {
+        page_size = sysconf(_SC_PAGESIZE);
+    }
+}
+
+static void *
+mmap_alloc(size_t size, size_t alignment)
 {
-    size_t aligned_size = ALIGN_8(size);
+    init_page_size();
+    size_t map_size = PAGE_ALIGN_UP(size + CHUNK_OVERHEAD + (alignment > 16 ? alignment : 0));
+    char *base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    // the rest of the mapping is usable; no footer needed as mapped chunks never get coalesced
+    char *payload = (char*) ALIGN_UP((uintptr_t) base + CHUNK_OVERHEAD, alignment);
+    chunk_header *chunk = PAYLOAD_CHUNK(payload);
+    MMAP_OFFSET(chunk) = ((char*) chunk) - base;
+    chunk->size = (map_size - MMAP_OFFSET(chunk) - SIZE_HEADER_SIZE) | MMAP_FLAG;
+    __atomic_add_fetch(&mmapped_size, map_size, __ATOMIC_RELAXED);
+    return payload;
+}
+
+static void
+mmap_free(chunk_header *chunk)
+{
+    size_t offset = MMAP_OFFSET(chunk);
+    size_t map_size = offset + SIZE_HEADER_SIZE + CHUNK_SIZE(chunk);
+    munmap(((char*) chunk) - offset, map_size);
+    __atomic_sub_fetch(&mmapped_size, map_size, __ATOMIC_RELAXED);
+}
 
-    chunk_header* chunk = find_free_chunk(aligned_size);
+static void *
+mmap_realloc(chunk_header *chunk, size_t size)
+{
+    size_t offset = MMAP_OFFSET(chunk);
+    size_t old_map_size = offset + SIZE_HEADER_SIZE + CHUNK_SIZE(chunk);
+    size_t new_map_size = PAGE_ALIGN_UP(offset + SIZE_HEADER_SIZE + size);
+
+    // let the kernel move the pages instead of copying them
+    char *base = mremap(((char*) chunk) - offset, old_map_size, new_map_size, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    chunk = (chunk_header*) (base + offset);
+    chunk->size = (new_map_size - offset - SIZE_HEADER_SIZE) | MMAP_FLAG;
+    __atomic_add_fetch(&mmapped_size, new_map_size - old_map_size, __ATOMIC_RELAXED); // wraps around when shrinking
+    return CHUNK_PAYLOAD(chunk);
+}
+
+// must be called with arena_mtx held
+static int
+trim_heap(chunk_header *chunk)
+{
+    // only the last chunk of the most recent segment can be trimmed, and only if nobody has moved the
+    // program break above it since (the same check glibc does before shrinking its heap)
+    size_t *chunk_end = (size_t*) (((char*) chunk) + CHUNK_SIZE(chunk) + CHUNK_OVERHEAD);
+    if (chunk_end != heap_end || CHUNK_SIZE(chunk) < TRIM_THRESHOLD) {
+        return 0;
+    }
+    if (sbrk(0) != ((char*) heap_end) + SIZE_HEADER_SIZE) {
+        return 0;
+    }
+
+    size_t trim_size = CHUNK_SIZE(chunk) + CHUNK_OVERHEAD;
+    remove_from_free_list(chunk);
+    if (sbrk(-(intptr_t) trim_size) == (void*) -1) {
+        add_to_free_list(chunk);
+        return 0;
+    }
+
+    // the chunk's header becomes the new epilogue
+    heap_end = (size_t*) chunk;
+    *heap_end = 0;
+    heap_size -= trim_size;
+    return 1;
+}
+
+// must be called with arena_mtx held
+static void
+release_chunk_pages(chunk_header *chunk)
+{
+    // keep the page holding the header and free list pointers, and the one holding the footer
+    init_page_size();
+    uintptr_t start = PAGE_ALIGN_UP((uintptr_t) chunk + sizeof(chunk_header) + sizeof(unsigned long));
+    uintptr_t end = PAGE_ALIGN_DOWN((uintptr_t) chunk + SIZE_HEADER_SIZE + CHUNK_SIZE(chunk));
+    if (end > start) {
+        madvise((void*) start, end - start, MADV_DONTNEED);
+    }
+    chunk->size |= RELEASED_FLAG;
+}
+
+// must be called with arena_mtx held
+static void
+release_free_pages(int all)
+{
+    for (int class = size_class(RELEASE_MIN_SIZE); class < NUM_SIZE_CLASSES; class++) {
+        for (chunk_header *chunk = free_lists[class]; chunk; chunk = chunk->next) {
+            if (CHUNK_SIZE(chunk) < RELEASE_MIN_SIZE || IS_RELEASED(chunk)) {
+                continue;
+            }
+            // a chunk is long-lived once it was freed before the current epoch started
+            if (all || FREE_EPOCH(chunk) < release_epoch) {
+                release_chunk_pages(chunk);
+            }
+        }
+    }
+}
+
+// must be called with arena_mtx held
+static void
+fill_stats(mymalloc_heap_stats *stats)
+{
+    size_t largest_free = 0;
+    if (nonempty_classes) {
+        int top = (int) (sizeof(unsigned long) * 8 - 1) - __builtin_clzl(nonempty_classes);
+        if (stale_class_max & (1UL << top)) {
+            class_max[top] = 0;
+            for (chunk_header *chunk = free_lists[top]; chunk; chunk = chunk->next) {
+                if (CHUNK_SIZE(chunk) > class_max[top]) {
+                    class_max[top] = CHUNK_SIZE(chunk);
+                    class_max_count[top] = 1;
+                } else if (CHUNK_SIZE(chunk) == class_max[top]) {
+                    class_max_count[top]++;
+                }
+            }
+            stale_class_max &= ~(1UL << top);
+        }
+        largest_free = class_max[top];
+    }
+
+    stats->heap_size = heap_size;
+    stats->mmapped_size = __atomic_load_n(&mmapped_size, __ATOMIC_RELAXED);
+    stats->in_use_bytes = heap_size - free_bytes - free_chunks * CHUNK_OVERHEAD + stats->mmapped_size;
+    stats->free_bytes = free_bytes;
+    stats->free_chunks = free_chunks;
+    stats->largest_free_chunk = largest_free;
+    stats->external_fragmentation = free_bytes ? 1.0 - (double) largest_free / free_bytes : 0.0;
+    memcpy(stats->free_bytes_by_class, class_free_bytes, sizeof(class_free_bytes));
+    memcpy(stats->free_chunks_by_class, class_free_chunks, sizeof(class_free_chunks));
+}
+
+// must be called with arena_mtx held. Formats on the stack and uses write(), so it never allocates
+static void
+print_stats(int fd)
+{
+    mymalloc_heap_stats stats;
+    fill_stats(&stats);
+
+    char buf[4096];
+    size_t len = snprintf(buf, sizeof(buf),
+            "mymalloc: heap %zu, mmapped %zu, in use %zu, free %zu in %zu chunks, largest free %zu, "
+            "external fragmentation %.3f\n",
+            stats.heap_size, stats.mmapped_size, stats.in_use_bytes, stats.free_bytes, stats.free_chunks,
+            stats.largest_free_chunk, stats.external_fragmentation);
+    for (int class = 0; class < NUM_SIZE_CLASSES && len < sizeof(buf); class++) {
+        if (stats.free_chunks_by_class[class] > 0) {
+            len += snprintf(buf + len, sizeof(buf) - len, "  free [%zu, %zu): %zu chunks, %zu bytes\n",
+                    (size_t) 16 << class, (size_t) 32 << class,
+                    stats.free_chunks_by_class[class], stats.free_bytes_by_class[class]);
+        }
+    }
+    if (len > sizeof(buf) - 1) {
+        len = sizeof(buf) - 1;
+    }
+    if (write(fd, buf, len) == -1) {
+        // nothing sensible to do about it
+    }
+}
+
+// must be called with arena_mtx held
+static void
+maybe_dump_stats(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (now.tv_sec - last_stats_dump >= stats_interval) {
+        last_stats_dump = now.tv_sec;
+        print_stats(STDERR_FILENO);
+    }
+}
+
+// must be called with arena_mtx held
+static chunk_header *
+arena_alloc(size_t size)
+{
+    if (stats_interval > 0) {
+        maybe_dump_stats();
+    }
+
+    chunk_header* chunk = find_free_chunk(size);
     if (chunk) {
         remove_from_free_list(chunk);
-        split_chunk(chunk, aligned_size);
+        split_chunk(chunk, size);
         SET_ALLOCATED(chunk);
-        return ((char*) chunk) + SIZE_HEADER_SIZE; // return pointer to payload
+        return chunk;
     }
 
     // no big enough chunk found, extend the heap
-    chunk = expand_heap(aligned_size);
+    chunk = expand_heap(size);
     if (!chunk) {
         return NULL; // OOM!
     }
 
     SET_ALLOCATED(chunk);
-    return (void*) (((char*) chunk) + SIZE_HEADER_SIZE); // return pointer to payload
+    return chunk;
+}
+
+// must be called with arena_mtx held
+static void
+arena_free(chunk_header *chunk)
+{
+    if (stats_interval > 0) {
+        maybe_dump_stats();
+    }
+
+    chunk = coalesce(chunk);
+    add_to_free_list(chunk);
+    trim_heap(chunk);
+
+    if (++frees_in_epoch >= RELEASE_INTERVAL) {
+        release_free_pages(0);
+        frees_in_epoch = 0;
+        release_epoch++;
+    }
+}
+
+// must be called with arena_mtx held
+static void
+shrink_chunk(chunk_header *chunk, size_t size)
+{
+    // give the tail of an allocated chunk back to the arena, if it's big enough to form a free chunk
+    if (CHUNK_SIZE(chunk) >= size + CHUNK_OVERHEAD + MIN_FREE_CHUNK_SIZE) {
+        size_t remaining_size = CHUNK_SIZE(chunk) - size - CHUNK_OVERHEAD;
+        set_chunk_size_headers(chunk, size);
+
+        chunk_header *tail = NEXT_CHUNK(chunk);
+        set_chunk_size_headers(tail, remaining_size);
+        arena_free(tail);
+    }
+}
+
+// must be called with arena_mtx held
+static int
+grow_chunk(chunk_header *chunk, size_t size)
+{
+    chunk_header *next_chunk = NEXT_CHUNK(chunk);
+    chunk_header *end = next_chunk;
+    size_t available = CHUNK_SIZE(chunk);
+    if (IS_FREE(next_chunk)) {
+        available += CHUNK_OVERHEAD + CHUNK_SIZE(next_chunk);
+        end = NEXT_CHUNK(next_chunk);
+    }
+
+    if (available < size && (size_t*) end == heap_end && sbrk(0) == ((char*) heap_end) + SIZE_HEADER_SIZE) {
+        // we're at the top of the heap - move the program break rather than the data
+        if (sbrk(size - available) != ((char*) heap_end) + SIZE_HEADER_SIZE) {
+            return 0;
+        }
+        heap_end = (size_t*) (((char*) heap_end) + size - available);
+        *heap_end = 0; // epilogue
+        heap_size += size - available;
+        available = size;
+    }
+    if (available < size) {
+        return 0;
+    }
+
+    // absorb the next chunk, then give back whatever we don't need
+    if (IS_FREE(next_chunk)) {
+        remove_from_free_list(next_chunk);
+    }
+    set_chunk_size_headers(chunk, available);
+    shrink_chunk(chunk, size);
+    return 1;
+}
+
+static void
+tcache_flush_bin(tcache *tc, size_t bin, unsigned int count)
+{
+    pthread_mutex_lock(&arena_mtx);
+    while (count-- > 0 && tc->bins[bin]) {
+        chunk_header *chunk = tc->bins[bin];
+        tc->bins[bin] = chunk->next;
+        tc->counts[bin]--;
+        arena_free(chunk);
+    }
+    pthread_mutex_unlock(&arena_mtx);
+}
+
+static void
+tcache_flush_all(tcache *tc)
+{
+    for (size_t bin = 0; bin < TCACHE_NUM_BINS; bin++) {
+        if (tc->counts[bin] > 0) {
+            tcache_flush_bin(tc, bin, tc->counts[bin]);
+        }
+    }
+}
+
+static void
+tcache_destructor(void *arg)
+{
+    tcache *tc = arg;
+
+    // frees done by later TSD destructors go straight to the arena
+    tc->disabled = 1;
+    tcache_flush_all(tc);
+}
+
+static void
+tcache_create_key(void)
+{
+    if (pthread_key_create(&tcache_key, tcache_destructor) != 0) {
+        abort();
+    }
+}
+
+static tcache *
+get_tcache(void)
+{
+    tcache *tc = &thread_cache;
+    if (!tc->initialized) {
+        // register the cache so its chunks are given back to the arena when the thread exits
+        pthread_once(&tcache_key_once, tcache_create_key);
+        pthread_setspecific(tcache_key, tc);
+        tc->initialized = 1;
+    }
+    return tc;
+}
+
+static chunk_header *
+tcache_get(size_t size)
+{
+    tcache *tc = &thread_cache;
+    size_t bin = TCACHE_BIN(size);
+
+    chunk_header *chunk = tc->bins[bin];
+    if (chunk) {
+        tc->bins[bin] = chunk->next;
+        tc->counts[bin]--;
+    }
+    return chunk;
+}
+
+static int
+tcache_put(chunk_header *chunk)
+{
+    tcache *tc = get_tcache();
+    if (tc->disabled) {
+        return 0;
+    }
+
+    size_t bin = TCACHE_BIN(CHUNK_SIZE(chunk));
+    if (tc->counts[bin] >= TCACHE_BIN_MAX) {
+        tcache_flush_bin(tc, bin, TCACHE_BIN_MAX / 2);
+    }
+
+    chunk->next = tc->bins[bin];
+    tc->bins[bin] = chunk;
+    tc->counts[bin]++;
+    return 1;
+}
+
+static size_t
+aligned_request(size_t size)
+{
+    return size < MIN_PAYLOAD_SIZE ? MIN_PAYLOAD_SIZE : ALIGN_16(size);
+}
+
+void *
+mymalloc(size_t size)
+{
+    if (size > MAX_PAYLOAD_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t aligned_size = aligned_request(size);
+
+    if (aligned_size >= MMAP_THRESHOLD) {
+        void *ptr = mmap_alloc(aligned_size, 16);
+        if (!ptr) {
+            errno = ENOMEM;
+        }
+        return ptr;
+    }
+
+    chunk_header* chunk;
+    if (aligned_size <= TCACHE_MAX_SIZE) {
+        chunk = tcache_get(aligned_size);
+        if (chunk) {
+            return CHUNK_PAYLOAD(chunk);
+        }
+    }
+
+    // cache miss (or a large chunk), go to the shared arena
+    pthread_mutex_lock(&arena_mtx);
+    chunk = arena_alloc(aligned_size);
+    pthread_mutex_unlock(&arena_mtx);
+
+    if (!chunk) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return CHUNK_PAYLOAD(chunk); // return pointer to payload
 }
 
 void
@@ -180,61 +739,212 @@ myfree(void *ptr)
         return;
     }
 
-    chunk_header* chunk = (chunk_header*)(((char*) ptr) - SIZE_HEADER_SIZE);
-    SET_FREE(chunk);
-    add_to_free_list(chunk);
-    coalesce(chunk);
+    // chunks may be freed by any thread - they all belong to the same arena, so the freeing
+    // thread simply caches the chunk (or gives it back to the arena) as if it allocated it
+    chunk_header* chunk = PAYLOAD_CHUNK(ptr);
+    if (IS_MMAPPED(chunk)) {
+        mmap_free(chunk);
+        return;
+    }
+    if (CHUNK_SIZE(chunk) <= TCACHE_MAX_SIZE && tcache_put(chunk)) {
+        return;
+    }
+
+    pthread_mutex_lock(&arena_mtx);
+    arena_free(chunk);
+    pthread_mutex_unlock(&arena_mtx);
 }
 
-// used for testing
-static size_t 
-get_chunk_size(void *chunk_payload)
+void *
+mycalloc(size_t nmemb, size_t size)
 {
-    return CHUNK_SIZE((chunk_header*) (((char*) chunk_payload) - SIZE_HEADER_SIZE));
+    if (size != 0 && nmemb > MAX_PAYLOAD_SIZE / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    void *ptr = mymalloc(nmemb * size);
+    if (ptr && !IS_MMAPPED(PAYLOAD_CHUNK(ptr))) { // fresh mappings are already zeroed
+        memset(ptr, 0, nmemb * size);
+    }
+    return ptr;
 }
 
-int
-main()
+void *
+myrealloc(void *ptr, size_t size)
 {
-    void *ptr1 = mymalloc(100);
+    if (!ptr) {
+        return mymalloc(size);
+    }
+    if (size == 0) {
+        myfree(ptr);
+        return NULL;
+    }
+    if (size > MAX_PAYLOAD_SIZE) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
-    // chunk aligned to multiplies of 8s
-    assert(get_chunk_size(ptr1) == 104);
+    size_t aligned_size = aligned_request(size);
+    chunk_header *chunk = PAYLOAD_CHUNK(ptr);
 
-    void *ptr2 = mymalloc(200);
-    void *ptr3 = mymalloc(50);
+    if (IS_MMAPPED(chunk)) {
+        if (aligned_size >= MMAP_THRESHOLD) {
+            void *new_ptr = mmap_realloc(chunk, aligned_size);
+            if (!new_ptr) {
+                errno = ENOMEM;
+            }
+            return new_ptr;
+        }
+    } else if (aligned_size <= CHUNK_SIZE(chunk)) {
+        pthread_mutex_lock(&arena_mtx);
+        shrink_chunk(chunk, aligned_size);
+        pthread_mutex_unlock(&arena_mtx);
+        return ptr;
+    } else if (aligned_size < MMAP_THRESHOLD) {
+        // grow in place if the next chunk is free (or we're at the top of the heap)
+        pthread_mutex_lock(&arena_mtx);
+        int grown = grow_chunk(chunk, aligned_size);
+        pthread_mutex_unlock(&arena_mtx);
+        if (grown) {
+            return ptr;
+        }
+    }
 
+    // move the data to a new chunk
+    void *new_ptr = mymalloc(size);
+    if (!new_ptr) {
+        return NULL;
+    }
+    memcpy(new_ptr, ptr, CHUNK_SIZE(chunk) < size ? CHUNK_SIZE(chunk) : size);
+    myfree(ptr);
+    return new_ptr;
+}
 
-    // free block gets reallocated
-    myfree(ptr1);
-    void *ptr4 = mymalloc(100);
-    assert(ptr4 == ptr1);
+void *
+mymemalign(size_t alignment, size_t size)
+{
+    if (alignment <= 16) {
+        return mymalloc(size);
+    }
+    if ((alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (size > MAX_PAYLOAD_SIZE || alignment > MAX_PAYLOAD_SIZE / 2) {
+        errno = ENOMEM;
+        return NULL;
+    }
 
+    // room for the chunk, the worst case distance to an aligned payload, and for turning that distance into a free chunk
+    size_t aligned_size = aligned_request(size);
+    size_t padded_size = aligned_size + alignment + MIN_FREE_CHUNK_SIZE;
+    if (padded_size >= MMAP_THRESHOLD) {
+        void *ptr = mmap_alloc(aligned_size, alignment);
+        if (!ptr) {
+            errno = ENOMEM;
+        }
+        return ptr;
+    }
 
-    // coalesce freed block with adjacent blocks
-    size_t ptr1_with_overhead_size = get_chunk_size(ptr1) + CHUNK_OVERHEAD;
-    size_t ptr3_with_overhead_size = get_chunk_size(ptr3) + CHUNK_OVERHEAD;
-    size_t ptr2_size = get_chunk_size(ptr2);
-    myfree(ptr1); // free lower block
-    myfree(ptr3); // free upper block
+    pthread_mutex_lock(&arena_mtx);
+    chunk_header *chunk = arena_alloc(padded_size);
+    if (chunk) {
+        uintptr_t payload = (uintptr_t) CHUNK_PAYLOAD(chunk);
+        if (payload & (alignment - 1)) {
+            // cut the chunk at the first aligned payload that leaves room for a free chunk in front of it
+            uintptr_t aligned_payload = ALIGN_UP(payload + MIN_FREE_CHUNK_SIZE, alignment);
+            size_t lead_size = aligned_payload - payload;
+            chunk_header *aligned_chunk = PAYLOAD_CHUNK(aligned_payload);
+
+            set_chunk_size_headers(aligned_chunk, CHUNK_SIZE(chunk) - lead_size);
+            set_chunk_size_headers(chunk, lead_size - CHUNK_OVERHEAD);
+            arena_free(chunk);
+            chunk = aligned_chunk;
+        }
+        shrink_chunk(chunk, aligned_size);
+    }
+    pthread_mutex_unlock(&arena_mtx);
 
-    myfree(ptr2);
-    size_t ptr1_size = get_chunk_size(ptr1);
-    assert(ptr1_size == ( // we now have one big free block including all allocated space so far
-        ptr1_with_overhead_size + ptr3_with_overhead_size + ptr2_size));
+    if (!chunk) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return CHUNK_PAYLOAD(chunk);
+}
 
-    // split free block
-    char *allocated_chunk = (char*) mymalloc(24);
-    size_t expected_remaining_space = ptr1_size - 24 - CHUNK_OVERHEAD;
-    size_t actual_size = CHUNK_SIZE(free_list_head);
+size_t
+mymalloc_usable_size(void *ptr)
+{
+    if (!ptr) {
+        return 0;
+    }
+    return CHUNK_SIZE(PAYLOAD_CHUNK(ptr));
+}
+
+void
+mymalloc_flush_cache(void)
+{
+    tcache_flush_all(&thread_cache);
+}
 
-    assert(actual_size == expected_remaining_space);
+void
+mymalloc_trim(void)
+{
+    mymalloc_flush_cache();
 
+    pthread_mutex_lock(&arena_mtx);
+    release_free_pages(1);
+    pthread_mutex_unlock(&arena_mtx);
+}
 
-    char *test_str = "This is it.";
-    strcpy(allocated_chunk, test_str);
-    printf("%s\n", allocated_chunk);
-    myfree(allocated_chunk);
+void
+mymalloc_stats(mymalloc_heap_stats *stats)
+{
+    pthread_mutex_lock(&arena_mtx);
+    fill_stats(stats);
+    pthread_mutex_unlock(&arena_mtx);
+}
 
-    return 0;
+void
+mymalloc_stats_print(int fd)
+{
+    pthread_mutex_lock(&arena_mtx);
+    print_stats(fd);
+    pthread_mutex_unlock(&arena_mtx);
+}
+
+static void
+arena_lock_before_fork(void)
+{
+    pthread_mutex_lock(&arena_mtx);
+}
+
+static void
+arena_unlock_in_parent(void)
+{
+    pthread_mutex_unlock(&arena_mtx);
+}
+
+static void
+arena_reset_in_child(void)
+{
+    // the child has a single thread, whatever the others had cached is lost
+    pthread_mutex_init(&arena_mtx, NULL);
+}
+
+static void __attribute__((constructor))
+mymalloc_init(void)
+{
+    // keep the arena consistent across fork(); handlers registered first run last in the prepare phase,
+    // so any handler that allocates does it before we take the lock
+    pthread_atfork(arena_lock_before_fork, arena_unlock_in_parent, arena_reset_in_child);
+
+    const char *interval = getenv("MYMALLOC_STATS_INTERVAL");
+    if (interval) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        last_stats_dump = now.tv_sec; // first dump after one interval
+        stats_interval = atol(interval);
+    }
 }
@@ -0,0 +1,47 @@
+#ifndef MYMALLOC_H
+#define MYMALLOC_H
+
+#include <stddef.h>
+
+void *mymalloc(size_t size);
+void myfree(void *ptr);
+void *mycalloc(size_t nmemb, size_t size);
+
+// grows in place when the next chunk is free, large chunks are moved with mremap()
+void *myrealloc(void *ptr, size_t size);
+
+// alignment must be a power of two
+void *mymemalign(size_t alignment, size_t size);
+
+// number of payload bytes usable in an allocated chunk (may exceed the requested size)
+size_t mymalloc_usable_size(void *ptr);
+
+// return every chunk cached by the calling thread to the shared arena
+// (done automatically when a thread exits)
+void mymalloc_flush_cache(void);
+
+// flush the calling thread's cache and give the pages of all large free chunks back to the OS
+void mymalloc_trim(void);
+
+// free chunks are grouped by power of two size classes: class i holds payloads of [16 << i, 32 << i) bytes
+// (the last class holds everything bigger)
+#define MYMALLOC_NUM_SIZE_CLASSES 32
+
+typedef struct mymalloc_heap_stats {
+    size_t heap_size;       // bytes taken with sbrk()
+    size_t mmapped_size;    // bytes of chunks that have their own mapping
+    size_t in_use_bytes;    // heap and mapped bytes outside free chunks (chunk headers and thread caches included)
+    size_t free_bytes;      // payload bytes of the free chunks in the arena
+    size_t free_chunks;
+    size_t largest_free_chunk;
+    double external_fragmentation; // 1 - largest_free_chunk / free_bytes
+    size_t free_bytes_by_class[MYMALLOC_NUM_SIZE_CLASSES];
+    size_t free_chunks_by_class[MYMALLOC_NUM_SIZE_CLASSES];
+} mymalloc_heap_stats;
+
+// counters are kept up to date by every arena operation, so these don't walk the heap.
+// Setting MYMALLOC_STATS_INTERVAL=<seconds> also prints the stats to stderr periodically
+void mymalloc_stats(mymalloc_heap_stats *stats);
+void mymalloc_stats_print(int fd);
+
+#endif /* MYMALLOC_H */
@@ -0,0 +1,163 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "mymalloc.h"
+
+// Multi-threaded allocation benchmark - mymalloc vs. glibc malloc
+//
+// Each thread keeps NUM_SLOTS live blocks and repeatedly replaces a random one with a new block of a random
+// small size. Every ROUND_OPS operations the threads also hand their blocks to the next thread, which frees
+// them, so cross-thread frees are part of the measured workload.
+
+#define NUM_SLOTS 256
+#define ROUND_OPS 100000
+#define MAX_BLOCK_SIZE 512
+
+typedef struct allocator {
+    const char *name;
+    void *(*alloc)(size_t);
+    void (*release)(void *);
+} allocator;
+
+typedef struct bench_args {
+    const allocator *a;
+    int thread_id;
+    int num_threads;
+    long num_ops;
+    pthread_barrier_t *barrier;
+    void ***slots; // slots[thread_id] - live blocks of each thread
+} bench_args;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [ops-per-thread [thread-count...]]\n", progName);
+    fprintf(stderr, "  ops-per-thread: malloc/free pairs done by each thread (default 1000000)\n");
+    fprintf(stderr, "  thread-count:   thread counts to measure (default 1 2 4 8 16 32)\n");
+    exit(EXIT_FAILURE);
+}
+
+static unsigned int
+xorshift(unsigned int *state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static void *
+bench_thread(void *arg)
+{
+    bench_args *args = arg;
+    const allocator *a = args->a;
+    void **slots = args->slots[args->thread_id];
+    void **peer_slots = args->slots[(args->thread_id + 1) % args->num_threads];
+    unsigned int seed = 2463534242u + args->thread_id;
+
+    for (long done = 0; done < args->num_ops; done += ROUND_OPS) {
+        for (int i = 0; i < NUM_SLOTS; i++) {
+            slots[i] = a->alloc(1 + xorshift(&seed) % MAX_BLOCK_SIZE);
+        }
+
+        long round_ops = min(ROUND_OPS, args->num_ops - done);
+        for (long i = 0; i < round_ops; i++) {
+            int slot = xorshift(&seed) % NUM_SLOTS;
+            a->release(slots[slot]);
+            slots[slot] = a->alloc(1 + xorshift(&seed) % MAX_BLOCK_SIZE);
+            *(char *) slots[slot] = 1; // touch the block
+        }
+
+        // cross-thread frees: release the blocks of the next thread
+        pthread_barrier_wait(args->barrier);
+        for (int i = 0; i < NUM_SLOTS; i++) {
+            a->release(peer_slots[i]);
+        }
+        pthread_barrier_wait(args->barrier);
+    }
+    return NULL;
+}
+
+static double
+run_bench(const allocator *a, int num_threads, long num_ops)
+{
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    bench_args *args = calloc(num_threads, sizeof(bench_args));
+    void ***slots = calloc(num_threads, sizeof(void **));
+    void **slot_mem = calloc((size_t) num_threads * NUM_SLOTS, sizeof(void *));
+    if (!threads || !args || !slots || !slot_mem)
+        errExit("calloc");
+
+    pthread_barrier_t barrier;
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    for (int i = 0; i < num_threads; i++) {
+        slots[i] = slot_mem + (size_t) i * NUM_SLOTS;
+        args[i] = (bench_args) {
+            .a = a, .thread_id = i, .num_threads = num_threads,
+            .num_ops = num_ops, .barrier = &barrier, .slots = slots,
+        };
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < num_threads; i++) {
+        int s = pthread_create(&threads[i], NULL, bench_thread, &args[i]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (int i = 0; i < num_threads; i++) {
+        int s = pthread_join(threads[i], NULL);
+        if (s != 0)
+            errExitEN(s, "pthread_join");
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    pthread_barrier_destroy(&barrier);
+    free(slot_mem);
+    free(slots);
+    free(args);
+    free(threads);
+
+    return (double) num_ops * num_threads / elapsed; // malloc/free pairs per second
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const allocator allocators[] = {
+        { "mymalloc", mymalloc, myfree },
+        { "glibc", malloc, free },
+    };
+    static const int default_threads[] = { 1, 2, 4, 8, 16, 32 };
+
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    long num_ops = argc > 1 ? getLong(argv[1], GN_GT_0, "ops-per-thread") : 1000000;
+
+    int num_counts = argc > 2 ? argc - 2 : (int) (sizeof(default_threads) / sizeof(default_threads[0]));
+    int thread_counts[num_counts];
+    for (int i = 0; i < num_counts; i++)
+        thread_counts[i] = argc > 2 ? getInt(argv[i + 2], GN_GT_0, "thread-count") : default_threads[i];
+
+    printf("Allocation throughput (malloc/free pairs per second, sizes 1-%d bytes)\n", MAX_BLOCK_SIZE);
+    printf("| Threads | mymalloc ops/s | glibc ops/s | mymalloc/glibc |\n");
+    printf("|---------|----------------|-------------|----------------|\n");
+
+    for (int i = 0; i < num_counts; i++) {
+        double ops[2];
+        for (int j = 0; j < 2; j++)
+            ops[j] = run_bench(&allocators[j], thread_counts[i], num_ops);
+        printf("| %7d | %14.0f | %11.0f | %13.2fx |\n",
+               thread_counts[i], ops[0], ops[1], ops[0] / ops[1]);
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <malloc.h>
+
+#include "mymalloc.h"
+
+// Interpose the malloc API with mymalloc, so any dynamically linked program can run on top of it:
+//
+//     LD_PRELOAD=./libmymalloc.so ./some_program
+//
+// glibc routes its own internal allocations through these symbols as well, so replacing malloc, free,
+// calloc and realloc is enough for correctness; the aligned variants and malloc_usable_size are replaced
+// too so memory from them can be given to our free().
+
+
+void *
+malloc(size_t size)
+{
+    return mymalloc(size);
+}
+
+void
+free(void *ptr)
+{
+    myfree(ptr);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    return mycalloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    return myrealloc(ptr, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+
+    int saved_errno = errno;
+    void *ptr = mymemalign(alignment, size);
+    if (!ptr) {
+        int err = errno;
+        errno = saved_errno; // posix_memalign() reports errors only through its return value
+        return err;
+    }
+    *memptr = ptr;
+    return 0;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return mymemalign(alignment, size);
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+    // like glibc, round an alignment that isn't a power of two up to the next one
+    size_t a = 1;
+    while (a < alignment && a < SIZE_MAX / 2) {
+        a <<= 1;
+    }
+    return mymemalign(a, size);
+}
+
+void *
+valloc(size_t size)
+{
+    return mymemalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *
+pvalloc(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page_size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return mymemalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+size_t
+malloc_usable_size(void *ptr)
+{
+    return mymalloc_usable_size(ptr);
+}
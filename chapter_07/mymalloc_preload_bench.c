@@ -0,0 +1,103 @@
+#define _GNU_SOURCE
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+
+// Run a program with glibc malloc and with mymalloc preloaded, and compare wall time and peak RSS
+//
+// e.g. ./mymalloc_preload_bench 5 ./libmymalloc.so ../chapter_12/pstree
+
+typedef struct run_stats {
+    double total_wall;
+    double min_wall;
+    long max_rss_kb;
+} run_stats;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s num-runs preload-lib command [arg...]\n", progName);
+    fprintf(stderr, "  the command's stdout is discarded\n");
+    exit(EXIT_FAILURE);
+}
+
+static void
+run_once(const char *preload, char *argv[], run_stats *stats)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    pid_t pid = fork();
+    switch (pid) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        if (preload != NULL && setenv("LD_PRELOAD", preload, 1) == -1)
+            errExit("setenv");
+
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+            errExit("redirecting stdout");
+        close(fd);
+
+        execvp(argv[0], argv);
+        errExit("execvp %s", argv[0]);
+
+    default:
+        break;
+    }
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) == -1)
+        errExit("wait4");
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fprintf(stderr, "warning: %s (%s) terminated abnormally (status 0x%x)\n",
+                argv[0], preload ? preload : "glibc", status);
+
+    stats->total_wall += wall;
+    if (stats->min_wall == 0 || wall < stats->min_wall)
+        stats->min_wall = wall;
+    if (ru.ru_maxrss > stats->max_rss_kb)
+        stats->max_rss_kb = ru.ru_maxrss;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 4 || strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    int runs = getInt(argv[1], GN_GT_0, "num-runs");
+
+    // LD_PRELOAD needs a path the dynamic linker can open from any working directory
+    char lib[PATH_MAX];
+    if (realpath(argv[2], lib) == NULL)
+        errExit("realpath %s", argv[2]);
+
+    run_stats glibc = { 0 }, mine = { 0 };
+    for (int i = 0; i < runs; i++) {
+        // interleave the runs, so both allocators see the same system noise
+        run_once(NULL, &argv[3], &glibc);
+        run_once(lib, &argv[3], &mine);
+    }
+
+    printf("Command: %s (%d runs each)\n", argv[3], runs);
+    printf("| Allocator | Avg wall (s) | Min wall (s) | Peak RSS (KB) |\n");
+    printf("|-----------|--------------|--------------|---------------|\n");
+    printf("| glibc     | %12.6f | %12.6f | %13ld |\n", glibc.total_wall / runs, glibc.min_wall, glibc.max_rss_kb);
+    printf("| mymalloc  | %12.6f | %12.6f | %13ld |\n", mine.total_wall / runs, mine.min_wall, mine.max_rss_kb);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "mymalloc.h"
+#include "mymalloc_trace.h"
+
+// Replay an allocation trace (see mymalloc_trace.c) against mymalloc or glibc malloc
+//
+// The trace is first translated into operations on dense slot numbers, so the timed replay doesn't pay
+// for mapping traced addresses. Calls are replayed in their recorded (global) order from a single thread.
+// Reports ops/sec, peak footprint (growth over the replay of what the allocator holds from the OS: its heap plus
+// its own mappings, as it reports them after every op), fragmentation ratio (peak footprint / peak live requested
+// bytes) and a log2 histogram of latency for each kind of op.
+
+#define NUM_LATENCY_BUCKETS 32
+#define NUM_OP_TYPES (TRACE_MEMALIGN + 1)
+
+typedef struct replay_op {
+    uint32_t op;
+    uint32_t slot;
+    uint64_t size;
+    uint64_t alignment;
+} replay_op;
+
+typedef struct allocator {
+    const char *name;
+    void *(*alloc)(size_t);
+    void (*release)(void *);
+    void *(*zalloc)(size_t, size_t);
+    void *(*resize)(void *, size_t);
+    void *(*aligned)(size_t, size_t);
+    size_t (*footprint)(void);
+} allocator;
+
+static void *
+glibc_memalign(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+static size_t
+mymalloc_footprint(void)
+{
+    mymalloc_heap_stats stats;
+    mymalloc_stats(&stats);
+    return stats.heap_size + stats.mmapped_size;
+}
+
+// main arena plus mmapped chunks; the replay is single threaded, so there are no other arenas
+static size_t
+glibc_footprint(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    return mi.arena + mi.hblkhd;
+}
+
+static const allocator allocators[] = {
+    { "mymalloc", mymalloc, myfree, mycalloc, myrealloc, mymemalign, mymalloc_footprint },
+    { "glibc", malloc, free, calloc, realloc, glibc_memalign, glibc_footprint },
+};
+
+static const char *op_names[NUM_OP_TYPES] = {
+    [TRACE_MALLOC] = "malloc",
+    [TRACE_FREE] = "free",
+    [TRACE_REALLOC] = "realloc",
+    [TRACE_CALLOC] = "calloc",
+    [TRACE_MEMALIGN] = "memalign",
+};
+
+// open addressing map from traced addresses to slots, used only while translating the trace
+typedef struct addr_map {
+    uint64_t *keys;
+    uint32_t *slots;
+    size_t capacity;
+} addr_map;
+
+#define TOMBSTONE 1 // never a valid allocation address
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s {mymalloc|glibc} trace-file\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+static size_t
+map_index(addr_map *m, uint64_t key)
+{
+    return (key >> 4) * 11400714819323198485ULL & (m->capacity - 1);
+}
+
+static void
+map_put(addr_map *m, uint64_t key, uint32_t slot)
+{
+    size_t i = map_index(m, key);
+    while (m->keys[i] != 0 && m->keys[i] != TOMBSTONE && m->keys[i] != key)
+        i = (i + 1) & (m->capacity - 1);
+    m->keys[i] = key;
+    m->slots[i] = slot;
+}
+
+static Boolean
+map_take(addr_map *m, uint64_t key, uint32_t *slot)
+{
+    for (size_t i = map_index(m, key); m->keys[i] != 0; i = (i + 1) & (m->capacity - 1)) {
+        if (m->keys[i] == key) {
+            *slot = m->slots[i];
+            m->keys[i] = TOMBSTONE;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static replay_op *
+translate(const trace_record *records, size_t num_records, size_t *num_ops, uint32_t *num_slots, uint64_t *peak_live)
+{
+    replay_op *ops = calloc(num_records, sizeof(replay_op));
+    uint64_t *slot_sizes = calloc(num_records + 1, sizeof(uint64_t));
+    addr_map m = { .capacity = 1 };
+    while (m.capacity < num_records * 2)
+        m.capacity <<= 1;
+    m.keys = calloc(m.capacity, sizeof(uint64_t));
+    m.slots = calloc(m.capacity, sizeof(uint32_t));
+    if (!ops || !slot_sizes || !m.keys || !m.slots)
+        errExit("calloc");
+
+    size_t n = 0;
+    uint32_t next_slot = 0;
+    uint64_t live = 0;
+    *peak_live = 0;
+
+    for (size_t i = 0; i < num_records; i++) {
+        const trace_record *r = &records[i];
+        replay_op *op = &ops[n];
+        uint32_t slot;
+
+        switch (r->op) {
+        case TRACE_MALLOC:
+        case TRACE_CALLOC:
+        case TRACE_MEMALIGN:
+            if (r->addr == 0)
+                continue; // the traced call failed
+            slot = next_slot++;
+            map_put(&m, r->addr, slot);
+            *op = (replay_op) { .op = r->op, .slot = slot, .size = r->size, .alignment = r->arg };
+            slot_sizes[slot] = r->size;
+            live += r->size;
+            break;
+
+        case TRACE_FREE:
+            if (!map_take(&m, r->addr, &slot))
+                continue; // allocated before tracing started
+            *op = (replay_op) { .op = TRACE_FREE, .slot = slot };
+            live -= slot_sizes[slot];
+            break;
+
+        case TRACE_REALLOC:
+            if (r->arg == 0 || !map_take(&m, r->arg, &slot)) {
+                // realloc(NULL, size), or of a block we never saw allocated - replay as malloc
+                if (r->addr == 0)
+                    continue;
+                slot = next_slot++;
+                map_put(&m, r->addr, slot);
+                *op = (replay_op) { .op = TRACE_MALLOC, .slot = slot, .size = r->size };
+                slot_sizes[slot] = r->size;
+                live += r->size;
+                break;
+            }
+            if (r->addr == 0) {
+                if (r->size == 0) { // realloc(ptr, 0) frees
+                    *op = (replay_op) { .op = TRACE_FREE, .slot = slot };
+                    live -= slot_sizes[slot];
+                    break;
+                }
+                map_put(&m, r->arg, slot); // failed realloc keeps the old block
+                continue;
+            }
+            map_put(&m, r->addr, slot);
+            *op = (replay_op) { .op = TRACE_REALLOC, .slot = slot, .size = r->size };
+            live += r->size - slot_sizes[slot];
+            slot_sizes[slot] = r->size;
+            break;
+
+        default:
+            fatal("unknown trace op %u at record %zu", r->op, i);
+        }
+
+        if (live > *peak_live)
+            *peak_live = live;
+        n++;
+    }
+
+    free(m.keys);
+    free(m.slots);
+    free(slot_sizes);
+
+    *num_ops = n;
+    *num_slots = next_slot;
+    return ops;
+}
+
+static long long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int
+latency_bucket(long long ns)
+{
+    int b = 0;
+    while (ns > 1 && b < NUM_LATENCY_BUCKETS - 1) {
+        ns >>= 1;
+        b++;
+    }
+    return b;
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc != 3 || strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    const allocator *a = NULL;
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+        if (strcmp(argv[1], allocators[i].name) == 0)
+            a = &allocators[i];
+    if (a == NULL)
+        usageError(argv[0]);
+
+    int fd = open(argv[2], O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", argv[2]);
+    struct stat sb;
+    if (fstat(fd, &sb) == -1)
+        errExit("fstat");
+    if ((size_t) sb.st_size < sizeof(trace_header))
+        fatal("%s: too short for a trace", argv[2]);
+
+    char *data = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        errExit("mmap");
+    close(fd);
+
+    const trace_header *header = (const trace_header *) data;
+    if (header->magic != TRACE_MAGIC || header->version != TRACE_VERSION ||
+            header->record_size != sizeof(trace_record))
+        fatal("%s: not a version %d allocation trace", argv[2], TRACE_VERSION);
+
+    const trace_record *records = (const trace_record *) (data + sizeof(trace_header));
+    size_t num_records = (sb.st_size - sizeof(trace_header)) / sizeof(trace_record);
+
+    size_t num_ops;
+    uint32_t num_slots;
+    uint64_t peak_live;
+    replay_op *ops = translate(records, num_records, &num_ops, &num_slots, &peak_live);
+    munmap(data, sb.st_size);
+
+    void **slots = calloc(num_slots + 1, sizeof(void *));
+    if (slots == NULL)
+        errExit("calloc");
+
+    long long histogram[NUM_OP_TYPES][NUM_LATENCY_BUCKETS] = { { 0 } };
+    long long op_count[NUM_OP_TYPES] = { 0 }, op_ns[NUM_OP_TYPES] = { 0 };
+    long long total_ns = 0;
+    size_t base_footprint = a->footprint();
+    size_t peak_footprint = base_footprint;
+
+    for (size_t i = 0; i < num_ops; i++) {
+        const replay_op *op = &ops[i];
+        long long start = now_ns();
+
+        switch (op->op) {
+        case TRACE_MALLOC:
+            slots[op->slot] = a->alloc(op->size);
+            break;
+        case TRACE_CALLOC:
+            slots[op->slot] = a->zalloc(1, op->size);
+            break;
+        case TRACE_MEMALIGN:
+            slots[op->slot] = a->aligned(op->alignment, op->size);
+            break;
+        case TRACE_REALLOC:
+            slots[op->slot] = a->resize(slots[op->slot], op->size);
+            break;
+        case TRACE_FREE:
+            a->release(slots[op->slot]);
+            slots[op->slot] = NULL;
+            break;
+        }
+
+        long long elapsed = now_ns() - start;
+        total_ns += elapsed;
+        op_count[op->op]++;
+        op_ns[op->op] += elapsed;
+        histogram[op->op][latency_bucket(elapsed)]++;
+
+        // only allocations can grow the footprint
+        if (op->op != TRACE_FREE) {
+            size_t fp = a->footprint();
+            if (fp > peak_footprint)
+                peak_footprint = fp;
+        }
+    }
+
+    size_t peak_kb = (peak_footprint - base_footprint) / 1024;
+    printf("Replay of %s with %s\n", argv[2], a->name);
+    printf("Records: %zu, replayed ops: %zu\n", num_records, num_ops);
+    printf("Ops/sec: %.0f\n", num_ops / (total_ns / 1e9));
+    printf("Peak live requested: %llu KB\n", (unsigned long long) peak_live / 1024);
+    printf("Peak heap footprint (heap + mappings growth): %zu KB\n", peak_kb);
+    printf("Fragmentation ratio: %.3f\n", peak_live ? (peak_footprint - base_footprint) / (double) peak_live : 0.0);
+
+    for (int t = 0; t < NUM_OP_TYPES; t++) {
+        if (op_count[t] == 0)
+            continue;
+        printf("\n%s latency: %lld ops, mean %.0f ns\n", op_names[t], op_count[t], (double) op_ns[t] / op_count[t]);
+        printf("| Latency (ns)      | Ops        | %%      |\n");
+        printf("|-------------------|------------|--------|\n");
+        for (int b = 0; b < NUM_LATENCY_BUCKETS; b++) {
+            if (histogram[t][b] == 0)
+                continue;
+            printf("| %7lld - %-7lld | %10lld | %5.2f%% |\n", b == 0 ? 0 : 1LL << b, (1LL << (b + 1)) - 1,
+                   histogram[t][b], 100.0 * histogram[t][b] / op_count[t]);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
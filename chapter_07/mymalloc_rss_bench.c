@@ -0,0 +1,153 @@
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "mymalloc.h"
+
+// RSS over time under bursty allocation
+//
+// Each burst allocates a large transient working set - blocks big enough to be mmap()ed plus a run of
+// medium heap blocks with a few long-lived small objects sprinkled between them (so the heap top can't
+// always be trimmed) - then frees it and goes back to a steady churn of small and medium blocks.
+// RSS is sampled after every phase. Run once per allocator; RSS is per process.
+
+#define NUM_LARGE 64
+#define LARGE_SIZE (256 * 1024)
+#define NUM_MEDIUM 2048
+#define MEDIUM_MAX_SIZE (32 * 1024)
+#define LONG_LIVED_EVERY 256
+#define CHURN_SLOTS 512
+#define CHURN_OPS 20000
+#define CHURN_MAX_SIZE 4096
+
+typedef struct allocator {
+    const char *name;
+    void *(*alloc)(size_t);
+    void (*release)(void *);
+} allocator;
+
+static const allocator allocators[] = {
+    { "mymalloc", mymalloc, myfree },
+    { "glibc", malloc, free },
+};
+
+static struct timespec start_time;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s {mymalloc|glibc} [num-bursts]\n", progName);
+    exit(EXIT_FAILURE);
+}
+
+static unsigned int
+xorshift(unsigned int *state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+static long
+get_rss_kb(void)
+{
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f == NULL)
+        errExit("fopen /proc/self/statm");
+
+    long size, resident;
+    if (fscanf(f, "%ld %ld", &size, &resident) != 2)
+        fatal("can't parse /proc/self/statm");
+    fclose(f);
+
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static void
+sample(int burst, const char *phase, long *peak_kb)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long ms = (now.tv_sec - start_time.tv_sec) * 1000 + (now.tv_nsec - start_time.tv_nsec) / 1000000;
+
+    long rss = get_rss_kb();
+    if (rss > *peak_kb)
+        *peak_kb = rss;
+    printf("| %7ld | %5d | %-12s | %10ld |\n", ms, burst, phase, rss);
+}
+
+static void
+churn(const allocator *a, void **slots, unsigned int *seed)
+{
+    for (int i = 0; i < CHURN_OPS; i++) {
+        int slot = xorshift(seed) % CHURN_SLOTS;
+        a->release(slots[slot]);
+        size_t size = 1 + xorshift(seed) % CHURN_MAX_SIZE;
+        slots[slot] = a->alloc(size);
+        memset(slots[slot], 1, size);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3 || strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    const allocator *a = NULL;
+    for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); i++)
+        if (strcmp(argv[1], allocators[i].name) == 0)
+            a = &allocators[i];
+    if (a == NULL)
+        usageError(argv[0]);
+
+    int num_bursts = argc > 2 ? getInt(argv[2], GN_GT_0, "num-bursts") : 5;
+
+    static void *large[NUM_LARGE];
+    static void *medium[NUM_MEDIUM];
+    static void *long_lived[NUM_MEDIUM / LONG_LIVED_EVERY * 100];
+    static void *slots[CHURN_SLOTS];
+    int num_long_lived = 0;
+    unsigned int seed = 2463534242u;
+    long peak_kb = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    printf("RSS over time - %s\n", a->name);
+    printf("| time ms | burst | phase        | RSS (KB)   |\n");
+    printf("|---------|-------|--------------|------------|\n");
+
+    for (int i = 0; i < CHURN_SLOTS; i++)
+        slots[i] = a->alloc(1 + xorshift(&seed) % CHURN_MAX_SIZE);
+    sample(0, "baseline", &peak_kb);
+
+    for (int burst = 1; burst <= num_bursts; burst++) {
+        for (int i = 0; i < NUM_LARGE; i++) {
+            large[i] = a->alloc(LARGE_SIZE);
+            memset(large[i], 1, LARGE_SIZE);
+        }
+        for (int i = 0; i < NUM_MEDIUM; i++) {
+            size_t size = 1 + xorshift(&seed) % MEDIUM_MAX_SIZE;
+            medium[i] = a->alloc(size);
+            memset(medium[i], 1, size);
+            if (i % LONG_LIVED_EVERY == 0 && num_long_lived < (int) (sizeof(long_lived) / sizeof(long_lived[0])))
+                long_lived[num_long_lived++] = a->alloc(64);
+        }
+        sample(burst, "burst", &peak_kb);
+
+        for (int i = 0; i < NUM_LARGE; i++)
+            a->release(large[i]);
+        for (int i = 0; i < NUM_MEDIUM; i++)
+            a->release(medium[i]);
+        sample(burst, "after free", &peak_kb);
+
+        churn(a, slots, &seed);
+        sample(burst, "steady", &peak_kb);
+    }
+
+    printf("\nPeak RSS: %ld KB, final RSS: %ld KB\n", peak_kb, get_rss_kb());
+
+    exit(EXIT_SUCCESS);
+}
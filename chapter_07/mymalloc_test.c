@@ -0,0 +1,275 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#include "mymalloc.h"
+
+#define CHUNK_OVERHEAD (2 * sizeof(size_t)) // size header and footer
+
+#define NUM_THREADS 8
+#define NUM_BLOCKS 2000
+
+
+typedef struct thread_args {
+    int thread_id;
+    pthread_barrier_t *barrier;
+    unsigned char **blocks;      // blocks allocated by this thread
+    unsigned char **peer_blocks; // blocks allocated by the next thread, freed by this one
+} thread_args;
+
+
+static size_t
+block_size(int thread_id, int i)
+{
+    return 1 + (thread_id * 7 + i * 13) % 2048; // mix of cached and non-cached sizes
+}
+
+static void *
+cross_thread_worker(void *arg)
+{
+    thread_args *args = arg;
+
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        size_t size = block_size(args->thread_id, i);
+        args->blocks[i] = mymalloc(size);
+        assert(args->blocks[i] != NULL);
+        assert(mymalloc_usable_size(args->blocks[i]) >= size);
+        memset(args->blocks[i], args->thread_id, size);
+    }
+
+    pthread_barrier_wait(args->barrier);
+
+    // free the blocks of our neighbour, verifying nobody else scribbled over them
+    int peer_id = (args->thread_id + 1) % NUM_THREADS;
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        size_t size = block_size(peer_id, i);
+        for (size_t j = 0; j < size; j++) {
+            assert(args->peer_blocks[i][j] == (unsigned char) peer_id);
+        }
+        myfree(args->peer_blocks[i]);
+    }
+
+    // reuse what we just freed (and whatever the arena got back from other threads)
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        void *ptr = mymalloc(block_size(args->thread_id, i));
+        assert(ptr != NULL);
+        myfree(ptr);
+    }
+    return NULL;
+}
+
+static void
+test_large_alloc_and_trim(void)
+{
+    // large requests get their own mapping and don't move the program break
+    void *brk_before = sbrk(0);
+    char *large = mymalloc(1024 * 1024);
+    assert(large != NULL);
+    assert(mymalloc_usable_size(large) >= 1024 * 1024);
+    memset(large, 'x', 1024 * 1024);
+    assert(sbrk(0) == brk_before);
+    myfree(large);
+
+    // a big free chunk at the top of the heap is given back with a negative sbrk()
+    char *a = mymalloc(100 * 1024);
+    char *b = mymalloc(100 * 1024);
+    assert(a != NULL && b != NULL);
+    void *brk_grown = sbrk(0);
+    assert(brk_grown > brk_before);
+    myfree(a);
+    myfree(b);
+    assert(sbrk(0) < brk_grown);
+
+    // trimming leaves the heap usable
+    a = mymalloc(100 * 1024);
+    memset(a, 'y', 100 * 1024);
+    myfree(a);
+    mymalloc_trim();
+}
+
+static void
+test_realloc_and_memalign(void)
+{
+    // grow in place into the free chunk that follows
+    char *a = mymalloc(200);
+    char *b = mymalloc(200);
+    char *guard = mymalloc(200); // keeps b from being the top chunk
+    memset(a, 'a', 200);
+    myfree(b);
+    mymalloc_flush_cache();
+    char *grown = myrealloc(a, 400);
+    assert(grown == a);
+    for (int i = 0; i < 200; i++) {
+        assert(grown[i] == 'a');
+    }
+
+    // shrinking stays in place too
+    assert(myrealloc(grown, 50) == grown);
+    assert(mymalloc_usable_size(grown) == 64);
+
+    // no room to grow - the data moves
+    char *c = mymalloc(100);
+    strcpy(c, "moved");
+    char *d = mymalloc(100);
+    char *moved = myrealloc(c, 4000);
+    assert(moved != c && strcmp(moved, "moved") == 0);
+    myfree(d);
+    myfree(moved);
+    myfree(grown);
+    myfree(guard);
+
+    // large chunks are resized with mremap()
+    char *large = myrealloc(NULL, 200 * 1024);
+    memset(large, 'l', 200 * 1024);
+    large = myrealloc(large, 2 * 1024 * 1024);
+    assert(large[200 * 1024 - 1] == 'l');
+    myfree(large);
+
+    char *zeroed = mycalloc(100, 10);
+    for (int i = 0; i < 1000; i++) {
+        assert(zeroed[i] == 0);
+    }
+    myfree(zeroed);
+
+    size_t alignments[] = { 16, 64, 4096, 256 * 1024 };
+    for (size_t i = 0; i < sizeof(alignments) / sizeof(alignments[0]); i++) {
+        char *p = mymemalign(alignments[i], 1000);
+        assert(p != NULL && ((uintptr_t) p & (alignments[i] - 1)) == 0);
+        assert(mymalloc_usable_size(p) >= 1000);
+        memset(p, 'm', 1000);
+        myfree(p);
+    }
+}
+
+static void
+test_heap_stats(void)
+{
+    mymalloc_heap_stats before, during, after;
+    mymalloc_flush_cache();
+    mymalloc_stats(&before);
+
+    // whatever the allocation is carved from and whatever the free coalesces with, a chunk moves exactly
+    // its size plus headers in and out of use
+    char *p = mymalloc(20000);
+    mymalloc_stats(&during);
+    assert(during.in_use_bytes == before.in_use_bytes + mymalloc_usable_size(p) + CHUNK_OVERHEAD);
+    myfree(p);
+    mymalloc_stats(&after);
+    assert(after.in_use_bytes == before.in_use_bytes);
+
+    char *large = mymalloc(300 * 1024);
+    mymalloc_stats(&during);
+    assert(during.mmapped_size >= before.mmapped_size + 300 * 1024);
+    myfree(large);
+    mymalloc_stats(&after);
+    assert(after.mmapped_size == before.mmapped_size);
+
+    // the per class counters add up, and the largest free chunk sits in the highest non-empty class
+    size_t bytes = 0, chunks = 0;
+    int top = -1;
+    for (int i = 0; i < MYMALLOC_NUM_SIZE_CLASSES; i++) {
+        bytes += after.free_bytes_by_class[i];
+        chunks += after.free_chunks_by_class[i];
+        if (after.free_chunks_by_class[i] > 0)
+            top = i;
+    }
+    assert(bytes == after.free_bytes && chunks == after.free_chunks);
+    assert(after.heap_size >= after.free_bytes + after.free_chunks * CHUNK_OVERHEAD);
+    if (top >= 0) {
+        assert(after.largest_free_chunk >= (size_t) 16 << top && after.largest_free_chunk < (size_t) 32 << top);
+        assert(after.external_fragmentation >= 0.0 && after.external_fragmentation < 1.0);
+    }
+}
+
+static void
+test_cross_thread_free(void)
+{
+    pthread_t threads[NUM_THREADS];
+    thread_args args[NUM_THREADS];
+    unsigned char *blocks[NUM_THREADS][NUM_BLOCKS];
+    pthread_barrier_t barrier;
+
+    pthread_barrier_init(&barrier, NULL, NUM_THREADS);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        args[i] = (thread_args) {
+            .thread_id = i,
+            .barrier = &barrier,
+            .blocks = blocks[i],
+            .peer_blocks = blocks[(i + 1) % NUM_THREADS],
+        };
+    }
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, cross_thread_worker, &args[i]);
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&barrier);
+}
+
+int
+main()
+{
+    void *ptr1 = mymalloc(100);
+
+    // chunk aligned to multiplies of 16s
+    assert(mymalloc_usable_size(ptr1) == 112);
+    assert(((uintptr_t) ptr1 & 15) == 0);
+
+    void *ptr2 = mymalloc(200);
+    void *ptr3 = mymalloc(50);
+
+
+    // free block gets reallocated
+    myfree(ptr1);
+    void *ptr4 = mymalloc(100);
+    assert(ptr4 == ptr1);
+
+
+    // coalesce freed block with adjacent blocks
+    size_t ptr1_with_overhead_size = mymalloc_usable_size(ptr1) + CHUNK_OVERHEAD;
+    size_t ptr3_with_overhead_size = mymalloc_usable_size(ptr3) + CHUNK_OVERHEAD;
+    size_t ptr2_size = mymalloc_usable_size(ptr2);
+    myfree(ptr1); // free lower block
+    myfree(ptr3); // free upper block
+
+    myfree(ptr2);
+    mymalloc_flush_cache(); // small chunks sit in the thread cache until flushed back to the arena
+    size_t ptr1_size = mymalloc_usable_size(ptr1);
+    assert(ptr1_size == ( // we now have one big free block including all allocated space so far
+        ptr1_with_overhead_size + ptr3_with_overhead_size + ptr2_size));
+
+    // split free block
+    char *allocated_chunk = (char*) mymalloc(32);
+    assert(allocated_chunk == ptr1);
+    size_t expected_remaining_space = ptr1_size - 32 - CHUNK_OVERHEAD;
+
+    // the remainder is the only free chunk left, right after the allocated one
+    char *remaining_chunk = mymalloc(expected_remaining_space);
+    assert(remaining_chunk == allocated_chunk + 32 + CHUNK_OVERHEAD);
+    assert(mymalloc_usable_size(remaining_chunk) == expected_remaining_space);
+    myfree(remaining_chunk);
+
+
+    char *test_str = "This is it.";
+    strcpy(allocated_chunk, test_str);
+    printf("%s\n", allocated_chunk);
+    myfree(allocated_chunk);
+
+    test_large_alloc_and_trim();
+    printf("Large allocations and trimming OK\n");
+
+    test_realloc_and_memalign();
+    printf("realloc, calloc and memalign OK\n");
+
+    test_heap_stats();
+    printf("Heap stats OK\n");
+
+    // chunks allocated by one thread and freed by another
+    test_cross_thread_free();
+    printf("Cross-thread frees OK\n");
+
+    return 0;
+}
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <malloc.h>
+
+#include "mymalloc_trace.h"
+
+// Allocation tracing shim - record malloc/free/realloc (plus calloc and the aligned variants, valloc and pvalloc
+// included, so that every freed pointer has a matching allocation) to ${MALLOC_TRACE_FILE:-malloc_trace}.<pid>:
+//
+//     LD_PRELOAD=$PWD/libmymalloc_trace.so some_program
+//
+// Records go through one buffer guarded by a mutex, so the file keeps the global order of the calls.
+// The pid suffix keeps exec()ed children from clobbering the parent's trace; forked children stop tracing.
+
+#define BUFFER_RECORDS 4096
+#define BOOTSTRAP_SIZE 8192
+
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+
+// dlsym() may allocate before we know where the real calloc is
+static char bootstrap_buf[BOOTSTRAP_SIZE] __attribute__((aligned(16)));
+static size_t bootstrap_used = 0;
+static int resolving = 0;
+
+static pthread_mutex_t trace_mtx = PTHREAD_MUTEX_INITIALIZER;
+static trace_record buffer[BUFFER_RECORDS];
+static int buffered = 0;
+static int trace_fd = -1;
+static int tracing = 0;
+static struct timespec start_time;
+
+static unsigned int next_thread_id = 0;
+static __thread unsigned int thread_id __attribute__((tls_model("initial-exec")));
+static __thread int in_trace __attribute__((tls_model("initial-exec")));
+
+
+static void
+flush_buffer(void)
+{
+    if (trace_fd != -1 && buffered > 0) {
+        size_t len = buffered * sizeof(trace_record);
+        char *p = (char *) buffer;
+        while (len > 0) {
+            ssize_t n = write(trace_fd, p, len);
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            p += n;
+            len -= n;
+        }
+    }
+    buffered = 0;
+}
+
+// append a record; the caller holds trace_mtx
+static void
+record_locked(enum trace_op op, void *addr, size_t size, uint64_t arg)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if (thread_id == 0) {
+        thread_id = __atomic_add_fetch(&next_thread_id, 1, __ATOMIC_RELAXED);
+    }
+
+    if (tracing) {
+        trace_record *r = &buffer[buffered++];
+        r->timestamp = (now.tv_sec - start_time.tv_sec) * 1000000000ULL + now.tv_nsec - start_time.tv_nsec;
+        r->addr = (uintptr_t) addr;
+        r->size = size;
+        r->arg = arg;
+        r->thread = thread_id;
+        r->op = op;
+        if (buffered == BUFFER_RECORDS) {
+            flush_buffer();
+        }
+    }
+}
+
+static void
+record(enum trace_op op, void *addr, size_t size, uint64_t arg)
+{
+    if (!tracing || in_trace) {
+        return;
+    }
+
+    pthread_mutex_lock(&trace_mtx);
+    record_locked(op, addr, size, arg);
+    pthread_mutex_unlock(&trace_mtx);
+}
+
+static void
+stop_tracing_in_child(void)
+{
+    // the buffer holds the parent's records, and the file is the parent's
+    pthread_mutex_init(&trace_mtx, NULL);
+    tracing = 0;
+    buffered = 0;
+    if (trace_fd != -1) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+}
+
+static void
+resolve_symbols(void)
+{
+    // other constructors may allocate before ours runs, so this happens on first use.
+    // (the casts are the POSIX-blessed way to assign dlsym() results to function pointers)
+    resolving = 1;
+    *(void **) (&real_free) = dlsym(RTLD_NEXT, "free");
+    *(void **) (&real_calloc) = dlsym(RTLD_NEXT, "calloc");
+    *(void **) (&real_realloc) = dlsym(RTLD_NEXT, "realloc");
+    *(void **) (&real_posix_memalign) = dlsym(RTLD_NEXT, "posix_memalign");
+    *(void **) (&real_aligned_alloc) = dlsym(RTLD_NEXT, "aligned_alloc");
+    *(void **) (&real_memalign) = dlsym(RTLD_NEXT, "memalign");
+    *(void **) (&real_malloc) = dlsym(RTLD_NEXT, "malloc");
+    resolving = 0;
+}
+
+static void __attribute__((constructor))
+trace_init(void)
+{
+    in_trace = 1; // don't trace our own allocations (getenv, pthread_atfork, ...)
+
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+
+    const char *prefix = getenv("MALLOC_TRACE_FILE");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s.%ld", prefix ? prefix : "malloc_trace", (long) getpid());
+
+    trace_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (trace_fd != -1) {
+        trace_header header = {
+            .magic = TRACE_MAGIC,
+            .version = TRACE_VERSION,
+            .record_size = sizeof(trace_record),
+            .pid = getpid(),
+        };
+        if (write(trace_fd, &header, sizeof(header)) == sizeof(header)) {
+            clock_gettime(CLOCK_MONOTONIC, &start_time);
+            pthread_atfork(NULL, NULL, stop_tracing_in_child);
+            tracing = 1;
+        }
+    }
+
+    in_trace = 0;
+}
+
+static void __attribute__((destructor))
+trace_fini(void)
+{
+    pthread_mutex_lock(&trace_mtx);
+    flush_buffer();
+    tracing = 0;
+    pthread_mutex_unlock(&trace_mtx);
+}
+
+static void *
+bootstrap_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t) 15;
+    if (bootstrap_used + size > BOOTSTRAP_SIZE) {
+        return NULL;
+    }
+    void *ptr = bootstrap_buf + bootstrap_used;
+    bootstrap_used += size;
+    return ptr; // static storage, already zeroed
+}
+
+static int
+is_bootstrap(void *ptr)
+{
+    return (char *) ptr >= bootstrap_buf && (char *) ptr < bootstrap_buf + BOOTSTRAP_SIZE;
+}
+
+void *
+malloc(size_t size)
+{
+    if (resolving) {
+        return bootstrap_alloc(size);
+    }
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+    void *ptr = real_malloc(size);
+    record(TRACE_MALLOC, ptr, size, 0);
+    return ptr;
+}
+
+void
+free(void *ptr)
+{
+    if (!ptr || is_bootstrap(ptr)) {
+        return;
+    }
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+    record(TRACE_FREE, ptr, 0, 0);
+    real_free(ptr);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+    if (resolving) {
+        return bootstrap_alloc(nmemb * size);
+    }
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+    void *ptr = real_calloc(nmemb, size);
+    record(TRACE_CALLOC, ptr, nmemb * size, 0);
+    return ptr;
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+    if (!real_malloc && !resolving) {
+        resolve_symbols();
+    }
+    if (is_bootstrap(ptr) || resolving) {
+        void *new_ptr = malloc(size);
+        if (!ptr) {
+            return new_ptr;
+        }
+        if (new_ptr) {
+            size_t avail = bootstrap_buf + BOOTSTRAP_SIZE - (char *) ptr;
+            memcpy(new_ptr, ptr, size < avail ? size : avail);
+        }
+        return new_ptr;
+    }
+    if (!tracing || in_trace) {
+        return real_realloc(ptr, size);
+    }
+
+    // realloc() may free the old block, and another thread may get its address from malloc() and record that
+    // before we record the realloc - the replay would then give the realloc the wrong block. Holding the trace
+    // lock across the call keeps the two in order; in_trace keeps anything real_realloc() allocates from
+    // recording (and taking the lock again)
+    pthread_mutex_lock(&trace_mtx);
+    in_trace = 1;
+    void *new_ptr = real_realloc(ptr, size);
+    in_trace = 0;
+    record_locked(TRACE_REALLOC, new_ptr, size, (uintptr_t) ptr);
+    pthread_mutex_unlock(&trace_mtx);
+    return new_ptr;
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+    int err = real_posix_memalign(memptr, alignment, size);
+    if (err == 0) {
+        record(TRACE_MEMALIGN, *memptr, size, alignment);
+    }
+    return err;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+    void *ptr = real_aligned_alloc(alignment, size);
+    record(TRACE_MEMALIGN, ptr, size, alignment);
+    return ptr;
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+    if (!real_malloc) {
+        resolve_symbols();
+    }
+    void *ptr = real_memalign(alignment, size);
+    record(TRACE_MEMALIGN, ptr, size, alignment);
+    return ptr;
+}
+
+// valloc() and pvalloc() are page aligned memalign() calls; going through the real memalign() rather than
+// glibc's own valloc()/pvalloc() lets the replay treat them as one
+void *
+valloc(size_t size)
+{
+    return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *
+pvalloc(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - page_size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page_size, size ? (size + page_size - 1) & ~(page_size - 1) : page_size);
+}
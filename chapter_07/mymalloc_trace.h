@@ -0,0 +1,36 @@
+#ifndef MYMALLOC_TRACE_H
+#define MYMALLOC_TRACE_H
+
+#include <stdint.h>
+
+// Binary allocation trace, as written by libmymalloc_trace.so and read by mymalloc_replay:
+// a trace_header followed by fixed size trace_records, in the order the calls completed.
+
+#define TRACE_MAGIC 0x4352544dU // "MTRC"
+#define TRACE_VERSION 1
+
+enum trace_op {
+    TRACE_MALLOC = 1,
+    TRACE_FREE,
+    TRACE_REALLOC,
+    TRACE_CALLOC,
+    TRACE_MEMALIGN,
+};
+
+typedef struct trace_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size;
+    uint32_t pid;
+} trace_header;
+
+typedef struct trace_record {
+    uint64_t timestamp; // ns since the traced process started tracing
+    uint64_t addr;      // pointer returned (or freed, for TRACE_FREE)
+    uint64_t size;      // requested size (nmemb * size for calloc)
+    uint64_t arg;       // old pointer for TRACE_REALLOC, alignment for TRACE_MEMALIGN
+    uint32_t thread;    // small sequential id of the calling thread
+    uint32_t op;        // enum trace_op
+} trace_record;
+
+#endif /* MYMALLOC_TRACE_H */
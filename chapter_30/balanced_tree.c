@@ -0,0 +1,359 @@
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+
+#include "tlpi_hdr.h"
+#include "threadsafe_tree.h"
+#include "epoch.h"
+
+// Balanced implementation of the threadsafe_tree.h API - a treap.
+//
+// Every node gets a priority (a hash of its key), and besides being a binary search tree by key, the tree is a
+// max-heap by priority. Priorities are effectively random, so the tree has the shape of a randomly built BST
+// (expected depth O(log n)) whatever the insertion order is - sorted keys included.
+//
+// The point of a treap here is that insertion and deletion restructure the tree top-down, in a single pass:
+// * add() walks down until the new node outranks the current one, puts the new node there, and splits the
+//   subtree it replaced into its left and right children
+// * delete() replaces the node with the merge of its two subtrees
+// So, like the plain tree, every update locks its way down hand-over-hand and only modifies nodes it holds
+// locked, always taking locks parent before child. Red-black and AVL trees rebalance bottom-up, which would
+// mean locking whole paths (or the whole tree).
+//
+// lookup() takes no locks at all. It validates what it reads against per node versions instead, bumped
+// around every change of a node's links and odd while a change is under way:
+// * a split or a merge keeps every node it takes over odd until it's done with it. They work top-down, so a
+//   node is odd before the links of any node below it change - which is the only way keys leave its subtree
+// * the new node of a split, and the deleted node and its parent during a merge, stay odd for the whole
+//   operation, so no reader can get into the part of the tree being restructured once it started
+// A reader moves from a node to its child only after checking the node's version didn't change since it read
+// the link and the child's version, so the child's subtree held the key (if it was in the tree) at that moment.
+// Whenever a validation fails, the lookup starts over from the root. Nodes and keys are freed through epoch
+// based reclamation (epoch.c), so a reader never touches freed memory.
+//
+// The tree returned by new_tree() is a sentinel that never holds a key; its left child is the root of the treap.
+// That way rotating a new node into the root position never moves the node the caller holds.
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+struct TreeNode {
+    struct TreeNode *left;
+    struct TreeNode *right;
+    pthread_mutex_t mtx;
+    char *key;
+    void *value;
+    unsigned int priority; // heap order
+    unsigned long version; // odd while the node's links are being changed
+};
+
+__thread TreeLockStats tree_lock_stats;
+
+
+static unsigned int
+key_priority(const char *key)
+{
+    // FNV-1a, followed by a finalizer mixing the bits so that similar keys get unrelated priorities
+    unsigned int h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) key; *p; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static void
+write_begin(struct TreeNode *node)
+{
+    // the odd version has to be visible before any of the changes it covers
+    __atomic_store_n(&node->version, node->version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void
+write_end(struct TreeNode *node)
+{
+    __atomic_store_n(&node->version, node->version + 1, __ATOMIC_RELEASE);
+}
+
+static void
+set_link(struct TreeNode *owner, struct TreeNode **link, struct TreeNode *child)
+{
+    write_begin(owner);
+    STORE(*link, child);
+    write_end(owner);
+}
+
+// a node taken over by a split or a merge is locked and kept odd until the operation is done with it
+static void
+acquire(struct TreeNode *node)
+{
+    tree_lock(&node->mtx);
+    write_begin(node);
+}
+
+static void
+release(struct TreeNode *node)
+{
+    write_end(node);
+    pthread_mutex_unlock(&node->mtx);
+}
+
+static unsigned long
+stable_version(struct TreeNode *node)
+{
+    unsigned long version;
+    while ((version = LOAD(node->version)) & 1)
+        sched_yield(); // the writer holds locks and may be waiting for one - let it run
+    return version;
+}
+
+static Boolean
+version_unchanged(struct TreeNode *node, unsigned long version)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // order the reads being validated before the check
+    return __atomic_load_n(&node->version, __ATOMIC_RELAXED) == version;
+}
+
+static struct TreeNode *
+new_node(char *key, void *value)
+{
+    struct TreeNode *node = new_tree();
+    node->key = strdup(key);
+    node->value = value;
+    node->priority = key_priority(key);
+    return node;
+}
+
+static void
+free_node(void *arg)
+{
+    struct TreeNode *node = arg;
+    free(node->key);
+    pthread_mutex_destroy(&node->mtx);
+    free(node);
+}
+
+static void
+delete_node(struct TreeNode *node)
+{
+    // lock-free readers may still be looking at it
+    pthread_mutex_unlock(&node->mtx);
+    epoch_retire(node, free_node);
+}
+
+struct TreeNode *
+new_tree()
+{
+    struct TreeNode *tree = (struct TreeNode *) malloc(sizeof(struct TreeNode));
+    if (tree == NULL) {
+        errExit("malloc");
+    }
+    initialize(tree);
+    return tree;
+}
+
+
+void
+initialize(struct TreeNode *tree)
+{
+    pthread_mutex_init(&tree->mtx, NULL);
+    tree->key = NULL;
+    tree->value = NULL;
+    tree->left = NULL;
+    tree->right = NULL;
+    tree->priority = UINT_MAX;
+    tree->version = 0;
+}
+
+
+void
+add(struct TreeNode *tree, char *key, void *value)
+{
+    unsigned int priority = key_priority(key);
+
+    // walk down while the nodes on the way outrank the new key. A node with the same key has the same
+    // priority, so if the key is already in the tree we meet it before stopping
+    tree_lock(&tree->mtx);
+    struct TreeNode *parent = tree;
+    struct TreeNode **link = &tree->left;
+
+    while (*link && (*link)->priority >= priority) { // priorities never change, no need to lock for reading them
+        struct TreeNode *curr = *link;
+        tree_lock(&curr->mtx);
+
+        int cmp = strcmp(key, curr->key);
+        if (cmp == 0) {
+            STORE(curr->value, value);
+            pthread_mutex_unlock(&curr->mtx);
+            pthread_mutex_unlock(&parent->mtx);
+            return;
+        }
+
+        pthread_mutex_unlock(&parent->mtx);
+        parent = curr;
+        link = cmp < 0 ? &curr->left : &curr->right;
+    }
+
+    // the new node takes the place of the subtree below; lock it before making it visible, and keep its
+    // version odd until it has all of the subtree's keys below it again
+    struct TreeNode *node = new_node(key, value);
+    pthread_mutex_lock(&node->mtx);
+    node->version = 1;
+    struct TreeNode *curr = *link;
+    set_link(parent, link, node);
+    pthread_mutex_unlock(&parent->mtx);
+
+    // split the subtree by the new key: nodes with smaller keys hang along the right spine of node->left,
+    // the others along the left spine of node->right. The owner of each spine's open link stays acquired
+    // until that link is final, and the new node until the split is done - a writer getting past it would
+    // change versions inside a subtree that readers can't trust yet
+    struct TreeNode *left_owner = node, *right_owner = node;
+    struct TreeNode **left_link = &node->left, **right_link = &node->right;
+
+    while (curr) {
+        acquire(curr);
+        if (strcmp(curr->key, key) < 0) {
+            STORE(*left_link, curr);
+            if (left_owner != node && left_owner != right_owner)
+                release(left_owner);
+            left_owner = curr;
+            left_link = &curr->right;
+            curr = curr->right;
+        } else {
+            STORE(*right_link, curr);
+            if (right_owner != node && right_owner != left_owner)
+                release(right_owner);
+            right_owner = curr;
+            right_link = &curr->left;
+            curr = curr->left;
+        }
+    }
+
+    // the open link of one spine still points at a node that moved to the other one
+    STORE(*left_link, NULL);
+    STORE(*right_link, NULL);
+    if (left_owner != node)
+        release(left_owner);
+    if (right_owner != node)
+        release(right_owner);
+    release(node);
+}
+
+
+void
+delete(struct TreeNode *tree, char *key)
+{
+    if (!tree) return;
+
+    // find the node, holding its parent locked
+    tree_lock(&tree->mtx);
+    struct TreeNode *parent = tree;
+    struct TreeNode **link = &tree->left;
+    struct TreeNode *curr;
+
+    for (;;) {
+        curr = *link;
+        if (curr == NULL) {
+            pthread_mutex_unlock(&parent->mtx); // no node found
+            return;
+        }
+
+        tree_lock(&curr->mtx);
+        int cmp = strcmp(key, curr->key);
+        if (cmp == 0)
+            break;
+
+        pthread_mutex_unlock(&parent->mtx);
+        parent = curr;
+        link = cmp < 0 ? &curr->left : &curr->right;
+    }
+
+    // replace the node with the merge of its subtrees: the higher priority of the two subtree roots takes the
+    // open link, and the merge continues into its inner side. Nobody can reach the detached subtree roots
+    // (they hang off the locked node being deleted), and we acquire a root before changing its links.
+    // Until the merge is done a subtree root may be detached, so the parent stays acquired, and so does the
+    // deleted node (readers that already got to it would follow its stale links)
+    write_begin(parent);
+    write_begin(curr);
+    struct TreeNode *owner = parent;
+    struct TreeNode *left = curr->left, *right = curr->right;
+
+    while (left && right) {
+        struct TreeNode *next;
+        struct TreeNode **next_link;
+        if (left->priority > right->priority) {
+            next = left;
+            acquire(next); // before reading its links
+            next_link = &left->right;
+            left = left->right;
+        } else {
+            next = right;
+            acquire(next);
+            next_link = &right->left;
+            right = right->left;
+        }
+
+        STORE(*link, next);
+        if (owner != parent)
+            release(owner);
+        owner = next;
+        link = next_link;
+    }
+
+    STORE(*link, left ? left : right);
+    if (owner != parent)
+        release(owner);
+    write_end(curr);
+    release(parent);
+
+    // unlinked the moment the parent's link was overwritten; no writer waits on it as we held the parent until then
+    delete_node(curr);
+}
+
+
+Boolean
+lookup(struct TreeNode *tree, char *key, void **value)
+{
+    if (tree == NULL)
+        return FALSE;
+
+    Boolean found = FALSE;
+    epoch_enter();
+
+retry:
+    ;
+    struct TreeNode *node = tree;
+    unsigned long version = stable_version(node);
+    int cmp = -1; // the sentinel's tree hangs on its left
+
+    for (;;) {
+        struct TreeNode *child = cmp < 0 ? LOAD(node->left) : LOAD(node->right);
+        unsigned long child_version = child ? stable_version(child) : 0;
+        if (!version_unchanged(node, version))
+            goto retry;
+
+        if (child == NULL)
+            break;
+
+        // keys never change while a node is in the tree, and aren't freed before we leave the epoch
+        cmp = strcmp(key, child->key);
+        if (cmp == 0) {
+            *value = LOAD(child->value);
+            found = TRUE;
+            break;
+        }
+
+        node = child;
+        version = child_version;
+    }
+
+    epoch_exit();
+    return found;
+}
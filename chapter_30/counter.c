@@ -0,0 +1,101 @@
+#include <pthread.h>
+
+#include "tlpi_hdr.h"
+#include "counter.h"
+
+// every thread gets the next shard index the first time it adds to a sharded counter; the same index is used
+// (modulo the number of shards) for all sharded counters
+static int next_shard_index = 0;
+static __thread int my_shard_index = -1;
+
+
+void
+mutex_counter_init(MutexCounter *counter)
+{
+    int s = pthread_mutex_init(&counter->mtx, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_mutex_init");
+    counter->value = 0;
+}
+
+void
+mutex_counter_add(MutexCounter *counter, long n)
+{
+    pthread_mutex_lock(&counter->mtx);
+    counter->value += n;
+    pthread_mutex_unlock(&counter->mtx);
+}
+
+long
+mutex_counter_read(MutexCounter *counter)
+{
+    pthread_mutex_lock(&counter->mtx);
+    long value = counter->value;
+    pthread_mutex_unlock(&counter->mtx);
+    return value;
+}
+
+void
+mutex_counter_destroy(MutexCounter *counter)
+{
+    pthread_mutex_destroy(&counter->mtx);
+}
+
+
+void
+atomic_counter_init(AtomicCounter *counter)
+{
+    counter->value = 0;
+}
+
+void
+atomic_counter_add(AtomicCounter *counter, long n)
+{
+    // a counter orders nothing else, relaxed is enough
+    __atomic_fetch_add(&counter->value, n, __ATOMIC_RELAXED);
+}
+
+long
+atomic_counter_read(AtomicCounter *counter)
+{
+    return __atomic_load_n(&counter->value, __ATOMIC_RELAXED);
+}
+
+
+void
+sharded_counter_init(ShardedCounter *counter, int num_shards)
+{
+    int s = posix_memalign((void **) &counter->shards, CACHE_LINE_SIZE, num_shards * sizeof(CounterShard));
+    if (s != 0)
+        errExitEN(s, "posix_memalign");
+    for (int i = 0; i < num_shards; i++)
+        counter->shards[i].value = 0;
+    counter->num_shards = num_shards;
+}
+
+void
+sharded_counter_add(ShardedCounter *counter, long n)
+{
+    if (my_shard_index == -1)
+        my_shard_index = __atomic_fetch_add(&next_shard_index, 1, __ATOMIC_RELAXED);
+
+    // still atomic, as threads may share a shard - but the cache line only bounces between those threads
+    __atomic_fetch_add(&counter->shards[my_shard_index % counter->num_shards].value, n, __ATOMIC_RELAXED);
+}
+
+long
+sharded_counter_read(ShardedCounter *counter)
+{
+    long sum = 0;
+    for (int i = 0; i < counter->num_shards; i++)
+        sum += __atomic_load_n(&counter->shards[i].value, __ATOMIC_RELAXED);
+    return sum;
+}
+
+void
+sharded_counter_destroy(ShardedCounter *counter)
+{
+    free(counter->shards);
+    counter->shards = NULL;
+    counter->num_shards = 0;
+}
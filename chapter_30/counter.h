@@ -0,0 +1,48 @@
+#ifndef COUNTER_H
+#define COUNTER_H
+
+#include <pthread.h>
+
+// Shared counters, three ways:
+// * MutexCounter   - a long protected by a mutex
+// * AtomicCounter  - a long updated with an atomic fetch-and-add
+// * ShardedCounter - one slot per thread (threads beyond the number of shards share slots), each on its own
+//                    cache line; adding only touches the thread's own slot, reading sums all of them
+// All of them are safe to use from any number of threads. A sharded counter's read isn't a snapshot: adds
+// running concurrently may or may not be included.
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct MutexCounter {
+    pthread_mutex_t mtx;
+    long value;
+} MutexCounter;
+
+typedef struct AtomicCounter {
+    long value;
+} AtomicCounter;
+
+typedef struct CounterShard {
+    long value;
+} __attribute__((aligned(CACHE_LINE_SIZE))) CounterShard;
+
+typedef struct ShardedCounter {
+    CounterShard *shards;
+    int num_shards;
+} ShardedCounter;
+
+void mutex_counter_init(MutexCounter *counter);
+void mutex_counter_add(MutexCounter *counter, long n);
+long mutex_counter_read(MutexCounter *counter);
+void mutex_counter_destroy(MutexCounter *counter);
+
+void atomic_counter_init(AtomicCounter *counter);
+void atomic_counter_add(AtomicCounter *counter, long n);
+long atomic_counter_read(AtomicCounter *counter);
+
+void sharded_counter_init(ShardedCounter *counter, int num_shards);
+void sharded_counter_add(ShardedCounter *counter, long n);
+long sharded_counter_read(ShardedCounter *counter);
+void sharded_counter_destroy(ShardedCounter *counter);
+
+#endif
@@ -0,0 +1,184 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "counter.h"
+
+// Counter benchmark: every thread increments the same counter loops times, for each counter kind and thread
+// count. Besides the counters of counter.c, two more kinds for comparison:
+// * racy   - a plain volatile long, incremented like in thread_incr.c; fast, and loses updates
+// * packed - per thread slots like the sharded counter, but next to each other in one array, so up to 8 threads
+//            share a cache line (false sharing): no slot is shared, yet the line bounces between cores
+
+#define MAX_THREADS 1024
+
+enum { KIND_RACY, KIND_MUTEX, KIND_ATOMIC, KIND_SHARDED, KIND_PACKED, NUM_KINDS };
+static const char *kind_names[NUM_KINDS] = { "racy", "mutex", "atomic", "sharded", "packed" };
+
+typedef struct ThreadArgs {
+    int kind;
+    int id;
+    long loops;
+    struct timespec start, end;
+} ThreadArgs;
+
+static volatile long racy_counter;
+static MutexCounter mutex_counter;
+static AtomicCounter atomic_counter;
+static ShardedCounter sharded_counter;
+static long packed_counter[MAX_THREADS] __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static pthread_barrier_t start_barrier;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [loops-per-thread [num-threads...]]\n", progName);
+    fprintf(stderr, "  defaults: 500000 loops, 1 2 4 8 16 32 64 threads\n");
+    exit(EXIT_FAILURE);
+}
+
+static void *
+incrementer(void *arg)
+{
+    ThreadArgs *args = arg;
+    long loops = args->loops;
+
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &args->start);
+    switch (args->kind) {
+    case KIND_RACY:
+        for (long i = 0; i < loops; i++)
+            racy_counter++;
+        break;
+    case KIND_MUTEX:
+        for (long i = 0; i < loops; i++)
+            mutex_counter_add(&mutex_counter, 1);
+        break;
+    case KIND_ATOMIC:
+        for (long i = 0; i < loops; i++)
+            atomic_counter_add(&atomic_counter, 1);
+        break;
+    case KIND_SHARDED:
+        for (long i = 0; i < loops; i++)
+            sharded_counter_add(&sharded_counter, 1);
+        break;
+    case KIND_PACKED:
+        for (long i = 0; i < loops; i++)
+            __atomic_fetch_add(&packed_counter[args->id], 1, __ATOMIC_RELAXED);
+        break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &args->end);
+    return NULL;
+}
+
+static long
+read_counter(int kind, int num_threads)
+{
+    long sum = 0;
+    switch (kind) {
+    case KIND_RACY:    return racy_counter;
+    case KIND_MUTEX:   return mutex_counter_read(&mutex_counter);
+    case KIND_ATOMIC:  return atomic_counter_read(&atomic_counter);
+    case KIND_SHARDED: return sharded_counter_read(&sharded_counter);
+    default:
+        for (int i = 0; i < num_threads; i++)
+            sum += packed_counter[i];
+        return sum;
+    }
+}
+
+static double
+ts_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1e9 + ts->tv_nsec;
+}
+
+// returns ns per increment - from the first thread starting to the last one finishing, over all increments;
+// sets *value to the final counter value. The threads take the times themselves: on a single CPU the first
+// one may well be done before the main thread gets to run again
+static double
+run(int kind, int num_threads, long loops, long *value)
+{
+    pthread_t threads[num_threads];
+    ThreadArgs args[num_threads];
+
+    racy_counter = 0;
+    mutex_counter_init(&mutex_counter);
+    atomic_counter_init(&atomic_counter);
+    sharded_counter_init(&sharded_counter, num_threads);
+    for (int i = 0; i < num_threads; i++)
+        packed_counter[i] = 0;
+
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        args[i] = (ThreadArgs) { .kind = kind, .id = i, .loops = loops };
+        int s = pthread_create(&threads[i], NULL, incrementer, &args[i]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = 0, end = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        if (i == 0 || ts_ns(&args[i].start) < start)
+            start = ts_ns(&args[i].start);
+        if (ts_ns(&args[i].end) > end)
+            end = ts_ns(&args[i].end);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    *value = read_counter(kind, num_threads);
+    mutex_counter_destroy(&mutex_counter);
+    sharded_counter_destroy(&sharded_counter);
+
+    return (end - start) / ((double) num_threads * loops);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    long loops = argc > 1 ? getLong(argv[1], GN_GT_0, "loops-per-thread") : 500000;
+
+    int default_threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+    int num_counts = argc > 2 ? argc - 2 : (int) (sizeof(default_threads) / sizeof(default_threads[0]));
+    int thread_counts[num_counts];
+    for (int i = 0; i < num_counts; i++) {
+        thread_counts[i] = argc > 2 ? getInt(argv[i + 2], GN_GT_0, "num-threads") : default_threads[i];
+        if (thread_counts[i] > MAX_THREADS)
+            cmdLineErr("at most %d threads\n", MAX_THREADS);
+    }
+
+    printf("%s: %ld increments per thread, %ld CPUs; ns per increment (wall clock time / total increments)\n",
+           argv[0], loops, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| Threads |");
+    for (int k = 0; k < NUM_KINDS; k++)
+        printf(" %-8s |", kind_names[k]);
+    printf(" Racy lost |\n|---------|");
+    for (int k = 0; k < NUM_KINDS; k++)
+        printf("----------|");
+    printf("-----------|\n");
+
+    for (int i = 0; i < num_counts; i++) {
+        long expected = thread_counts[i] * loops, lost = 0;
+        printf("| %7d |", thread_counts[i]);
+        for (int k = 0; k < NUM_KINDS; k++) {
+            long value;
+            double ns = run(k, thread_counts[i], loops, &value);
+            if (k == KIND_RACY)
+                lost = expected - value;
+            else if (value != expected)
+                fatal("%s counter: %ld, expected %ld", kind_names[k], value, expected);
+            printf(" %8.2f |", ns);
+            fflush(stdout);
+        }
+        printf(" %8.2f%% |\n", 100.0 * lost / expected);
+    }
+
+    exit(EXIT_SUCCESS);
+}
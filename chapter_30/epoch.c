@@ -0,0 +1,142 @@
+#include <pthread.h>
+
+#include "tlpi_hdr.h"
+#include "epoch.h"
+
+// There's a global epoch, and every thread that ever read publishes the epoch it's reading in (or that it's
+// not reading at all). The global epoch only moves from e to e + 1 once no reader is still in e - 1, so
+// anything retired during e - 1 was unlinked before every current reader started, and can be freed.
+// Retired objects wait in one of three lists, by the epoch they were retired in.
+
+#define RECLAIM_THRESHOLD 256 // retired objects before trying to advance the epoch
+
+typedef struct EpochRecord {
+    unsigned long state; // (epoch << 1) | 1 while reading, 0 otherwise
+    int in_use;          // owned by a live thread
+    struct EpochRecord *next;
+} EpochRecord;
+
+typedef struct Retired {
+    void *ptr;
+    void (*destructor)(void *);
+    struct Retired *next;
+} Retired;
+
+static unsigned long global_epoch = 0;
+static EpochRecord *records = NULL; // only ever grows; records of exited threads are reused
+
+static pthread_mutex_t retire_mtx = PTHREAD_MUTEX_INITIALIZER;
+static Retired *limbo[3];
+static int num_retired = 0;
+
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+static __thread EpochRecord *my_record;
+
+
+static void
+release_record(void *arg)
+{
+    EpochRecord *record = arg;
+    __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&record->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void
+create_record_key(void)
+{
+    int s = pthread_key_create(&record_key, release_record);
+    if (s != 0)
+        errExitEN(s, "pthread_key_create");
+}
+
+static EpochRecord *
+get_record(void)
+{
+    if (my_record)
+        return my_record;
+
+    // take over the record of a thread that exited, or add a new one
+    EpochRecord *record;
+    for (record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&record->in_use, &unused, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            break;
+    }
+
+    if (record == NULL) {
+        record = calloc(1, sizeof(EpochRecord));
+        if (record == NULL)
+            errExit("calloc");
+        record->in_use = 1;
+        record->next = __atomic_load_n(&records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&records, &record->next, record, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+
+    pthread_once(&record_key_once, create_record_key);
+    pthread_setspecific(record_key, record);
+    my_record = record;
+    return record;
+}
+
+void
+epoch_enter(void)
+{
+    EpochRecord *record = get_record();
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    __atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_RELAXED);
+
+    // the announcement must be visible before we read any pointer from the data structure
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void
+epoch_exit(void)
+{
+    __atomic_store_n(&my_record->state, 0, __ATOMIC_RELEASE);
+}
+
+// must be called with retire_mtx held
+static void
+try_advance(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+
+    for (EpochRecord *record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+        unsigned long state = __atomic_load_n(&record->state, __ATOMIC_ACQUIRE);
+        if ((state & 1) && (state >> 1) != epoch)
+            return; // someone still reads in the previous epoch
+    }
+    __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_RELEASE);
+
+    // readers are in epoch or epoch + 1 now - nobody can hold what was retired in epoch - 1
+    Retired *r = limbo[(epoch + 2) % 3];
+    limbo[(epoch + 2) % 3] = NULL;
+    while (r) {
+        Retired *next = r->next;
+        r->destructor(r->ptr);
+        free(r);
+        num_retired--;
+        r = next;
+    }
+}
+
+void
+epoch_retire(void *ptr, void (*destructor)(void *))
+{
+    Retired *r = malloc(sizeof(Retired));
+    if (r == NULL)
+        errExit("malloc");
+    r->ptr = ptr;
+    r->destructor = destructor;
+
+    pthread_mutex_lock(&retire_mtx);
+    unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_RELAXED);
+    r->next = limbo[epoch % 3];
+    limbo[epoch % 3] = r;
+    if (++num_retired >= RECLAIM_THRESHOLD)
+        try_advance();
+    pthread_mutex_unlock(&retire_mtx);
+}
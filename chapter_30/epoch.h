@@ -0,0 +1,14 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+// Epoch based memory reclamation, for data structures read without locks.
+//
+// Readers wrap every access in epoch_enter()/epoch_exit() (no nesting). A writer that unlinks an object hands
+// it to epoch_retire() instead of freeing it; the destructor runs once every reader that might still hold a
+// pointer to it has left its critical section.
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(void *ptr, void (*destructor)(void *));
+
+#endif
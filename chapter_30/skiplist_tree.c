@@ -0,0 +1,332 @@
+#include <pthread.h>
+#include <string.h>
+#include <sched.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "skiplist_tree.h"
+#include "epoch.h"
+
+// Skip list implementation of the threadsafe_tree.h API - the "lazy" skip list of Herlihy, Lev, Luchangco and
+// Shavit ("A Simple Optimistic Skiplist Algorithm").
+//
+// Every node is on the bottom level list, and on each level above it with probability 1/2, so a search skips
+// over about half of the remaining nodes per level - O(log n) expected, whatever the insertion order is.
+//
+// * lookup() takes no locks: it walks down the levels and only trusts a node that is fully linked and not
+//   marked as deleted.
+// * add() and delete() search without locks too, then lock just the predecessors of the node on each of its
+//   levels (bottom level first - the same order for everyone) and validate that they're still unmarked and
+//   still point where the search saw them point. If not, they unlock and search again.
+// * delete() first marks the node (logical deletion - from now on it isn't in the tree), then unlinks it top
+//   level first, so a node is never reachable on a level without being reachable on the ones below it.
+//
+// Nodes are freed through epoch based reclamation (epoch.c); every operation walks the list inside an epoch.
+//
+// The TreeNode returned by new_tree() is only a handle on the skip list's head node.
+
+#define MAX_LEVEL 24 // plenty for 2^24 keys
+
+#define LOAD(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define STORE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+__thread TreeLockStats tree_lock_stats;
+
+typedef struct SkipNode {
+    pthread_mutex_t mtx;
+    char *key; // NULL for the head, which is before every key
+    void *value;
+    int top_level;
+    int marked;       // logically deleted
+    int fully_linked; // linked on all its levels
+    struct SkipNode *next[]; // top_level + 1 of them
+} SkipNode;
+
+struct TreeNode {
+    SkipNode *head;
+};
+
+static __thread unsigned int level_seed;
+
+
+static int
+random_level(void)
+{
+    if (level_seed == 0)
+        level_seed = (unsigned int) (uintptr_t) &level_seed ^ (unsigned int) time(NULL);
+
+    // xorshift; each trailing one bit is another level
+    level_seed ^= level_seed << 13;
+    level_seed ^= level_seed >> 17;
+    level_seed ^= level_seed << 5;
+    return __builtin_ctz(~level_seed | (1u << (MAX_LEVEL - 1)));
+}
+
+static SkipNode *
+new_node(char *key, void *value, int top_level)
+{
+    SkipNode *node = calloc(1, sizeof(SkipNode) + (top_level + 1) * sizeof(SkipNode *));
+    if (node == NULL)
+        errExit("calloc");
+    pthread_mutex_init(&node->mtx, NULL);
+    if (key != NULL)
+        node->key = strdup(key);
+    node->value = value;
+    node->top_level = top_level;
+    return node;
+}
+
+static void
+free_node(void *arg)
+{
+    SkipNode *node = arg;
+    free(node->key);
+    pthread_mutex_destroy(&node->mtx);
+    free(node);
+}
+
+// is the node's key before key?
+static Boolean
+before(SkipNode *node, const char *key)
+{
+    return node->key == NULL || strcmp(node->key, key) < 0;
+}
+
+// fill the last node before key and the one after it on every level; returns the highest level the key was
+// found on, or -1. Must be called inside an epoch
+static int
+find(SkipNode *head, const char *key, SkipNode *preds[], SkipNode *succs[])
+{
+    int found_level = -1;
+    SkipNode *pred = head;
+
+    for (int level = MAX_LEVEL - 1; level >= 0; level--) {
+        SkipNode *curr = LOAD(pred->next[level]);
+        while (curr && before(curr, key)) {
+            pred = curr;
+            curr = LOAD(pred->next[level]);
+        }
+        if (found_level == -1 && curr && strcmp(curr->key, key) == 0)
+            found_level = level;
+        preds[level] = pred;
+        succs[level] = curr;
+    }
+    return found_level;
+}
+
+// lock the distinct predecessors of levels 0..top_level; a predecessor on a higher level is never after the one
+// below it, so repeated ones are consecutive
+static void
+lock_preds(SkipNode *preds[], int top_level)
+{
+    for (int level = 0; level <= top_level; level++)
+        if (level == 0 || preds[level] != preds[level - 1])
+            tree_lock(&preds[level]->mtx);
+}
+
+static void
+unlock_preds(SkipNode *preds[], int top_level)
+{
+    for (int level = 0; level <= top_level; level++)
+        if (level == 0 || preds[level] != preds[level - 1])
+            pthread_mutex_unlock(&preds[level]->mtx);
+}
+
+struct TreeNode *
+new_tree()
+{
+    struct TreeNode *tree = (struct TreeNode *) malloc(sizeof(struct TreeNode));
+    if (tree == NULL) {
+        errExit("malloc");
+    }
+    initialize(tree);
+    return tree;
+}
+
+
+void
+initialize(struct TreeNode *tree)
+{
+    tree->head = new_node(NULL, NULL, MAX_LEVEL - 1);
+}
+
+
+void
+add(struct TreeNode *tree, char *key, void *value)
+{
+    SkipNode *head = tree->head;
+    SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    int top_level = random_level();
+
+    epoch_enter();
+    for (;;) {
+        int found_level = find(head, key, preds, succs);
+        if (found_level != -1) {
+            SkipNode *found = succs[found_level];
+            if (!LOAD(found->marked)) {
+                // already there (or being added by someone else) - replace the value
+                while (!LOAD(found->fully_linked))
+                    sched_yield();
+                STORE(found->value, value);
+                epoch_exit();
+                return;
+            }
+            sched_yield(); // being deleted; wait for it to go away
+            continue;
+        }
+
+        lock_preds(preds, top_level);
+        Boolean valid = TRUE;
+        for (int level = 0; valid && level <= top_level; level++) {
+            SkipNode *succ = succs[level];
+            valid = !LOAD(preds[level]->marked) && (succ == NULL || !LOAD(succ->marked))
+                    && preds[level]->next[level] == succ;
+        }
+        if (!valid) {
+            unlock_preds(preds, top_level);
+            continue;
+        }
+
+        // link bottom up; until fully_linked is set lookups ignore the node
+        SkipNode *node = new_node(key, value, top_level);
+        for (int level = 0; level <= top_level; level++)
+            node->next[level] = succs[level];
+        for (int level = 0; level <= top_level; level++)
+            STORE(preds[level]->next[level], node);
+        STORE(node->fully_linked, 1);
+
+        unlock_preds(preds, top_level);
+        epoch_exit();
+        return;
+    }
+}
+
+
+void
+delete(struct TreeNode *tree, char *key)
+{
+    if (!tree) return;
+
+    SkipNode *head = tree->head;
+    SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    SkipNode *victim = NULL;
+    int top_level = -1;
+
+    epoch_enter();
+    for (;;) {
+        int found_level = find(head, key, preds, succs);
+
+        if (victim == NULL) {
+            // only a node that is fully linked and found on its top level is done being added
+            SkipNode *found = found_level != -1 ? succs[found_level] : NULL;
+            if (found == NULL || !LOAD(found->fully_linked) || found->top_level != found_level || LOAD(found->marked)) {
+                epoch_exit();
+                return; // not in the tree (a node that isn't fully linked yet wasn't added yet)
+            }
+
+            tree_lock(&found->mtx);
+            if (found->marked) {
+                pthread_mutex_unlock(&found->mtx);
+                epoch_exit();
+                return; // someone else deleted it first
+            }
+            STORE(found->marked, 1);
+            victim = found;
+            top_level = victim->top_level;
+        }
+
+        lock_preds(preds, top_level);
+        Boolean valid = TRUE;
+        for (int level = 0; valid && level <= top_level; level++)
+            valid = !LOAD(preds[level]->marked) && preds[level]->next[level] == victim;
+        if (!valid) {
+            unlock_preds(preds, top_level);
+            continue;
+        }
+
+        for (int level = top_level; level >= 0; level--)
+            STORE(preds[level]->next[level], victim->next[level]);
+
+        pthread_mutex_unlock(&victim->mtx);
+        unlock_preds(preds, top_level);
+        epoch_exit();
+
+        // unlinked now, but lock-free readers and writers waiting on its lock may still be looking at it
+        epoch_retire(victim, free_node);
+        return;
+    }
+}
+
+
+Boolean
+lookup(struct TreeNode *tree, char *key, void **value)
+{
+    if (tree == NULL)
+        return FALSE;
+
+    SkipNode *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+    Boolean found = FALSE;
+
+    epoch_enter();
+    int found_level = find(tree->head, key, preds, succs);
+    if (found_level != -1) {
+        SkipNode *node = succs[found_level];
+        if (LOAD(node->fully_linked) && !LOAD(node->marked)) {
+            *value = LOAD(node->value);
+            found = TRUE;
+        }
+    }
+    epoch_exit();
+    return found;
+}
+
+
+void
+range_begin(struct TreeNode *tree, char *from, char *to, TreeRange *range)
+{
+    SkipNode *head = tree->head;
+
+    epoch_enter(); // until range_end()
+    SkipNode *pred = head;
+    if (from != NULL) {
+        for (int level = MAX_LEVEL - 1; level >= 0; level--) {
+            SkipNode *curr = LOAD(pred->next[level]);
+            while (curr && before(curr, from)) {
+                pred = curr;
+                curr = LOAD(pred->next[level]);
+            }
+        }
+    }
+
+    range->next = LOAD(pred->next[0]);
+    range->to = to;
+}
+
+
+Boolean
+range_next(TreeRange *range, char **key, void **value)
+{
+    // a deleted node keeps its links, so we can go on from it even after it was unlinked
+    for (SkipNode *node = range->next; node; node = LOAD(node->next[0])) {
+        if (range->to != NULL && strcmp(node->key, range->to) >= 0)
+            break;
+        if (LOAD(node->fully_linked) && !LOAD(node->marked)) {
+            range->next = LOAD(node->next[0]);
+            *key = node->key;
+            *value = LOAD(node->value);
+            return TRUE;
+        }
+    }
+
+    range->next = NULL;
+    return FALSE;
+}
+
+
+void
+range_end(TreeRange *range)
+{
+    range->next = NULL;
+    epoch_exit();
+}
@@ -0,0 +1,30 @@
+#ifndef SKIPLIST_TREE_H
+#define SKIPLIST_TREE_H
+
+#include "threadsafe_tree.h"
+
+// The skip list implementation of threadsafe_tree.h keeps its keys in order on the bottom level list, so on
+// top of the common API it can iterate over a range of keys:
+//
+//     TreeRange range;
+//     range_begin(tree, "a", "b", &range);
+//     while (range_next(&range, &key, &value))
+//         ...
+//     range_end(&range);
+//
+// The iteration doesn't block writers. It returns, in order, keys that were in the tree at some point during
+// the iteration (every key that stayed in the tree the whole time among them). Returned keys stay valid until
+// range_end(), which must be called from the thread that called range_begin(), with no other range or tree
+// call in between.
+
+typedef struct TreeRange {
+    void *next; // next node to look at
+    char *to;
+} TreeRange;
+
+// keys in [from, to); NULL stands for an open end
+void range_begin(struct TreeNode *tree, char *from, char *to, TreeRange *range);
+Boolean range_next(TreeRange *range, char **key, void **value);
+void range_end(TreeRange *range);
+
+#endif
@@ -1,8 +1,15 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 
+#ifdef SKIPLIST_TREE
+#include "skiplist_tree.h"
+#else
 #include "threadsafe_tree.h"
+#endif
 
 #define NUM_THREADS 10
 #define NUM_KEYS 100
@@ -63,7 +70,321 @@ static void *delete_keys(void *arg) {
 }
 
 
-int main(void) {
+#ifdef SKIPLIST_TREE
+// iterate over [from, to), checking the keys come in order; returns how many there were
+static int check_range(struct TreeNode *tree, char *from, char *to) {
+    TreeRange range;
+    char *key, prev[50] = "";
+    void *value;
+    int count = 0;
+
+    range_begin(tree, from, to, &range);
+    while (range_next(&range, &key, &value)) {
+        assert(strcmp(prev, key) < 0);
+        assert(from == NULL || strcmp(key, from) >= 0);
+        assert(to == NULL || strcmp(key, to) < 0);
+        snprintf(prev, sizeof(prev), "%s", key);
+        count++;
+    }
+    range_end(&range);
+    return count;
+}
+
+
+static void *scan_keys(void *arg) {
+    ThreadArgs *args = (ThreadArgs *)arg;
+    for (int i = 0; i < 20; i++)
+        check_range(args->tree, NULL, NULL);
+    return NULL;
+}
+#endif
+
+
+
+// Benchmark mode (-b): threads run a mix of lookups, adds and deletes on a key space that starts half full, for a
+// fixed time. Reported per thread: ops/s and lock contention (node locks that pthread_mutex_trylock() found
+// held, see tree_lock()); overall: ops/s and latency percentiles per operation.
+
+#define BENCH_KEY_LEN 16
+#define HIST_SUB_BITS 4 // 16 linear buckets per power of two - percentiles within 1/16 of the real value
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+enum { OP_LOOKUP, OP_ADD, OP_DELETE, NUM_OPS };
+static const char *op_names[NUM_OPS] = { "lookup", "add", "delete" };
+
+enum { DIST_UNIFORM, DIST_ZIPF, DIST_SORTED };
+
+typedef struct BenchConfig {
+    int num_threads;
+    int num_keys;
+    int dist;
+    double zipf_theta;
+    int pct_lookup, pct_add; // the rest are deletes
+    int seconds;
+} BenchConfig;
+
+typedef struct Zipf { // Gray et al., "Quickly generating billion-record synthetic databases"
+    int n;
+    double theta, alpha, zetan, eta;
+} Zipf;
+
+typedef struct BenchThread {
+    struct TreeNode *tree;
+    const BenchConfig *config;
+    const Zipf *zipf;
+    char (*keys)[BENCH_KEY_LEN];
+    int thread_id;
+    unsigned int seed;
+    long long ops[NUM_OPS];
+    unsigned long hist[NUM_OPS][HIST_BUCKETS];
+    TreeLockStats locks;
+} BenchThread;
+
+static volatile int bench_stop;
+static pthread_barrier_t bench_barrier;
+
+
+static void bench_usage(const char *progName) {
+    fprintf(stderr, "Usage: %s [-b [-t threads] [-k keys] [-d uniform|zipf|sorted] [-z theta]\n"
+                    "          [-m lookup%%/add%%/delete%%] [-s seconds]]\n", progName);
+    fprintf(stderr, "  without -b runs the correctness test\n");
+    fprintf(stderr, "  defaults: 4 threads, 100000 keys, uniform, theta 0.99, 80/10/10, 2 seconds\n");
+    exit(EXIT_FAILURE);
+}
+
+
+static void zipf_init(Zipf *z, int n, double theta) {
+    double zeta2 = 1 + pow(0.5, theta);
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1 / (1 - theta);
+    z->zetan = 0;
+    for (int i = 1; i <= n; i++)
+        z->zetan += 1 / pow(i, theta);
+    z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+
+// key index with rank i drawn with probability proportional to 1 / (i + 1)^theta
+static int zipf_next(const Zipf *z, unsigned int *seed) {
+    double u = rand_r(seed) / ((double) RAND_MAX + 1);
+    double uz = u * z->zetan;
+    if (uz < 1)
+        return 0;
+    if (uz < 1 + pow(0.5, z->theta))
+        return 1;
+    int i = (int) (z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+    return i < z->n ? i : z->n - 1;
+}
+
+
+static int hist_bucket(unsigned long ns) {
+    if (ns < (1UL << HIST_SUB_BITS))
+        return ns;
+    int msb = 63 - __builtin_clzl(ns);
+    return ((msb - HIST_SUB_BITS + 1) << HIST_SUB_BITS) + ((ns >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+
+// the highest value that falls into the bucket
+static unsigned long hist_value(int bucket) {
+    if (bucket < (1 << HIST_SUB_BITS))
+        return bucket;
+    int msb = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+    unsigned long sub = bucket & ((1 << HIST_SUB_BITS) - 1);
+    return ((1UL << msb) | (sub << (msb - HIST_SUB_BITS))) + (1UL << (msb - HIST_SUB_BITS)) - 1;
+}
+
+
+static unsigned long hist_percentile(const unsigned long *hist, long long count, double pct) {
+    long long rank = (long long) ceil(count * pct / 100), seen = 0;
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist[i];
+        if (seen >= rank)
+            return hist_value(i);
+    }
+    return 0;
+}
+
+
+static void *bench_thread(void *arg) {
+    BenchThread *t = arg;
+    const BenchConfig *c = t->config;
+    int cursor = (long long) t->thread_id * c->num_keys / c->num_threads;
+    void *value;
+    struct timespec start, end;
+
+    tree_lock_stats = (TreeLockStats) { 0, 0 };
+    pthread_barrier_wait(&bench_barrier);
+
+    while (!bench_stop) {
+        int k;
+        if (c->dist == DIST_UNIFORM) {
+            k = rand_r(&t->seed) % c->num_keys;
+        } else if (c->dist == DIST_ZIPF) {
+            k = zipf_next(t->zipf, &t->seed);
+        } else {
+            k = cursor;
+            cursor = (cursor + 1) % c->num_keys;
+        }
+
+        int r = rand_r(&t->seed) % 100;
+        int op = r < c->pct_lookup ? OP_LOOKUP : r < c->pct_lookup + c->pct_add ? OP_ADD : OP_DELETE;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (op) {
+        case OP_LOOKUP: lookup(t->tree, t->keys[k], &value); break;
+        case OP_ADD:    add(t->tree, t->keys[k], t->keys[k]); break;
+        default:        delete(t->tree, t->keys[k]); break;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        unsigned long ns = (end.tv_sec - start.tv_sec) * 1000000000UL + end.tv_nsec - start.tv_nsec;
+        t->hist[op][hist_bucket(ns)]++;
+        t->ops[op]++;
+    }
+
+    t->locks = tree_lock_stats;
+    return NULL;
+}
+
+
+static int benchmark(int argc, char *argv[]) {
+    BenchConfig c = { .num_threads = 4, .num_keys = 100000, .dist = DIST_UNIFORM, .zipf_theta = 0.99,
+                      .pct_lookup = 80, .pct_add = 10, .seconds = 2 };
+    int opt, pct_delete = 10;
+
+    while ((opt = getopt(argc, argv, "bt:k:d:z:m:s:")) != -1) {
+        switch (opt) {
+        case 'b': break;
+        case 't': c.num_threads = getInt(optarg, GN_GT_0, "threads"); break;
+        case 'k': c.num_keys = getInt(optarg, GN_GT_0, "keys"); break;
+        case 'd':
+            if (strcmp(optarg, "uniform") == 0)     c.dist = DIST_UNIFORM;
+            else if (strcmp(optarg, "zipf") == 0)   c.dist = DIST_ZIPF;
+            else if (strcmp(optarg, "sorted") == 0) c.dist = DIST_SORTED;
+            else bench_usage(argv[0]);
+            break;
+        case 'z':
+            c.zipf_theta = atof(optarg);
+            if (c.zipf_theta <= 0 || c.zipf_theta >= 1)
+                cmdLineErr("theta must be in (0, 1)\n");
+            break;
+        case 'm':
+            if (sscanf(optarg, "%d/%d/%d", &c.pct_lookup, &c.pct_add, &pct_delete) != 3 ||
+                    c.pct_lookup < 0 || c.pct_add < 0 || pct_delete < 0 ||
+                    c.pct_lookup + c.pct_add + pct_delete != 100)
+                cmdLineErr("-m wants lookup/add/delete percentages adding up to 100\n");
+            break;
+        case 's': c.seconds = getInt(optarg, GN_GT_0, "seconds"); break;
+        default:  bench_usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        bench_usage(argv[0]);
+
+    char (*keys)[BENCH_KEY_LEN] = malloc(c.num_keys * sizeof(*keys));
+    int *order = malloc(c.num_keys * sizeof(int));
+    BenchThread *threads = calloc(c.num_threads, sizeof(BenchThread));
+    pthread_t *tids = malloc(c.num_threads * sizeof(pthread_t));
+    if (keys == NULL || order == NULL || threads == NULL || tids == NULL)
+        errExit("malloc");
+    for (int i = 0; i < c.num_keys; i++) {
+        snprintf(keys[i], BENCH_KEY_LEN, "key_%010d", i);
+        order[i] = i;
+    }
+
+    Zipf zipf;
+    if (c.dist == DIST_ZIPF)
+        zipf_init(&zipf, c.num_keys, c.zipf_theta);
+
+    // half of the keys, in a random order (the plain tree doesn't rebalance)
+    srandom(1);
+    for (int i = c.num_keys - 1; i > 0; i--) {
+        int j = random() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    struct TreeNode *tree = new_tree();
+    for (int i = 0; i < c.num_keys; i++)
+        if (order[i] % 2 == 0)
+            add(tree, keys[order[i]], keys[order[i]]);
+
+    bench_stop = 0;
+    pthread_barrier_init(&bench_barrier, NULL, c.num_threads + 1);
+    for (int i = 0; i < c.num_threads; i++) {
+        threads[i] = (BenchThread) { .tree = tree, .config = &c, .zipf = &zipf, .keys = keys,
+                                     .thread_id = i, .seed = i + 1 };
+        int s = pthread_create(&tids[i], NULL, bench_thread, &threads[i]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    struct timespec start, end;
+    pthread_barrier_wait(&bench_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sleep(c.seconds);
+    bench_stop = 1;
+    for (int i = 0; i < c.num_threads; i++)
+        pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    static const char *dist_names[] = { "uniform", "zipf", "sorted" };
+    printf("%s: %d threads, %d keys, %s", argv[0], c.num_threads, c.num_keys, dist_names[c.dist]);
+    if (c.dist == DIST_ZIPF)
+        printf(" (theta %.2f)", c.zipf_theta);
+    printf(", %d/%d/%d lookup/add/delete, %.2f s, %ld CPUs\n\n", c.pct_lookup, c.pct_add, pct_delete, elapsed,
+           sysconf(_SC_NPROCESSORS_ONLN));
+
+    printf("| Thread | Ops/s        | Locks        | Contended    | Contended %% |\n");
+    printf("|--------|--------------|--------------|--------------|-------------|\n");
+    long long total_ops = 0, op_counts[NUM_OPS] = { 0 };
+    TreeLockStats total_locks = { 0, 0 };
+    static unsigned long hist[NUM_OPS][HIST_BUCKETS];
+    for (int i = 0; i < c.num_threads; i++) {
+        BenchThread *t = &threads[i];
+        long long ops = t->ops[OP_LOOKUP] + t->ops[OP_ADD] + t->ops[OP_DELETE];
+        printf("| %6d | %12.0f | %12lu | %12lu | %10.3f%% |\n", i, ops / elapsed, t->locks.locks,
+               t->locks.contended, t->locks.locks ? 100.0 * t->locks.contended / t->locks.locks : 0);
+
+        total_ops += ops;
+        total_locks.locks += t->locks.locks;
+        total_locks.contended += t->locks.contended;
+        for (int op = 0; op < NUM_OPS; op++) {
+            op_counts[op] += t->ops[op];
+            for (int b = 0; b < HIST_BUCKETS; b++)
+                hist[op][b] += t->hist[op][b];
+        }
+    }
+    printf("| total  | %12.0f | %12lu | %12lu | %10.3f%% |\n\n", total_ops / elapsed, total_locks.locks,
+           total_locks.contended, total_locks.locks ? 100.0 * total_locks.contended / total_locks.locks : 0);
+
+    printf("| Op     | Count        | p50 (ns) | p90 (ns) | p99 (ns) | p99.9 (ns) | max (ns)   |\n");
+    printf("|--------|--------------|----------|----------|----------|------------|------------|\n");
+    for (int op = 0; op < NUM_OPS; op++) {
+        if (op_counts[op] == 0)
+            continue;
+        printf("| %-6s | %12lld | %8lu | %8lu | %8lu | %10lu | %10lu |\n", op_names[op], op_counts[op],
+               hist_percentile(hist[op], op_counts[op], 50), hist_percentile(hist[op], op_counts[op], 90),
+               hist_percentile(hist[op], op_counts[op], 99), hist_percentile(hist[op], op_counts[op], 99.9),
+               hist_percentile(hist[op], op_counts[op], 100));
+    }
+
+    return 0;
+}
+
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) {
+        if (strcmp(argv[1], "-b") != 0)
+            bench_usage(argv[0]);
+        return benchmark(argc, argv);
+    }
+
     struct TreeNode *tree = new_tree();
 
     pthread_t threads[NUM_THREADS];
@@ -83,12 +404,29 @@ int main(void) {
     for (int i = 0; i < NUM_THREADS; i++)
         pthread_join(threads[i], NULL);
 
+#ifdef SKIPLIST_TREE
+    // ordered iteration: all keys, and the ones starting with "key_1" (key_1, key_10..19, key_100..199)
+    assert(check_range(tree, NULL, NULL) == NUM_THREADS * NUM_KEYS);
+    assert(check_range(tree, "key_1", "key_2") == 111);
+    assert(check_range(tree, "key_9", NULL) == 111);
+    assert(check_range(tree, "key_2", "key_2") == 0);
+
+    // delete keys in parallel, while another thread iterates
+    pthread_t scanner;
+    pthread_create(&scanner, NULL, scan_keys, &args[0]);
+#endif
+
     // delete keys in parallel
     for (int i = 0; i < NUM_THREADS; i++)
         pthread_create(&threads[i], NULL, delete_keys, &args[i]);
     for (int i = 0; i < NUM_THREADS; i++)
         pthread_join(threads[i], NULL);
 
+#ifdef SKIPLIST_TREE
+    pthread_join(scanner, NULL);
+    assert(check_range(tree, NULL, NULL) == 0);
+#endif
+
     // verify tree is empty
     for (int i = 0; i < NUM_THREADS * NUM_KEYS; i++) {
         char key[50];
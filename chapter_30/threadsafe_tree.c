@@ -1,6 +1,7 @@
 #include <pthread.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
 
 #include "tlpi_hdr.h"
 #include "threadsafe_tree.h"
@@ -15,19 +16,193 @@
     #define DEBUG(...)
 #endif
 
-#define MAX_KEY_LEN 1024
+#define TREE_INLINE_KEY_LEN 32 // keys shorter than this are stored in the node itself
+
+// What a lookup touches on every level - the key prefix, the links and the lock - comes first and fits in one
+// 64-byte cache line; the key itself is only read when the prefixes are equal.
+struct TreeNode {
+    uint64_t key_prefix; // first 8 bytes of the key, big-endian - compares like the key
+    struct TreeNode *left;
+    struct TreeNode *right;
+    pthread_mutex_t mtx;
+    char *key;
+    void *value;
+    char inline_key[TREE_INLINE_KEY_LEN]; // key points here for short keys
+};
+
+__thread TreeLockStats tree_lock_stats;
+
+// Node pool: every thread keeps its own list of free nodes, so add() and delete() don't go through malloc()
+// (and its locks) for every node. Nodes are carved out of cache line aligned chunks; a thread whose list grows
+// past POOL_MAX hands POOL_BATCH nodes over to a global list, which a thread with an empty list takes a batch
+// from before allocating a new chunk. Memory of the pool is never given back to the system.
+#define POOL_CHUNK 64 // nodes per chunk
+#define POOL_BATCH 64
+#define POOL_MAX 256
+
+typedef struct NodePool {
+    struct TreeNode *free;
+    int count;
+} NodePool;
+
+static __thread NodePool pool;
+
+static pthread_mutex_t global_pool_mtx = PTHREAD_MUTEX_INITIALIZER;
+static struct TreeNode *global_pool = NULL; // batches of POOL_BATCH nodes, linked through left; right links batches
+
+static pthread_once_t pool_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t pool_key;
 
 
 static void
-delete_node(struct TreeNode *node)
+give_batch(struct TreeNode *batch)
+{
+    pthread_mutex_lock(&global_pool_mtx);
+    batch->right = global_pool;
+    global_pool = batch;
+    pthread_mutex_unlock(&global_pool_mtx);
+}
+
+// thread exit: the thread's free nodes go to the global list (possibly as a partial batch)
+static void
+release_pool(void *arg)
+{
+    NodePool *p = arg;
+    if (p->free)
+        give_batch(p->free);
+    p->free = NULL;
+    p->count = 0;
+}
+
+static void
+create_pool_key(void)
+{
+    int s = pthread_key_create(&pool_key, release_pool);
+    if (s != 0)
+        errExitEN(s, "pthread_key_create");
+}
+
+// called whenever the thread's list is empty, so that it's handed over when the thread exits
+static void
+register_pool(void)
+{
+    pthread_once(&pool_key_once, create_pool_key);
+    pthread_setspecific(pool_key, &pool);
+}
+
+static struct TreeNode *
+alloc_node(void)
+{
+    if (pool.free == NULL) {
+        register_pool();
+
+        pthread_mutex_lock(&global_pool_mtx);
+        struct TreeNode *batch = global_pool;
+        if (batch)
+            global_pool = batch->right;
+        pthread_mutex_unlock(&global_pool_mtx);
+
+        if (batch) {
+            pool.free = batch;
+            for (struct TreeNode *node = batch; node; node = node->left)
+                pool.count++;
+        } else {
+            struct TreeNode *chunk;
+            int s = posix_memalign((void **) &chunk, 64, POOL_CHUNK * sizeof(struct TreeNode));
+            if (s != 0)
+                errExitEN(s, "posix_memalign");
+            for (int i = 0; i < POOL_CHUNK; i++)
+                chunk[i].left = i + 1 < POOL_CHUNK ? &chunk[i + 1] : NULL;
+            pool.free = chunk;
+            pool.count = POOL_CHUNK;
+        }
+    }
+
+    struct TreeNode *node = pool.free;
+    pool.free = node->left;
+    pool.count--;
+    return node;
+}
+
+static void
+free_node(struct TreeNode *node)
+{
+    if (pool.free == NULL)
+        register_pool();
+    node->left = pool.free;
+    pool.free = node;
+
+    if (++pool.count > POOL_MAX) {
+        // hand the first POOL_BATCH nodes over, keep the rest
+        struct TreeNode *last = pool.free;
+        for (int i = 1; i < POOL_BATCH; i++)
+            last = last->left;
+        struct TreeNode *batch = pool.free;
+        pool.free = last->left;
+        pool.count -= POOL_BATCH;
+        last->left = NULL;
+        give_batch(batch);
+    }
+}
+
+// the first 8 bytes of key (zero padded), so that comparing prefixes as integers orders like strcmp()
+static uint64_t
+key_prefix(const char *key)
+{
+    uint64_t prefix = 0;
+    for (int i = 0; i < 8 && key[i]; i++)
+        prefix |= (uint64_t) (unsigned char) key[i] << (56 - 8 * i);
+    return prefix;
+}
+
+// compare key (whose prefix is given) to the node's key; the node's key is only touched on a prefix tie
+static int
+key_cmp(const char *key, uint64_t prefix, struct TreeNode *node)
 {
-    free(node->key);
+    if (prefix != node->key_prefix)
+        return prefix < node->key_prefix ? -1 : 1;
+    if ((prefix & 0xff) == 0) // the keys end within the prefix
+        return 0;
+    return strcmp(key + 8, node->key + 8);
+}
+
+static void
+free_key(struct TreeNode *node)
+{
+    if (node->key != node->inline_key)
+        free(node->key);
     node->key = NULL;
+}
+
+static void
+set_key(struct TreeNode *node, const char *key, uint64_t prefix)
+{
+    if (node->key == key)
+        return;
+    free_key(node);
+
+    size_t len = strlen(key);
+    if (len < TREE_INLINE_KEY_LEN) {
+        memcpy(node->inline_key, key, len + 1);
+        node->key = node->inline_key;
+    } else {
+        node->key = strdup(key);
+        if (node->key == NULL)
+            errExit("strdup");
+    }
+    node->key_prefix = prefix;
+}
+
+static void
+delete_node(struct TreeNode *node)
+{
+    free_key(node);
     pthread_mutex_unlock(&node->mtx);
     pthread_mutex_destroy(&node->mtx);
-    free(node);
+    free_node(node);
 }
 
+// the tree handle is the caller's to free, so unlike the nodes below it, it comes from malloc()
 struct TreeNode *
 new_tree()
 {
@@ -44,6 +219,7 @@ void
 initialize(struct TreeNode *tree)
 {
     pthread_mutex_init(&tree->mtx, NULL);
+    tree->key_prefix = 0;
     tree->key = NULL;
     tree->value = NULL;
     tree->left = NULL;
@@ -54,10 +230,11 @@ initialize(struct TreeNode *tree)
 void
 add(struct TreeNode *tree, char *key, void *value)
 {
-    pthread_mutex_lock(&tree->mtx);
+    uint64_t prefix = key_prefix(key);
+    tree_lock(&tree->mtx);
     
     if (tree->key == NULL) {
-        tree->key = strdup(key);
+        set_key(tree, key, prefix);
         tree->value = value;
         pthread_mutex_unlock(&tree->mtx);
         return;
@@ -67,7 +244,8 @@ add(struct TreeNode *tree, char *key, void *value)
     struct TreeNode *parent = NULL; // we're also locking the parent to avoid races with the delete function
     
     while (curr) {
-        if (strcmp(key, curr->key) == 0) {
+        int cmp = key_cmp(key, prefix, curr);
+        if (cmp == 0) {
             curr->value = value;
             pthread_mutex_unlock(&curr->mtx);
             if (parent)
@@ -75,11 +253,12 @@ add(struct TreeNode *tree, char *key, void *value)
             return;
         }
         
-        struct TreeNode **next = strcmp(key, curr->key) < 0 ? &curr->left : &curr->right;
+        struct TreeNode **next = cmp < 0 ? &curr->left : &curr->right;
         if (*next == NULL) {
-            struct TreeNode *newNode = new_tree();
+            struct TreeNode *newNode = alloc_node();
+            initialize(newNode);
             pthread_mutex_lock(&newNode->mtx);  // Ensure it is locked before making it visible
-            newNode->key = strdup(key);
+            set_key(newNode, key, prefix);
             newNode->value = value;
             *next = newNode;
             pthread_mutex_unlock(&newNode->mtx);
@@ -88,7 +267,7 @@ add(struct TreeNode *tree, char *key, void *value)
             return;
         }
 
-        pthread_mutex_lock(&(*next)->mtx);
+        tree_lock(&(*next)->mtx);
         if (parent)
             pthread_mutex_unlock(&parent->mtx);
         parent = curr;
@@ -103,22 +282,22 @@ add(struct TreeNode *tree, char *key, void *value)
 void delete(struct TreeNode *tree, char *key) {
     DEBUG("delete(%s)\n", key);
     if (!tree) return;
+    uint64_t prefix = key_prefix(key);
     
-    pthread_mutex_lock(&tree->mtx);
+    tree_lock(&tree->mtx);
     if (tree->key == NULL) {
         DEBUG("\tempty tree %s\n", key);
         // empty tree
         pthread_mutex_unlock(&tree->mtx);
         return;
-    } else if (strncmp(key, tree->key, MAX_KEY_LEN) == 0) {
+    } else if (key_cmp(key, prefix, tree) == 0) {
         // deleting root node
         DEBUG("\tdeleting root node (key = %s)\n", key);
 
         if (tree->left == NULL && tree->right == NULL) {
             // no children for root node
             DEBUG("\tno children for root node (key = %s)\n", key);
-            free(tree->key);
-            tree->key = NULL;
+            free_key(tree);
             tree->value = NULL;
             pthread_mutex_unlock(&tree->mtx);
             return;
@@ -135,7 +314,7 @@ void delete(struct TreeNode *tree, char *key) {
             struct TreeNode *successor_grand_parent = NULL;
 
             while (next) {
-                pthread_mutex_lock(&next->mtx);
+                tree_lock(&next->mtx);
                 successor_grand_parent = successor_parent;
                 successor_parent = successor;
                 successor = next;
@@ -148,23 +327,20 @@ void delete(struct TreeNode *tree, char *key) {
 
             // set parrent node with successor values
             DEBUG("\tset root node with successor values. tree->key = %s successor->key = %s\n", tree->key, successor->key);
-            tree->key = strdup(successor->key);
+            set_key(tree, successor->key, successor->key_prefix);
             tree->value = successor->value;
 
-            // remove successor node
+            // remove successor node; it has no left child, its right subtree takes its place
             DEBUG("\tremove successor node. successor->key = %s\n", successor->key);
+            struct TreeNode *successor_right = successor->right;
             delete_node(successor);
 
             // update successor's parent node pointer
             if (successor == tree->right) {
                 // this means our parent is actually the root node
-                tree->right = NULL;
+                tree->right = successor_right;
             } else if (successor_parent != NULL) {
-                if (successor_parent->left == successor) {
-                    successor_parent->left = NULL;
-                } else {
-                    successor_parent->right = NULL;
-                }
+                successor_parent->left = successor_right;
             } else {
                 errExit("SHOULD NEVER HAPPEN - successor_parent == NULL\n");
             }
@@ -181,11 +357,11 @@ void delete(struct TreeNode *tree, char *key) {
         // root has one child
         DEBUG("\troot has one child (key = %s)\n", key);
         struct TreeNode *child = tree->left ? tree->left : tree->right;
-        pthread_mutex_lock(&child->mtx);
+        tree_lock(&child->mtx);
 
         // copy child's data
         DEBUG("\tcopy child's data -- tree->key = %s; child->key = %s\n", tree->key, child->key);
-        tree->key = strdup(child->key);
+        set_key(tree, child->key, child->key_prefix);
         tree->value = child->value;
         tree->left = child->left;
         tree->right = child->right;
@@ -200,7 +376,7 @@ void delete(struct TreeNode *tree, char *key) {
     } else {
         // node to delete isn't the root node - traverse the tree to find node to delete; Lock our way down
         DEBUG("\tnode to delete isn't the root node -- key = %s, tree->key = %s\n", key, tree->key);
-        struct TreeNode *curr = strncmp(key, tree->key, MAX_KEY_LEN) < 0 ? tree->left : tree->right;
+        struct TreeNode *curr = key_cmp(key, prefix, tree) < 0 ? tree->left : tree->right;
         if (curr) {
             DEBUG("\tcurr->key = %s (%s)\n", curr->key, curr == tree->left ? "left": "right");
         } else {
@@ -211,12 +387,12 @@ void delete(struct TreeNode *tree, char *key) {
         struct TreeNode *curr_grand_parent = NULL;
 
         while (curr) {
-            pthread_mutex_lock(&curr->mtx);
+            tree_lock(&curr->mtx);
             DEBUG("\t\ttraversing curr->key = %s (%s); tree->key = %s\n", curr->key, curr == curr_parent->left ? "left": "right", tree->key);
             if (curr_grand_parent)
                 pthread_mutex_unlock(&curr_grand_parent->mtx);
 
-            int cmp = strncmp(key, curr->key, MAX_KEY_LEN);
+            int cmp = key_cmp(key, prefix, curr);
             if (cmp == 0) {
                 break;
             }
@@ -257,12 +433,13 @@ void delete(struct TreeNode *tree, char *key) {
                 // find successor node
                 struct TreeNode *successor_parent = curr;
                 struct TreeNode *successor = curr->right;
-                pthread_mutex_lock(&successor->mtx);  // lock successor
+                tree_lock(&successor->mtx);  // lock successor
 
                 while (successor->left) {
                     struct TreeNode *next = successor->left;
-                    pthread_mutex_lock(&next->mtx);     // lock child first
-                    pthread_mutex_unlock(&successor_parent->mtx);  // safe unlock parent
+                    tree_lock(&next->mtx);     // lock child first
+                    if (successor_parent != curr)
+                        pthread_mutex_unlock(&successor_parent->mtx);  // safe unlock parent (curr stays locked)
 
                     successor_parent = successor;
                     successor = next;
@@ -270,20 +447,19 @@ void delete(struct TreeNode *tree, char *key) {
 
                 // set parrent node with successor values
                 DEBUG("\tset parrent node with successor values -- curr->key = %s successor->key = %s\n", curr->key, successor->key);
-                curr->key = strdup(successor->key);
+                set_key(curr, successor->key, successor->key_prefix);
                 curr->value = successor->value;
 
-                // remove successor node
+                // remove successor node; it has no left child, its right subtree takes its place
                 DEBUG("\tdestory mutex - successor->key = %s\n", successor->key);
+                struct TreeNode *successor_right = successor->right;
                 delete_node(successor);
 
-                if (successor_parent) {
-                    // update successor's parent pointer
-                    if (successor_parent->left == successor) {
-                        successor_parent->left = NULL;
-                    } else {
-                        successor_parent->right = NULL;
-                    }
+                // update successor's parent pointer
+                if (successor_parent == curr) {
+                    curr->right = successor_right;
+                } else {
+                    successor_parent->left = successor_right;
 
                     // unlock successor's parent
                     pthread_mutex_unlock(&successor_parent->mtx);
@@ -309,12 +485,8 @@ void delete(struct TreeNode *tree, char *key) {
 
             // remove current node
             DEBUG("\tdestory mutex (node with one child) - curr->key = %s\n", curr->key);
-            free(curr->key);
             curr->value = NULL;
-            pthread_mutex_unlock(&curr->mtx);
-
-            pthread_mutex_destroy(&curr->mtx);
-            free(curr);
+            delete_node(curr);
 
             // unlock parent
             pthread_mutex_unlock(&curr_parent->mtx);
@@ -339,7 +511,8 @@ lookup(struct TreeNode *tree, char *key, void **value)
     if (tree == NULL)
         return FALSE;
 
-    pthread_mutex_lock(&tree->mtx);
+    uint64_t prefix = key_prefix(key);
+    tree_lock(&tree->mtx);
 
     if (tree->key == NULL) {  // head node was deleted after lock
         pthread_mutex_unlock(&tree->mtx);
@@ -352,12 +525,13 @@ lookup(struct TreeNode *tree, char *key, void **value)
 
     while (curr) {
         DEBUG("key = %s, curr->key = %s\n", key, curr->key);
-        if (strcmp(key, curr->key) == 0)
+        int cmp = key_cmp(key, prefix, curr);
+        if (cmp == 0)
             break;
         
-        struct TreeNode *next = strcmp(key, curr->key) < 0 ? curr->left : curr->right;
+        struct TreeNode *next = cmp < 0 ? curr->left : curr->right;
         if (next)
-            pthread_mutex_lock(&next->mtx);
+            tree_lock(&next->mtx);
         
         if (parent)
             pthread_mutex_unlock(&parent->mtx);
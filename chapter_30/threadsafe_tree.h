@@ -4,13 +4,28 @@
 #include <pthread.h>
 #include "tlpi_hdr.h"
 
-struct TreeNode {
-    pthread_mutex_t mtx;
-    char *key;
-    void *value;
-    struct TreeNode *left;
-    struct TreeNode *right;
-};
+// Opaque: every implementation lays out its own nodes (threadsafe_tree.c, balanced_tree.c, skiplist_tree.c).
+struct TreeNode;
+
+// Node locks are taken with tree_lock(), which counts (per thread) how often a lock was already held by
+// someone else - the lock contention reported by test_threadsafe_tree -b. Every implementation defines
+// tree_lock_stats.
+typedef struct TreeLockStats {
+    unsigned long locks;
+    unsigned long contended; // pthread_mutex_trylock() failed, had to wait for the lock
+} TreeLockStats;
+
+extern __thread TreeLockStats tree_lock_stats;
+
+static inline void
+tree_lock(pthread_mutex_t *mtx)
+{
+    tree_lock_stats.locks++;
+    if (pthread_mutex_trylock(mtx) != 0) {
+        tree_lock_stats.contended++;
+        pthread_mutex_lock(mtx);
+    }
+}
 
 struct TreeNode *new_tree(void);
 void initialize(struct TreeNode *tree);
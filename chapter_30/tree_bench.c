@@ -0,0 +1,153 @@
+#include <limits.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "threadsafe_tree.h"
+
+// Insertion order benchmark for the threadsafe_tree.h implementations
+//
+// Built for every implementation: tree_bench (plain BST, threadsafe_tree.c), balanced_tree_bench (treap,
+// balanced_tree.c) and skiplist_tree_bench (skip list, skiplist_tree.c).
+// Each thread inserts, looks up and deletes its share of the keys (every num-threads'th key):
+// * sorted - in ascending order, the worst case of a BST that doesn't rebalance
+// * random - in a shuffled order
+// For the plain BST (built with -DUNBALANCED_TREE) the sorted run is capped at SORTED_KEYS_MAX keys: each
+// insert walks, and locks, every node before it, so 1M sorted keys would take hours.
+
+#define KEY_LEN 16
+
+#ifdef UNBALANCED_TREE
+#define SORTED_KEYS_MAX 20000
+#else
+#define SORTED_KEYS_MAX INT_MAX
+#endif
+
+typedef struct ThreadArgs {
+    struct TreeNode *tree;
+    char (*keys)[KEY_LEN];
+    const int *order;
+    int num_keys;
+    int thread_id;
+    int num_threads;
+} ThreadArgs;
+
+typedef enum { PHASE_ADD, PHASE_LOOKUP, PHASE_DELETE } Phase;
+
+static Phase phase;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [num-keys [num-threads]]\n", progName);
+    fprintf(stderr, "  defaults: 1000000 keys, 4 threads\n");
+    if (SORTED_KEYS_MAX < INT_MAX)
+        fprintf(stderr, "  the sorted run uses at most %d keys\n", SORTED_KEYS_MAX);
+    exit(EXIT_FAILURE);
+}
+
+static void *
+worker(void *arg)
+{
+    ThreadArgs *args = arg;
+    void *value;
+
+    for (int i = args->thread_id; i < args->num_keys; i += args->num_threads) {
+        char *key = args->keys[args->order[i]];
+        switch (phase) {
+        case PHASE_ADD:
+            add(args->tree, key, key);
+            break;
+        case PHASE_LOOKUP:
+            if (!lookup(args->tree, key, &value) || value != key)
+                fatal("lookup(%s) failed", key);
+            break;
+        case PHASE_DELETE:
+            delete(args->tree, key);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static double
+run_phase(Phase p, ThreadArgs *args, int num_threads)
+{
+    pthread_t threads[num_threads];
+    struct timespec start, end;
+
+    phase = p;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_threads; i++) {
+        int s = pthread_create(&threads[i], NULL, worker, &args[i]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void
+bench(const char *name, const int *order, char (*keys)[KEY_LEN], int num_keys, int num_threads)
+{
+    struct TreeNode *tree = new_tree();
+    ThreadArgs args[num_threads];
+    for (int i = 0; i < num_threads; i++) {
+        args[i] = (ThreadArgs) {
+            .tree = tree, .keys = keys, .order = order,
+            .num_keys = num_keys, .thread_id = i, .num_threads = num_threads,
+        };
+    }
+
+    double add_secs = run_phase(PHASE_ADD, args, num_threads);
+    double lookup_secs = run_phase(PHASE_LOOKUP, args, num_threads);
+    double delete_secs = run_phase(PHASE_DELETE, args, num_threads);
+
+    printf("| %-6s | %10.3f | %12.0f | %12.0f | %12.0f |\n", name, add_secs,
+           num_keys / add_secs, num_keys / lookup_secs, num_keys / delete_secs);
+    free(tree);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 3 || (argc > 1 && strcmp(argv[1], "--help") == 0))
+        usageError(argv[0]);
+
+    int num_keys = argc > 1 ? getInt(argv[1], GN_GT_0, "num-keys") : 1000000;
+    int num_threads = argc > 2 ? getInt(argv[2], GN_GT_0, "num-threads") : 4;
+
+    // zero padded, so the lexical order of the keys is their numeric order
+    char (*keys)[KEY_LEN] = malloc(num_keys * sizeof(*keys));
+    int *sorted = malloc(num_keys * sizeof(int));
+    int *shuffled = malloc(num_keys * sizeof(int));
+    if (keys == NULL || sorted == NULL || shuffled == NULL)
+        errExit("malloc");
+
+    for (int i = 0; i < num_keys; i++) {
+        snprintf(keys[i], KEY_LEN, "key_%010d", i);
+        sorted[i] = shuffled[i] = i;
+    }
+    srandom(1);
+    for (int i = num_keys - 1; i > 0; i--) {
+        int j = random() % (i + 1);
+        int tmp = shuffled[i];
+        shuffled[i] = shuffled[j];
+        shuffled[j] = tmp;
+    }
+
+    int num_sorted = num_keys < SORTED_KEYS_MAX ? num_keys : SORTED_KEYS_MAX;
+    printf("%s: %d keys, %d threads\n", argv[0], num_keys, num_threads);
+    if (num_sorted < num_keys)
+        printf("sorted run capped at %d keys (the unbalanced tree walks every node on each insert)\n", num_sorted);
+    printf("| Order  | Insert (s) | Inserts/s    | Lookups/s    | Deletes/s    |\n");
+    printf("|--------|------------|--------------|--------------|--------------|\n");
+    bench("sorted", sorted, keys, num_sorted, num_threads);
+    bench("random", shuffled, keys, num_keys, num_threads);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,134 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "threadsafe_tree.h"
+
+// Lookup scaling benchmark for the threadsafe_tree.h implementations
+//
+// Built for every implementation, like tree_bench: tree_read_bench (plain BST, whose lookups lock
+// hand-over-hand), balanced_tree_read_bench (treap) and skiplist_tree_read_bench (skip list), whose lookups take
+// no locks. The tree is filled with shuffled keys, then
+// for every thread count the threads look up random keys for a fixed time.
+
+#define KEY_LEN 16
+
+typedef struct ThreadArgs {
+    struct TreeNode *tree;
+    char (*keys)[KEY_LEN];
+    int num_keys;
+    unsigned int seed;
+    long long lookups;
+} ThreadArgs;
+
+static volatile int stop;
+static pthread_barrier_t start_barrier;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [num-keys [seconds [num-threads...]]]\n", progName);
+    fprintf(stderr, "  defaults: 100000 keys, 1 second, 1 2 4 8 16 32 64 threads\n");
+    exit(EXIT_FAILURE);
+}
+
+static void *
+reader(void *arg)
+{
+    ThreadArgs *args = arg;
+    void *value;
+    long long n = 0;
+
+    pthread_barrier_wait(&start_barrier);
+    while (!stop) {
+        char *key = args->keys[rand_r(&args->seed) % args->num_keys];
+        if (!lookup(args->tree, key, &value))
+            fatal("lookup(%s) failed", key);
+        n++;
+    }
+    args->lookups = n;
+    return NULL;
+}
+
+static double
+run(struct TreeNode *tree, char (*keys)[KEY_LEN], int num_keys, int num_threads, int seconds)
+{
+    pthread_t threads[num_threads];
+    ThreadArgs args[num_threads];
+
+    stop = 0;
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        args[i] = (ThreadArgs) { .tree = tree, .keys = keys, .num_keys = num_keys, .seed = i + 1 };
+        int s = pthread_create(&threads[i], NULL, reader, &args[i]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    struct timespec start, end;
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sleep(seconds);
+    stop = 1;
+
+    long long total = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        total += args[i].lookups;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_barrier_destroy(&start_barrier);
+
+    return total / ((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    int num_keys = argc > 1 ? getInt(argv[1], GN_GT_0, "num-keys") : 100000;
+    int seconds = argc > 2 ? getInt(argv[2], GN_GT_0, "seconds") : 1;
+
+    int default_threads[] = { 1, 2, 4, 8, 16, 32, 64 };
+    int num_counts = argc > 3 ? argc - 3 : (int) (sizeof(default_threads) / sizeof(default_threads[0]));
+    int thread_counts[num_counts];
+    for (int i = 0; i < num_counts; i++)
+        thread_counts[i] = argc > 3 ? getInt(argv[i + 3], GN_GT_0, "num-threads") : default_threads[i];
+
+    char (*keys)[KEY_LEN] = malloc(num_keys * sizeof(*keys));
+    int *order = malloc(num_keys * sizeof(int));
+    if (keys == NULL || order == NULL)
+        errExit("malloc");
+    for (int i = 0; i < num_keys; i++) {
+        snprintf(keys[i], KEY_LEN, "key_%010d", i);
+        order[i] = i;
+    }
+    srandom(1);
+    for (int i = num_keys - 1; i > 0; i--) {
+        int j = random() % (i + 1);
+        int tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    struct TreeNode *tree = new_tree();
+    for (int i = 0; i < num_keys; i++)
+        add(tree, keys[order[i]], keys[order[i]]);
+
+    printf("%s: %d keys, %d second(s) per run, %ld CPUs\n", argv[0], num_keys, seconds, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| Threads | Lookups/s    | Per thread   | Speedup |\n");
+    printf("|---------|--------------|--------------|---------|\n");
+    double base = 0;
+    for (int i = 0; i < num_counts; i++) {
+        double rate = run(tree, keys, num_keys, thread_counts[i], seconds);
+        if (i == 0)
+            base = rate / thread_counts[i];
+        printf("| %7d | %12.0f | %12.0f | %6.2fx |\n",
+               thread_counts[i], rate, rate / thread_counts[i], rate / base);
+    }
+
+    exit(EXIT_SUCCESS);
+}
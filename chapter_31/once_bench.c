@@ -0,0 +1,152 @@
+#include <pthread.h>
+#include <time.h>
+
+#include "tlpi_hdr.h"
+#include "one_time.h"
+
+// Per-call cost of an initialization check that has long been done, at 1-32 threads:
+// * pthread_once   - glibc's, which is a load with acquire semantics after the first call
+// * one_time_init  - one_time_init.c, with its acquire-load fast path
+// * locked         - one_time_init as it was before the fast path: lock, check, unlock on every call
+
+enum { KIND_PTHREAD_ONCE, KIND_ONE_TIME, KIND_LOCKED, NUM_KINDS };
+static const char *kind_names[NUM_KINDS] = { "pthread_once", "one_time_init", "locked" };
+
+typedef struct ThreadArgs {
+    int kind;
+    long calls;
+    struct timespec start, end;
+} ThreadArgs;
+
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+static OneTimeControl one_time = ONE_TIME_INITIALIZER;
+static OneTimeControl locked = ONE_TIME_INITIALIZER;
+static volatile int init_count;
+
+static pthread_barrier_t start_barrier;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [calls-per-thread [num-threads...]]\n", progName);
+    fprintf(stderr, "  defaults: 2000000 calls, 1 2 4 8 16 32 threads\n");
+    exit(EXIT_FAILURE);
+}
+
+static void
+init(void)
+{
+    init_count++;
+}
+
+static void
+locked_init(OneTimeControl *control, void (*init)(void))
+{
+    pthread_mutex_lock(&control->mtx);
+    if (!control->initialized) {
+        (*init)();
+        control->initialized = TRUE;
+    }
+    pthread_mutex_unlock(&control->mtx);
+}
+
+static void *
+caller(void *arg)
+{
+    ThreadArgs *args = arg;
+    long calls = args->calls;
+
+    pthread_barrier_wait(&start_barrier);
+    clock_gettime(CLOCK_MONOTONIC, &args->start);
+    switch (args->kind) {
+    case KIND_PTHREAD_ONCE:
+        for (long i = 0; i < calls; i++)
+            pthread_once(&once, init);
+        break;
+    case KIND_ONE_TIME:
+        for (long i = 0; i < calls; i++)
+            one_time_init(&one_time, init);
+        break;
+    case KIND_LOCKED:
+        for (long i = 0; i < calls; i++)
+            locked_init(&locked, init);
+        break;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &args->end);
+    return NULL;
+}
+
+static double
+ts_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1e9 + ts->tv_nsec;
+}
+
+// ns per call: from the first thread starting to the last one finishing, over all calls (the threads take the
+// times themselves, as on a single CPU the main thread may only run again once they are done)
+static double
+run(int kind, int num_threads, long calls)
+{
+    pthread_t threads[num_threads];
+    ThreadArgs args[num_threads];
+
+    pthread_barrier_init(&start_barrier, NULL, num_threads + 1);
+    for (int i = 0; i < num_threads; i++) {
+        args[i] = (ThreadArgs) { .kind = kind, .calls = calls };
+        int s = pthread_create(&threads[i], NULL, caller, &args[i]);
+        if (s != 0)
+            errExitEN(s, "pthread_create");
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    double start = 0, end = 0;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+        if (i == 0 || ts_ns(&args[i].start) < start)
+            start = ts_ns(&args[i].start);
+        if (ts_ns(&args[i].end) > end)
+            end = ts_ns(&args[i].end);
+    }
+    pthread_barrier_destroy(&start_barrier);
+
+    return (end - start) / ((double) num_threads * calls);
+}
+
+int
+main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "--help") == 0)
+        usageError(argv[0]);
+
+    long calls = argc > 1 ? getLong(argv[1], GN_GT_0, "calls-per-thread") : 2000000;
+
+    int default_threads[] = { 1, 2, 4, 8, 16, 32 };
+    int num_counts = argc > 2 ? argc - 2 : (int) (sizeof(default_threads) / sizeof(default_threads[0]));
+    int thread_counts[num_counts];
+    for (int i = 0; i < num_counts; i++)
+        thread_counts[i] = argc > 2 ? getInt(argv[i + 2], GN_GT_0, "num-threads") : default_threads[i];
+
+    printf("%s: %ld calls per thread, %ld CPUs; ns per call (wall clock time / total calls)\n",
+           argv[0], calls, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| Threads |");
+    for (int k = 0; k < NUM_KINDS; k++)
+        printf(" %-13s |", kind_names[k]);
+    printf("\n|---------|");
+    for (int k = 0; k < NUM_KINDS; k++)
+        printf("---------------|");
+    printf("\n");
+
+    for (int i = 0; i < num_counts; i++) {
+        printf("| %7d |", thread_counts[i]);
+        for (int k = 0; k < NUM_KINDS; k++)
+            printf(" %13.2f |", run(k, thread_counts[i], calls));
+        printf("\n");
+    }
+
+    // every kind ran its init exactly once
+    if (init_count != NUM_KINDS)
+        fatal("init ran %d times, expected %d (once per kind)", init_count, NUM_KINDS);
+
+    exit(EXIT_SUCCESS);
+}
@@ -1,37 +1,11 @@
 #include <pthread.h>
 
 #include "tlpi_hdr.h"
-
-
-typedef struct {
-    Boolean initialized;
-    pthread_mutex_t mtx;
-} OneTimeControl;
-
-
-#define ONE_TIME_INITIALIZER { FALSE, PTHREAD_MUTEX_INITIALIZER }
+#include "one_time.h"
 
 
 static OneTimeControl one_time = ONE_TIME_INITIALIZER;
 
-void one_time_init(OneTimeControl *control, void (*init)(void));
-
-void
-one_time_init(OneTimeControl *control, void (*init)(void))
-{
-    int res;
-    if ((res = pthread_mutex_lock(&control->mtx)) == -1)
-        errExitEN(res, "pthread_mutex_lock");
-
-    if (!control->initialized) {
-        (*init)();
-        control->initialized = true;
-    }
-
-    if ((res = pthread_mutex_unlock(&control->mtx)) == -1)
-        errExitEN(res, "pthread_mutex_unlock");
-}
-
 
 static void
 run_me_once(void)
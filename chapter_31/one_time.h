@@ -0,0 +1,20 @@
+#ifndef ONE_TIME_H
+#define ONE_TIME_H
+
+#include <pthread.h>
+
+#include "tlpi_hdr.h"
+
+
+typedef struct {
+    Boolean initialized;
+    pthread_mutex_t mtx;
+} OneTimeControl;
+
+
+#define ONE_TIME_INITIALIZER { FALSE, PTHREAD_MUTEX_INITIALIZER }
+
+
+void one_time_init(OneTimeControl *control, void (*init)(void));
+
+#endif
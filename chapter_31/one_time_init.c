@@ -0,0 +1,28 @@
+#include <pthread.h>
+
+#include "tlpi_hdr.h"
+#include "one_time.h"
+
+
+void
+one_time_init(OneTimeControl *control, void (*init)(void))
+{
+    int res;
+
+    // fast path: once initialization is done, callers don't touch the mutex at all. The acquire load pairs
+    // with the release store below - a caller that sees initialized set also sees everything init() wrote
+    if (__atomic_load_n(&control->initialized, __ATOMIC_ACQUIRE))
+        return;
+
+    if ((res = pthread_mutex_lock(&control->mtx)) != 0)
+        errExitEN(res, "pthread_mutex_lock");
+
+    // whoever held the mutex before us may have done the initialization already
+    if (!control->initialized) {
+        (*init)();
+        __atomic_store_n(&control->initialized, TRUE, __ATOMIC_RELEASE);
+    }
+
+    if ((res = pthread_mutex_unlock(&control->mtx)) != 0)
+        errExitEN(res, "pthread_mutex_unlock");
+}
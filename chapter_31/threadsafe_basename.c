@@ -4,6 +4,7 @@
 #include <assert.h>
 
 #include "tlpi_hdr.h"
+#include "one_time.h"
 
 
 char *basename(char *path);
@@ -12,7 +13,36 @@ char *basename(char *path);
 #define BUF_SIZE 4096
 
 
-static __thread char buf[BUF_SIZE];
+// every thread gets its own buffer, as thread-specific data; the key is created on the first call
+static OneTimeControl buf_key_once = ONE_TIME_INITIALIZER;
+static pthread_key_t buf_key;
+
+
+static void
+create_buf_key(void)
+{
+    int res;
+    if ((res = pthread_key_create(&buf_key, free)) != 0)
+        errExitEN(res, "pthread_key_create");
+}
+
+
+static char *
+get_buf(void)
+{
+    int res;
+    one_time_init(&buf_key_once, create_buf_key);
+
+    char *buf = pthread_getspecific(buf_key);
+    if (buf == NULL) { // first call in this thread
+        buf = malloc(BUF_SIZE);
+        if (buf == NULL)
+            errExit("malloc");
+        if ((res = pthread_setspecific(buf_key, buf)) != 0)
+            errExitEN(res, "pthread_setspecific");
+    }
+    return buf;
+}
 
 
 char *
@@ -22,8 +52,9 @@ basename(char *path)
         return ".";
     }
 
-    strncpy(buf, path, sizeof(buf) - 1);
-    buf[sizeof(buf) - 1] = '\0';
+    char *buf = get_buf();
+    strncpy(buf, path, BUF_SIZE - 1);
+    buf[BUF_SIZE - 1] = '\0';
 
     size_t len = strlen(buf);
 
@@ -0,0 +1,180 @@
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "tlpi_hdr.h"
+#include "helper.h"
+#include "ring_ctl.h"
+
+#define RING_BYTES  (64 * 1024)     // the default capacity of a pipe, for a fair comparison
+#define WRITE_END   1
+#define READ_END    0
+
+// shared anonymous mapping for the slots of a ring, set up before fork() so both processes have it
+static char *
+map_slots(long nslots, long block_size)
+{
+    char *slots = mmap(NULL, nslots * block_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED)
+        errExit("mmap slots");
+    return slots;
+}
+
+// -l: round trips of block-size bytes through two one-slot rings, one in each direction
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct ring_ctl *ping, *pong;
+    char *ping_slot, *pong_slot;
+    struct latency_hist hist;
+    char *buffer;
+
+    buffer = malloc(opts->block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', opts->block_size);
+
+    ping = ring_ctl_create(1);
+    pong = ring_ctl_create(1);
+    ping_slot = map_slots(1, opts->block_size);
+    pong_slot = map_slots(1, opts->block_size);
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - echoes every message back
+        set_cpu_affinity(opts->child_cpu); // pin child to core 0 (or as -c says)
+
+        for (long i = 0; i < total; i++) {
+            ring_wait_data(ping);
+            memcpy(buffer, ping_slot, opts->block_size);
+            ring_release(ping);
+
+            ring_wait_space(pong);
+            memcpy(pong_slot, buffer, opts->block_size);
+            ring_publish(pong);
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu); // pin parent to core 1 (or as -c says)
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            ring_wait_space(ping);
+            memcpy(ping_slot, buffer, opts->block_size);
+            ring_publish(ping);
+
+            ring_wait_data(pong);
+            memcpy(buffer, pong_slot, opts->block_size);
+            ring_release(pong);
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        report_latency("eventfd_shm", opts, &hist);
+    }
+
+    free(buffer);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int syncfd[2];
+    long block_num, block_size, nslots;
+    char *buffer, *slots;
+    struct ring_ctl *ring;
+    long long start_time, end_time, elapsed_ns;
+    double elapsed_sec;
+    char sync_byte;
+    struct bench_opts opts;
+
+    parse_bench_args(argc, argv, &opts, 0);
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
+
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
+
+    buffer = malloc(block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', block_size);
+
+    // as many slots as fit in RING_BYTES, but at least 2 so that both sides can work at once
+    nslots = RING_BYTES / block_size > 2 ? RING_BYTES / block_size : 2;
+    ring = ring_ctl_create(nslots);
+    slots = map_slots(nslots, block_size);
+
+    // the ring has no way to send anything but blocks, so the sync byte goes through a pipe
+    if (pipe(syncfd) == -1)
+        errExit("pipe");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - writer
+        set_cpu_affinity(opts.child_cpu);  // pin child to core 0 (or as -c says)
+
+        sync_byte = 1;
+        if (write(syncfd[WRITE_END], &sync_byte, 1) != 1)
+            errExit("sync write");
+
+        // copy data blocks into the ring as fast as it has room
+        for (long i = 0; i < block_num; i++) {
+            long idx = ring_wait_space(ring);
+            memcpy(slots + idx * block_size, buffer, block_size);
+            ring_publish(ring);
+        }
+
+        free(buffer);
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - reader
+        set_cpu_affinity(opts.parent_cpu);  // pin parent to core 1 (or as -c says)
+
+        if (read(syncfd[READ_END], &sync_byte, 1) != 1)
+            errExit("sync read");
+
+        start_time = get_current_time_ns();
+
+        // copy every block out of the ring into our own buffer
+        long blocks_read = 0;
+        while (blocks_read < block_num) {
+            long idx = ring_wait_data(ring);
+            memcpy(buffer, slots + idx * block_size, block_size);
+            ring_release(ring);
+            blocks_read++;
+        }
+
+        end_time = get_current_time_ns();
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        elapsed_ns = end_time - start_time;
+        elapsed_sec = elapsed_ns / 1000000000.0;
+
+        report_bandwidth("eventfd_shm", &opts, blocks_read, elapsed_sec);
+
+        break;
+    }
+
+    free(buffer);
+    exit(EXIT_SUCCESS);
+}
@@ -3,18 +3,61 @@
 
 #include <time.h>
 #include <sched.h>
+#include <sys/utsname.h>
 
 #include "tlpi_hdr.h"
 #include "helper.h"
 
 // show usage message for bandwidth measurement programs
 void
-show_usage(char *prog_name)
+show_usage(char *prog_name, int flags)
 {
-    usageErr("Usage: %s num-blocks block-size\n", prog_name);
+    if (flags & BENCH_MMSG_OPTS)
+        usageErr("%s [-l] [-m] [-c child-cpu,parent-cpu] [-b batch] [-s sock-buf] num-blocks block-size\n"
+                 "  -l: measure round-trip latency of num-blocks messages instead of bandwidth\n"
+                 "  -m: machine-readable output (one JSON line)\n"
+                 "  -c: CPUs to pin the child (writer) and the parent (reader) to (default 0,1)\n"
+                 "  -b: messages per sendmmsg()/recvmmsg() call (default 1)\n"
+                 "  -s: SO_SNDBUF/SO_RCVBUF size in bytes (default: system's)\n", prog_name);
+    usageErr("%s [-l] [-m] [-c child-cpu,parent-cpu] num-blocks block-size\n"
+             "  -l: measure round-trip latency of num-blocks messages instead of bandwidth\n"
+             "  -m: machine-readable output (one JSON line)\n"
+             "  -c: CPUs to pin the child (writer) and the parent (reader) to (default 0,1)\n", prog_name);
+}
+
+// parse the command line, exit with usage message on error
+void
+parse_bench_args(int argc, char *argv[], struct bench_opts *opts, int flags)
+{
+    int opt;
+
+    memset(opts, 0, sizeof(*opts));
+    opts->child_cpu = 0;
+    opts->parent_cpu = 1;
+    opts->batch = 1;
+    while ((opt = getopt(argc, argv, flags & BENCH_MMSG_OPTS ? "lmc:b:s:" : "lmc:")) != -1) {
+        switch (opt) {
+        case 'l': opts->latency = 1; break;
+        case 'm': opts->machine = 1; break;
+        case 'c':
+            if (sscanf(optarg, "%d,%d", &opts->child_cpu, &opts->parent_cpu) != 2 ||
+                    opts->child_cpu < 0 || opts->parent_cpu < 0)
+                show_usage(argv[0], flags);
+            break;
+        case 'b': opts->batch = getInt(optarg, GN_GT_0, "batch"); break;
+        case 's': opts->sock_buf = getInt(optarg, GN_GT_0, "sock-buf"); break;
+        default: show_usage(argv[0], flags);
+        }
+    }
+    if (argc - optind != 2)
+        show_usage(argv[0], flags);
+
+    opts->num_blocks = getLong(argv[optind], GN_GT_0, "num-blocks");
+    opts->block_size = getLong(argv[optind + 1], GN_GT_0, "block-size");
 }
 
 // pin process to specific CPU core
+// if the machine doesn't have that core, warn and run unpinned rather than not at all
 void
 set_cpu_affinity(int core)
 {
@@ -23,8 +66,11 @@ set_cpu_affinity(int core)
     CPU_ZERO(&cpuset);
     CPU_SET(core, &cpuset);
     
-    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1)
-        errExit("sched_setaffinity");
+    if (sched_setaffinity(0, sizeof(cpuset), &cpuset) == -1) {
+        if (errno != EINVAL)
+            errExit("sched_setaffinity");
+        fprintf(stderr, "warning: no CPU core %d, running unpinned\n", core);
+    }
 }
 
 // get current time in nanoseconds using monotonic clock
@@ -38,3 +84,81 @@ get_current_time_ns(void)
     
     return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
+
+ssize_t
+read_fully(int fd, void *buf, size_t len)
+{
+    size_t total = 0;
+
+    while (total < len) {
+        ssize_t n = read(fd, (char *) buf + total, len - total);
+        if (n == -1)
+            return -1;
+        if (n == 0)
+            break;  // EOF
+        total += n;
+    }
+    return total;
+}
+
+long
+latency_warmup(long num_blocks)
+{
+    return num_blocks / 10 < 1000 ? num_blocks / 10 : 1000;
+}
+
+// the fields that say where a result comes from, for comparing across kernels and hosts
+static void
+print_host_fields(void)
+{
+    struct utsname uts;
+
+    if (uname(&uts) == -1)
+        errExit("uname");
+    printf("\"host\":\"%s\",\"kernel\":\"%s\",\"machine\":\"%s\",\"cpus\":%ld",
+           uts.nodename, uts.release, uts.machine, sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+void
+report_bandwidth(const char *transport, const struct bench_opts *opts, long blocks_read, double elapsed_sec)
+{
+    double total_bytes = (double) blocks_read * opts->block_size;
+    double bandwidth = total_bytes / elapsed_sec;
+
+    if (opts->machine) {
+        printf("{\"transport\":\"%s\",\"mode\":\"bandwidth\",\"block_size\":%ld,\"blocks\":%ld,"
+               "\"elapsed_s\":%.6f,\"mb_per_s\":%.2f,\"msgs_per_s\":%.0f,\"batch\":%d,\"sock_buf\":%d,"
+               "\"child_cpu\":%d,\"parent_cpu\":%d,", transport, opts->block_size, blocks_read, elapsed_sec,
+               bandwidth / (1024.0 * 1024.0), blocks_read / elapsed_sec, opts->batch, opts->sock_buf,
+               opts->child_cpu, opts->parent_cpu);
+        print_host_fields();
+        printf("}\n");
+        return;
+    }
+    printf("  Blocks read: %ld\n", blocks_read);
+    printf("  Bytes transferred: %.0f\n", total_bytes);
+    printf("  Elapsed time: %.6f seconds\n", elapsed_sec);
+    printf("  Bandwidth: %.2f MB/second\n", bandwidth / (1024.0 * 1024.0));
+    printf("  Message rate: %.0f messages/second\n", blocks_read / elapsed_sec);
+}
+
+void
+report_latency(const char *transport, const struct bench_opts *opts, const struct latency_hist *h)
+{
+    double mean = h->count > 0 ? (double) h->sum / h->count : 0;
+
+    if (opts->machine) {
+        printf("{\"transport\":\"%s\",\"mode\":\"latency\",\"block_size\":%ld,\"round_trips\":%lld,"
+               "\"min_ns\":%lld,\"p50_ns\":%lld,\"p99_ns\":%lld,\"p999_ns\":%lld,\"max_ns\":%lld,"
+               "\"mean_ns\":%.0f,\"child_cpu\":%d,\"parent_cpu\":%d,", transport, opts->block_size, h->count,
+               h->min, hist_percentile(h, 0.5), hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max,
+               mean, opts->child_cpu, opts->parent_cpu);
+        print_host_fields();
+        printf("}\n");
+        return;
+    }
+    printf("  Round trips: %lld (of %ld bytes)\n", h->count, opts->block_size);
+    printf("  Latency: min %lld ns, mean %.0f ns\n", h->min, mean);
+    printf("  Latency: p50 %lld ns, p99 %lld ns, p999 %lld ns, max %lld ns\n", hist_percentile(h, 0.5),
+           hist_percentile(h, 0.99), hist_percentile(h, 0.999), h->max);
+}
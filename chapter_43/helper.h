@@ -1,8 +1,36 @@
 #ifndef HELPER_H
 #define HELPER_H
 
-// show usage message for bandwidth measurement programs
-void show_usage(char *prog_name);
+#include <sys/types.h>
+
+#include "latency_hist.h"
+
+// options of the bandwidth measurement programs:
+//     prog [-l] [-m] [-c child-cpu,parent-cpu] [-b batch] [-s sock-buf] num-blocks block-size
+// -l measures round-trip latency instead: the parent sends num-blocks messages of block-size bytes one at
+// a time, and the child sends each one straight back.
+// -m prints one machine-readable line (JSON) instead of the text report.
+// -c pins the child (the writer) and the parent (the reader) to those CPUs instead of 0 and 1.
+// -b and -s are accepted only with BENCH_MMSG_OPTS (uds_bandwidth): messages per sendmmsg()/recvmmsg() call
+// (1: send() and recv()), and the SO_SNDBUF/SO_RCVBUF size to ask for (0: the default). the program stores
+// the size it got.
+#define BENCH_MMSG_OPTS 1
+struct bench_opts {
+    int latency;
+    int machine;
+    int child_cpu;
+    int parent_cpu;
+    int batch;
+    int sock_buf;
+    long num_blocks;
+    long block_size;
+};
+
+// show usage message for bandwidth measurement programs; 'flags' as for parse_bench_args()
+void show_usage(char *prog_name, int flags);
+
+// parse the command line described above, exit with usage message on error. 'flags' is 0 or BENCH_MMSG_OPTS
+void parse_bench_args(int argc, char *argv[], struct bench_opts *opts, int flags);
 
 // pin process to specific CPU core
 void set_cpu_affinity(int core);
@@ -10,4 +38,15 @@ void set_cpu_affinity(int core);
 // get current time in nanoseconds using monotonic clock
 long long get_current_time_ns(void);
 
-#endif /* HELPER_H */ 
+// read until 'len' bytes or EOF (for byte streams, which may return less per read); returns bytes read
+ssize_t read_fully(int fd, void *buf, size_t len);
+
+// round trips made before recording, so that caches and the scheduler settle
+long latency_warmup(long num_blocks);
+
+// print results, as text or (-m) as one JSON line naming 'transport'
+void report_bandwidth(const char *transport, const struct bench_opts *opts, long blocks_read,
+                      double elapsed_sec);
+void report_latency(const char *transport, const struct bench_opts *opts, const struct latency_hist *h);
+
+#endif /* HELPER_H */
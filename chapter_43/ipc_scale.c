@@ -0,0 +1,394 @@
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/wait.h>
+#include <ctype.h>
+#include <limits.h>
+
+#include "tlpi_hdr.h"
+
+// run one of the bandwidth programs as several independent pairs at once, or once for every pair of CPUs.
+//
+//     ipc_scale [-l] [-m] [-k pairs] [-p placement] program num-blocks block-size
+//     ipc_scale [-l] [-m] -M program num-blocks block-size
+//
+// the CPU topology comes from /sys/devices/system/cpu. a placement says how the two processes of a pair sit
+// relative to each other:
+//     same     both on the same CPU
+//     smt      on two hardware threads (SMT siblings) of one core
+//     core     on two different cores of one socket
+//     socket   on two different sockets
+//     any      on two different CPUs (the default; 'same' on a machine with one CPU)
+//     c,p[:c,p...]  exactly these CPUs (child, parent), a pair per c,p
+// except with an explicit list, each pair gets CPUs no other pair uses.
+//
+// -M runs the program once for every (child CPU, parent CPU) and prints a core-to-core matrix of the median
+// round trip (-l) or the bandwidth. -m prints the programs' own JSON lines instead of the tables.
+
+#define MAX_CPUS    1024
+#define MAX_PAIRS   (MAX_CPUS / 2)
+#define SYS_CPU     "/sys/devices/system/cpu"
+
+struct cpu_topo {
+    int cpu;
+    int package;    // physical_package_id (socket)
+    int core;       // core_id, unique within its package
+};
+
+static struct cpu_topo topo[MAX_CPUS];
+static int num_cpus;
+
+struct pair {
+    int child_cpu, parent_cpu;
+    pid_t pid;
+    int fd;                 // the program's stdout
+    char result[1024];      // its JSON line
+};
+
+// read one integer from a sysfs file, -1 if there is no such file (e.g. no topology for that CPU)
+static int
+read_sys_int(const char *path)
+{
+    FILE *fp;
+    int val;
+
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    if (fscanf(fp, "%d", &val) != 1)
+        val = -1;
+    fclose(fp);
+    return val;
+}
+
+// discover the online CPUs and where each one is; the online list has the kernel's "0-3,6,8-9" format
+static void
+read_topology(void)
+{
+    char list[4096], path[PATH_MAX];
+    FILE *fp;
+    char *p;
+
+    fp = fopen(SYS_CPU "/online", "r");
+    if (fp == NULL)
+        errExit("fopen " SYS_CPU "/online");
+    if (fgets(list, sizeof(list), fp) == NULL)
+        fatal("can't read " SYS_CPU "/online");
+    fclose(fp);
+
+    num_cpus = 0;
+    for (p = list; *p != '\0' && *p != '\n'; ) {
+        int lo, hi, n;
+
+        if (sscanf(p, "%d%n", &lo, &n) != 1)
+            fatal("bad CPU list: %s", list);
+        p += n;
+        hi = lo;
+        if (*p == '-') {
+            if (sscanf(p + 1, "%d%n", &hi, &n) != 1)
+                fatal("bad CPU list: %s", list);
+            p += n + 1;
+        }
+        if (*p == ',')
+            p++;
+
+        for (int cpu = lo; cpu <= hi && num_cpus < MAX_CPUS; cpu++) {
+            topo[num_cpus].cpu = cpu;
+            snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/physical_package_id", cpu);
+            topo[num_cpus].package = read_sys_int(path);
+            snprintf(path, sizeof(path), SYS_CPU "/cpu%d/topology/core_id", cpu);
+            topo[num_cpus].core = read_sys_int(path);
+            num_cpus++;
+        }
+    }
+}
+
+// whether two CPUs stand in the relation a placement asks for
+static int
+placement_fits(const char *placement, const struct cpu_topo *a, const struct cpu_topo *b)
+{
+    int same_package = a->package == b->package;
+    int same_core = same_package && a->core == b->core;
+
+    if (strcmp(placement, "same") == 0)
+        return a->cpu == b->cpu;
+    if (a->cpu == b->cpu)
+        return 0;
+    if (strcmp(placement, "smt") == 0)
+        return same_core;
+    if (strcmp(placement, "core") == 0)
+        return same_package && !same_core;
+    if (strcmp(placement, "socket") == 0)
+        return !same_package;
+    if (strcmp(placement, "any") == 0)
+        return 1;
+
+    fatal("unknown placement '%s'", placement);
+    return 0;
+}
+
+// fill in 'num_pairs' pairs of CPUs for 'placement', each pair on CPUs that no other pair has
+static void
+choose_pairs(const char *placement, struct pair *pairs, int num_pairs)
+{
+    int used[MAX_CPUS] = { 0 };
+    int found = 0;
+
+    if (isdigit((unsigned char) placement[0])) {       // explicit list
+        const char *p = placement;
+        int n;
+
+        for (found = 0; found < num_pairs; found++) {
+            if (sscanf(p, "%d,%d%n", &pairs[found].child_cpu, &pairs[found].parent_cpu, &n) != 2)
+                fatal("placement '%s' has fewer than %d pairs", placement, num_pairs);
+            p += n;
+            if (*p == ':')
+                p++;
+        }
+        return;
+    }
+
+    for (int i = 0; i < num_cpus && found < num_pairs; i++) {
+        if (used[i])
+            continue;
+        for (int j = 0; j < num_cpus; j++) {
+            if ((j != i && used[j]) || !placement_fits(placement, &topo[i], &topo[j]))
+                continue;
+            pairs[found].child_cpu = topo[i].cpu;
+            pairs[found].parent_cpu = topo[j].cpu;
+            used[i] = used[j] = 1;
+            found++;
+            break;
+        }
+    }
+
+    if (found < num_pairs)
+        fatal("this machine has room for %d pair(s) with placement '%s', not %d", found, placement,
+              num_pairs);
+}
+
+// start the program for one pair, with its stdout to a pipe we read the JSON line from. The child doesn't exec
+// it until 'barrier' (the read end of a pipe) sees EOF, i.e. until the parent lets all the pairs go at once.
+static void
+spawn(struct pair *pr, const char *program, int latency, const char *num_blocks, const char *block_size,
+      int barrier[2])
+{
+    char cpus[32];
+    int pfd[2];
+    char c;
+
+    snprintf(cpus, sizeof(cpus), "%d,%d", pr->child_cpu, pr->parent_cpu);
+
+    if (pipe(pfd) == -1)
+        errExit("pipe");
+
+    switch (pr->pid = fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0:
+        if (dup2(pfd[1], STDOUT_FILENO) == -1)
+            errExit("dup2");
+        close(pfd[0]);
+        close(pfd[1]);
+
+        close(barrier[1]);
+        read(barrier[0], &c, 1);            // returns at EOF
+        close(barrier[0]);
+
+        if (latency)
+            execl(program, program, "-m", "-l", "-c", cpus, num_blocks, block_size, (char *) NULL);
+        else
+            execl(program, program, "-m", "-c", cpus, num_blocks, block_size, (char *) NULL);
+        errExit("execl %s", program);
+
+    default:
+        close(pfd[1]);
+        pr->fd = pfd[0];
+    }
+}
+
+// collect the program's output; its JSON line is the one starting with '{'
+static void
+collect(struct pair *pr)
+{
+    char out[4096];
+    size_t len = 0;
+    ssize_t n;
+    int status;
+    char *line;
+
+    while (len < sizeof(out) - 1 && (n = read(pr->fd, out + len, sizeof(out) - 1 - len)) > 0)
+        len += n;
+    out[len] = '\0';
+    close(pr->fd);
+
+    if (waitpid(pr->pid, &status, 0) == -1)
+        errExit("waitpid");
+
+    pr->result[0] = '\0';
+    for (line = strtok(out, "\n"); line != NULL; line = strtok(NULL, "\n"))
+        if (line[0] == '{')
+            snprintf(pr->result, sizeof(pr->result), "%s", line);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || pr->result[0] == '\0')
+        fatal("pair on CPUs %d,%d failed or gave no result (message queue block size over 8192?)",
+              pr->child_cpu, pr->parent_cpu);
+}
+
+// a numeric field of a JSON line
+static double
+field(const struct pair *pr, const char *name)
+{
+    char key[64];
+    const char *p;
+
+    snprintf(key, sizeof(key), "\"%s\":", name);
+    p = strstr(pr->result, key);
+    if (p == NULL)
+        fatal("no %s in: %s", name, pr->result);
+    return strtod(p + strlen(key), NULL);
+}
+
+static void
+run_pairs(struct pair *pairs, int num_pairs, const char *program, int latency, const char *num_blocks,
+          const char *block_size)
+{
+    int barrier[2];
+
+    if (pipe(barrier) == -1)
+        errExit("pipe");
+    for (int i = 0; i < num_pairs; i++)
+        spawn(&pairs[i], program, latency, num_blocks, block_size, barrier);
+    close(barrier[0]);
+    close(barrier[1]);                      // go
+
+    for (int i = 0; i < num_pairs; i++)
+        collect(&pairs[i]);
+}
+
+static void
+print_topology(void)
+{
+    printf("%d CPU(s) online:\n", num_cpus);
+    for (int i = 0; i < num_cpus; i++)
+        printf("  CPU %d: socket %d, core %d\n", topo[i].cpu, topo[i].package, topo[i].core);
+    printf("\n");
+}
+
+// all the pairs at once: each one's result, and the total (bandwidth) or the worst (latency). The pairs start
+// together, so their runs overlap and the total is the sum of their rates, as long as they take about as long.
+static void
+scale(const char *placement, int num_pairs, const char *program, int latency, int machine,
+      const char *num_blocks, const char *block_size)
+{
+    struct pair pairs[MAX_PAIRS];
+    double total = 0, worst_p50 = 0, worst_p99 = 0;
+
+    choose_pairs(placement, pairs, num_pairs);
+    run_pairs(pairs, num_pairs, program, latency, num_blocks, block_size);
+
+    if (machine) {
+        for (int i = 0; i < num_pairs; i++)
+            printf("%s\n", pairs[i].result);
+        return;
+    }
+
+    print_topology();
+    printf("%s, %d pair(s), placement '%s', %s-byte blocks:\n", program, num_pairs, placement, block_size);
+    for (int i = 0; i < num_pairs; i++) {
+        if (latency) {
+            printf("  CPUs %d,%d: p50 %.0f ns, p99 %.0f ns, p999 %.0f ns\n", pairs[i].child_cpu,
+                   pairs[i].parent_cpu, field(&pairs[i], "p50_ns"), field(&pairs[i], "p99_ns"),
+                   field(&pairs[i], "p999_ns"));
+            if (field(&pairs[i], "p50_ns") > worst_p50)
+                worst_p50 = field(&pairs[i], "p50_ns");
+            if (field(&pairs[i], "p99_ns") > worst_p99)
+                worst_p99 = field(&pairs[i], "p99_ns");
+        } else {
+            printf("  CPUs %d,%d: %.2f MB/second\n", pairs[i].child_cpu, pairs[i].parent_cpu,
+                   field(&pairs[i], "mb_per_s"));
+            total += field(&pairs[i], "mb_per_s");
+        }
+    }
+    if (latency)
+        printf("  Worst pair: p50 %.0f ns, p99 %.0f ns\n", worst_p50, worst_p99);
+    else
+        printf("  Total: %.2f MB/second\n", total);
+}
+
+// one pair at a time on every (child, parent) combination of CPUs
+static void
+matrix(const char *program, int latency, int machine, const char *num_blocks, const char *block_size)
+{
+    if (!machine) {
+        print_topology();
+        printf("%s, %s-byte blocks, %s; rows: child (writer) CPU, columns: parent (reader) CPU\n\n",
+               program, block_size, latency ? "median round trip in ns" : "MB/second");
+        printf("%8s", "");
+        for (int j = 0; j < num_cpus; j++)
+            printf(" %9d", topo[j].cpu);
+        printf("\n");
+    }
+
+    for (int i = 0; i < num_cpus; i++) {
+        if (!machine)
+            printf("%8d", topo[i].cpu);
+        for (int j = 0; j < num_cpus; j++) {
+            struct pair pr = { .child_cpu = topo[i].cpu, .parent_cpu = topo[j].cpu };
+
+            run_pairs(&pr, 1, program, latency, num_blocks, block_size);
+            if (machine)
+                printf("%s\n", pr.result);
+            else
+                printf(" %9.0f", field(&pr, latency ? "p50_ns" : "mb_per_s"));
+            fflush(stdout);
+        }
+        if (!machine)
+            printf("\n");
+    }
+}
+
+static void
+usage_error(const char *prog_name)
+{
+    fprintf(stderr, "Usage: %s [-l] [-m] [-k pairs] [-p placement] program num-blocks block-size\n", prog_name);
+    fprintf(stderr, "       %s [-l] [-m] -M program num-blocks block-size\n", prog_name);
+    fprintf(stderr, "  -l: measure round-trip latency instead of bandwidth\n");
+    fprintf(stderr, "  -m: print the program's JSON lines\n");
+    fprintf(stderr, "  -k pairs: number of pairs to run at once (default 1)\n");
+    fprintf(stderr, "  -p placement: same, smt, core, socket, any, or c,p[:c,p...] (default any)\n");
+    fprintf(stderr, "  -M: core-to-core matrix, one pair at a time on every combination of CPUs\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int latency = 0, machine = 0, do_matrix = 0, num_pairs = 1, opt;
+    const char *placement = NULL;
+
+    while ((opt = getopt(argc, argv, "lmk:p:M")) != -1) {
+        switch (opt) {
+        case 'l': latency = 1; break;
+        case 'm': machine = 1; break;
+        case 'k': num_pairs = getInt(optarg, GN_GT_0, "pairs"); break;
+        case 'p': placement = optarg; break;
+        case 'M': do_matrix = 1; break;
+        default: usage_error(argv[0]);
+        }
+    }
+    if (argc - optind != 3 || num_pairs > MAX_PAIRS)
+        usage_error(argv[0]);
+
+    read_topology();
+    if (placement == NULL)
+        placement = num_cpus > 1 ? "any" : "same";
+
+    if (do_matrix)
+        matrix(argv[optind], latency, machine, argv[optind + 1], argv[optind + 2]);
+    else
+        scale(placement, num_pairs, argv[optind], latency, machine, argv[optind + 1], argv[optind + 2]);
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,78 @@
+#include <string.h>
+
+#include "latency_hist.h"
+
+void
+hist_init(struct latency_hist *h)
+{
+    memset(h, 0, sizeof(*h));
+    h->min = -1;
+}
+
+// values below 64 get a bucket each; above, a value whose top bit is bit 'msb' falls in one of the 32 buckets
+// of [2^msb, 2^(msb+1)), chosen by its 5 bits below the top one
+static int
+hist_index(long long ns)
+{
+    if (ns < (2 << HIST_SUB_BITS))
+        return ns;
+    int shift = (63 - __builtin_clzll(ns)) - HIST_SUB_BITS;
+    return (shift + 1) * (1 << HIST_SUB_BITS) + (int) ((ns >> shift) - (1 << HIST_SUB_BITS));
+}
+
+// largest value that falls in bucket 'idx'
+static long long
+hist_upper(int idx)
+{
+    if (idx < (2 << HIST_SUB_BITS))
+        return idx;
+    int shift = idx / (1 << HIST_SUB_BITS) - 1;
+    long long low = (long long) ((1 << HIST_SUB_BITS) + idx % (1 << HIST_SUB_BITS)) << shift;
+    return low + (1LL << shift) - 1;
+}
+
+void
+hist_record(struct latency_hist *h, long long ns)
+{
+    int idx = hist_index(ns);
+
+    if (idx >= HIST_BUCKETS)
+        idx = HIST_BUCKETS - 1;
+    h->buckets[idx]++;
+    h->count++;
+    h->sum += ns;
+    if (h->min == -1 || ns < h->min)
+        h->min = ns;
+    if (ns > h->max)
+        h->max = ns;
+}
+
+long long
+hist_percentile(const struct latency_hist *h, double q)
+{
+    long long rank = (long long) (q * h->count + 0.999999), seen = 0;
+
+    if (rank < 1)
+        rank = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank)
+            return hist_upper(i) < h->max ? hist_upper(i) : h->max;
+    }
+    return h->max;
+}
+
+void
+hist_merge(struct latency_hist *dst, const struct latency_hist *src)
+{
+    if (src->count == 0)
+        return;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        dst->buckets[i] += src->buckets[i];
+    if (dst->min == -1 || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+}
@@ -0,0 +1,23 @@
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+// histogram of latencies in nanoseconds: exact up to 64ns, then 32 buckets per power of 2 (within ~3%).
+// also used by ../chapter_53/sem_contention_bench.c
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS (64 << HIST_SUB_BITS)
+
+struct latency_hist {
+    long long count, sum, min, max;
+    long long buckets[HIST_BUCKETS];
+};
+
+void hist_init(struct latency_hist *h);
+void hist_record(struct latency_hist *h, long long ns);
+
+// add the values recorded in 'src' to 'dst'
+void hist_merge(struct latency_hist *dst, const struct latency_hist *src);
+
+// smallest value that at least fraction 'q' of the recorded values are at or below (bucket upper bound)
+long long hist_percentile(const struct latency_hist *h, double q);
+
+#endif /* LATENCY_HIST_H */
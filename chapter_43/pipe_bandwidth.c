@@ -10,6 +10,70 @@
 #define WRITE_END   1
 #define READ_END    0
 
+// -l: round trips of block-size bytes, to the child over one pipe and back over another
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    int to_child[2], to_parent[2];
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct latency_hist hist;
+    char *buffer;
+
+    buffer = malloc(opts->block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', opts->block_size);
+
+    if (pipe(to_child) == -1 || pipe(to_parent) == -1)
+        errExit("pipe");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - echoes every message back
+        set_cpu_affinity(opts->child_cpu);  // pin child to core 0 (or as -c says)
+
+        if (close(to_child[WRITE_END]) == -1 || close(to_parent[READ_END]) == -1)
+            errExit("close - child");
+
+        for (long i = 0; i < total; i++) {
+            if (read_fully(to_child[READ_END], buffer, opts->block_size) != opts->block_size)
+                errExit("read");
+            if (write(to_parent[WRITE_END], buffer, opts->block_size) != opts->block_size)
+                errExit("write");
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu);  // pin parent to core 1 (or as -c says)
+
+        if (close(to_child[READ_END]) == -1 || close(to_parent[WRITE_END]) == -1)
+            errExit("close - parent");
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            if (write(to_child[WRITE_END], buffer, opts->block_size) != opts->block_size)
+                errExit("write");
+            if (read_fully(to_parent[READ_END], buffer, opts->block_size) != opts->block_size)
+                errExit("read");
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        report_latency("pipe", opts, &hist);
+    }
+
+    free(buffer);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -18,15 +82,19 @@ main(int argc, char *argv[])
     long block_num, block_size;
     char *buffer;
     long long start_time, end_time, elapsed_ns;
-    double elapsed_sec, total_bytes, bandwidth;
+    double elapsed_sec;
     int status;
     char sync_byte;
+    struct bench_opts opts;
 
-    if (argc != 3)
-        show_usage(argv[0]);
+    parse_bench_args(argc, argv, &opts, 0);
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
 
-    block_num = getInt(argv[1], GN_GT_0, "num-blocks");
-    block_size = getInt(argv[2], GN_GT_0, "block-size");
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
 
     buffer = malloc(block_size);
     if (buffer == NULL)
@@ -41,7 +109,7 @@ main(int argc, char *argv[])
         errExit("fork");
 
     case 0: // child - writer
-        set_cpu_affinity(0);  // pin child to core 0
+        set_cpu_affinity(opts.child_cpu);  // pin child to core 0 (or as -c says)
         
         if (close(pipefd[READ_END]) == -1) // close read end of pipe
             errExit("close - child");
@@ -71,7 +139,7 @@ main(int argc, char *argv[])
         _exit(EXIT_SUCCESS);
 
     default: // parent - reader
-        set_cpu_affinity(1);  // pin parent to core 1
+        set_cpu_affinity(opts.parent_cpu);  // pin parent to core 1 (or as -c says)
         
         if (close(pipefd[WRITE_END]) == -1) // close write end of pipe
             errExit("close - parent");
@@ -127,13 +195,8 @@ main(int argc, char *argv[])
 
         elapsed_ns = end_time - start_time;
         elapsed_sec = elapsed_ns / 1000000000.0;
-        total_bytes = (double)(blocks_read * block_size);
-        bandwidth = total_bytes / elapsed_sec;
 
-        printf("  Blocks read: %ld\n", blocks_read);
-        printf("  Bytes transferred: %.0f\n", total_bytes);
-        printf("  Elapsed time: %.6f seconds\n", elapsed_sec);
-        printf("  Bandwidth: %.2f MB/second\n", bandwidth / (1024.0 * 1024.0));
+        report_bandwidth("pipe", &opts, blocks_read, elapsed_sec);
 
         break;
     }
@@ -3,10 +3,90 @@
 #include <mqueue.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <limits.h>
 
 #include "tlpi_hdr.h"
 #include "helper.h"
 
+// -l: round trips of block-size bytes: to the child on one queue, and back on another
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct latency_hist hist;
+    struct mq_attr attr;
+    mqd_t ping, pong;
+    char *buffer;
+    char ping_name[NAME_MAX], pong_name[NAME_MAX];
+
+    // names with our PID, as several instances may run at once (see ipc_scale.c)
+    snprintf(ping_name, sizeof(ping_name), "/latency_test_ping.%ld", (long) getpid());
+    snprintf(pong_name, sizeof(pong_name), "/latency_test_pong.%ld", (long) getpid());
+
+    buffer = malloc(opts->block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', opts->block_size);
+
+    mq_unlink(ping_name);
+    mq_unlink(pong_name);
+
+    attr.mq_flags = 0;
+    attr.mq_maxmsg = 10;
+    attr.mq_msgsize = opts->block_size;
+    attr.mq_curmsgs = 0;
+
+    ping = mq_open(ping_name, O_CREAT | O_RDWR, 0666, &attr);
+    pong = mq_open(pong_name, O_CREAT | O_RDWR, 0666, &attr);
+    if (ping == (mqd_t) -1 || pong == (mqd_t) -1)
+        errExit("mq_open create");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: /* Child - echoes every message back */
+        set_cpu_affinity(opts->child_cpu); // pin child to core 0 (or as -c says)
+
+        for (long i = 0; i < total; i++) {
+            if (mq_receive(ping, buffer, opts->block_size, NULL) != opts->block_size)
+                errExit("mq_receive");
+            if (mq_send(pong, buffer, opts->block_size, 0) == -1)
+                errExit("mq_send");
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: /* Parent - sends each message and times its return */
+        set_cpu_affinity(opts->parent_cpu); // pin parent to core 1 (or as -c says)
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            if (mq_send(ping, buffer, opts->block_size, 0) == -1)
+                errExit("mq_send");
+            if (mq_receive(pong, buffer, opts->block_size, NULL) != opts->block_size)
+                errExit("mq_receive");
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        if (mq_close(ping) == -1 || mq_close(pong) == -1)
+            errExit("mq_close");
+        if (mq_unlink(ping_name) == -1 || mq_unlink(pong_name) == -1)
+            errExit("mq_unlink");
+
+        report_latency("posix_msgq", opts, &hist);
+    }
+
+    free(buffer);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -14,19 +94,18 @@ main(int argc, char *argv[])
     char *buffer;
     char *sync_msg;
     char *sync_recv_buf;
-    double elapsed_sec, total_bytes, bandwidth;
+    double elapsed_sec;
     long long start_time, end_time, elapsed_ns;
     int status;
     unsigned int prio = 0;
     mqd_t mq;
     struct mq_attr attr;
-    const char *mq_name = "/bandwidth_test_mq";
+    char mq_name[NAME_MAX];
+    struct bench_opts opts;
 
-    if (argc != 3)
-        show_usage(argv[0]);
-
-    block_num = getLong(argv[1], GN_GT_0, "num-blocks");
-    block_size = getLong(argv[2], GN_GT_0, "block-size");
+    parse_bench_args(argc, argv, &opts, 0);
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
 
     /* Skip test if block size exceeds 8192 bytes (POSIX mq limit) */
     if (block_size > 8192) {
@@ -34,6 +113,11 @@ main(int argc, char *argv[])
         exit(EXIT_SUCCESS);
     }
 
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
+
     /* Allocate buffers */
     buffer = malloc(block_size);
     sync_msg = malloc(block_size);
@@ -45,6 +129,9 @@ main(int argc, char *argv[])
     memset(buffer, 'A', block_size);
     memset(sync_msg, 'S', block_size);  /* Sync message with same size */
 
+    /* A name with our PID, as several instances may run at once (see ipc_scale.c) */
+    snprintf(mq_name, sizeof(mq_name), "/bandwidth_test_mq.%ld", (long) getpid());
+
     /* Remove any existing message queue */
     mq_unlink(mq_name);
 
@@ -64,7 +151,7 @@ main(int argc, char *argv[])
         errExit("fork");
 
     case 0: /* Child - writer */
-        set_cpu_affinity(0); // pin child to core 0
+        set_cpu_affinity(opts.child_cpu); // pin child to core 0 (or as -c says)
         
         // reopen queue for writing only
         if (mq_close(mq) == -1)
@@ -91,7 +178,7 @@ main(int argc, char *argv[])
         exit(EXIT_SUCCESS);
 
     default: /* Parent - reader */
-        set_cpu_affinity(1); // pin parent to core 1
+        set_cpu_affinity(opts.parent_cpu); // pin parent to core 1 (or as -c says)
         
         // message queue already open from before fork, wait for sync message
         if (mq_receive(mq, sync_recv_buf, block_size, &prio) == -1)
@@ -127,13 +214,8 @@ main(int argc, char *argv[])
 
         elapsed_ns = end_time - start_time;
         elapsed_sec = elapsed_ns / 1000000000.0;
-        total_bytes = (double)(blocks_read * block_size);
-        bandwidth = total_bytes / elapsed_sec;
 
-        printf("  Blocks read: %ld\n", blocks_read);
-        printf("  Bytes transferred: %.0f\n", total_bytes);
-        printf("  Elapsed time: %.6f seconds\n", elapsed_sec);
-        printf("  Bandwidth: %.2f MB/second\n", bandwidth / (1024.0 * 1024.0));
+        report_bandwidth("posix_msgq", &opts, blocks_read, elapsed_sec);
 
         break;
     }
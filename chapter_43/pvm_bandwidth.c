@@ -0,0 +1,203 @@
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/uio.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include "tlpi_hdr.h"
+#include "helper.h"
+#include "ring_ctl.h"
+
+#define RING_BYTES  (64 * 1024)     // the default capacity of a pipe, for a fair comparison
+#define WRITE_END   1
+#define READ_END    0
+
+// the data goes straight from one process's private memory to the other's with process_vm_writev() and
+// process_vm_readv(): a single copy, made by the kernel, with no memory shared but a small ring_ctl.
+// the ring slots are malloc()ed before fork(), so they are at the same address in both processes.
+
+// copy 'len' bytes from our 'local' to 'remote' in process 'pid'
+static void
+pvm_write(pid_t pid, void *local, void *remote, size_t len)
+{
+    struct iovec liov = { local, len }, riov = { remote, len };
+
+    if (process_vm_writev(pid, &liov, 1, &riov, 1, 0) != (ssize_t) len)
+        errExit("process_vm_writev");
+}
+
+// copy 'len' bytes from 'remote' in process 'pid' to our 'local'
+static void
+pvm_read(pid_t pid, void *local, void *remote, size_t len)
+{
+    struct iovec liov = { local, len }, riov = { remote, len };
+
+    if (process_vm_readv(pid, &liov, 1, &riov, 1, 0) != (ssize_t) len)
+        errExit("process_vm_readv");
+}
+
+// -l: round trips of block-size bytes: the parent writes each message into the child's slot, and once the
+// child has seen it, reads it back from there. the parent makes all the copies, the child only signals.
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct ring_ctl *ping, *pong;
+    struct latency_hist hist;
+    char *buffer, *child_slot;
+    pid_t child_pid;
+
+    buffer = malloc(opts->block_size);
+    child_slot = malloc(opts->block_size);
+    if (buffer == NULL || child_slot == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', opts->block_size);
+
+    ping = ring_ctl_create(1);
+    pong = ring_ctl_create(1);
+
+    switch (child_pid = fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - hands every message back
+        set_cpu_affinity(opts->child_cpu); // pin child to core 0 (or as -c says)
+
+        for (long i = 0; i < total; i++) {
+            ring_wait_data(ping);
+            ring_release(ping);     // the parent sends nothing more before it has read the reply
+            ring_wait_space(pong);
+            ring_publish(pong);
+        }
+        ring_wait_space(pong);      // stay until the parent has read the last reply from our memory
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu); // pin parent to core 1 (or as -c says)
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            ring_wait_space(ping);
+            pvm_write(child_pid, buffer, child_slot, opts->block_size);
+            ring_publish(ping);
+
+            ring_wait_data(pong);
+            pvm_read(child_pid, buffer, child_slot, opts->block_size);
+            ring_release(pong);
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        report_latency("process_vm", opts, &hist);
+    }
+
+    free(buffer);
+    free(child_slot);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int syncfd[2];
+    pid_t child_pid, parent_pid;
+    long block_num, block_size, nslots;
+    char *buffer, *slots;
+    struct ring_ctl *ring;
+    long long start_time, end_time, elapsed_ns;
+    double elapsed_sec;
+    char sync_byte;
+    struct bench_opts opts;
+
+    parse_bench_args(argc, argv, &opts, 0);
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
+
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
+
+    buffer = malloc(block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', block_size);
+
+    // as many slots as fit in RING_BYTES, but at least 2 so that both sides can work at once
+    nslots = RING_BYTES / block_size > 2 ? RING_BYTES / block_size : 2;
+    ring = ring_ctl_create(nslots);
+    slots = malloc(nslots * block_size);    // only the parent's copy is used
+    if (slots == NULL)
+        errExit("malloc");
+
+    if (pipe(syncfd) == -1)
+        errExit("pipe");
+
+    parent_pid = getpid();
+
+    switch (child_pid = fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - writer, straight into the parent's slots
+        set_cpu_affinity(opts.child_cpu);  // pin child to core 0 (or as -c says)
+
+        // wait until the parent has allowed us to write into its memory
+        if (read(syncfd[READ_END], &sync_byte, 1) != 1)
+            errExit("sync read");
+
+        for (long i = 0; i < block_num; i++) {
+            long idx = ring_wait_space(ring);
+            pvm_write(parent_pid, buffer, slots + idx * block_size, block_size);
+            ring_publish(ring);
+        }
+
+        free(buffer);
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - reader
+        set_cpu_affinity(opts.parent_cpu);  // pin parent to core 1 (or as -c says)
+
+        // with Yama's ptrace_scope 1, only ancestors may access a process's memory unless it says otherwise
+        if (prctl(PR_SET_PTRACER, child_pid, 0, 0, 0) == -1 && errno != EINVAL)
+            errExit("prctl");
+
+        sync_byte = 1;
+        if (write(syncfd[WRITE_END], &sync_byte, 1) != 1)
+            errExit("sync write");
+
+        start_time = get_current_time_ns();
+
+        // copy every block out of the ring into our own buffer
+        long blocks_read = 0;
+        while (blocks_read < block_num) {
+            long idx = ring_wait_data(ring);
+            memcpy(buffer, slots + idx * block_size, block_size);
+            ring_release(ring);
+            blocks_read++;
+        }
+
+        end_time = get_current_time_ns();
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        elapsed_ns = end_time - start_time;
+        elapsed_sec = elapsed_ns / 1000000000.0;
+
+        report_bandwidth("process_vm", &opts, blocks_read, elapsed_sec);
+
+        break;
+    }
+
+    free(buffer);
+    free(slots);
+    exit(EXIT_SUCCESS);
+}
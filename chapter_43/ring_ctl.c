@@ -0,0 +1,104 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+
+#include "tlpi_hdr.h"
+#include "ring_ctl.h"
+
+struct ring_ctl *
+ring_ctl_create(long nslots)
+{
+    struct ring_ctl *ctl;
+
+    ctl = mmap(NULL, sizeof(*ctl), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ctl == MAP_FAILED)
+        errExit("mmap ring_ctl");
+
+    memset(ctl, 0, sizeof(*ctl));
+    ctl->nslots = nslots;
+    ctl->data_efd = eventfd(0, 0);
+    ctl->space_efd = eventfd(0, 0);
+    if (ctl->data_efd == -1 || ctl->space_efd == -1)
+        errExit("eventfd");
+
+    return ctl;
+}
+
+// sleep until the other side has posted a wake-up; several posts may come back as one
+static void
+efd_wait(int efd)
+{
+    uint64_t count;
+
+    if (read(efd, &count, sizeof(count)) != sizeof(count))
+        errExit("read eventfd");
+}
+
+static void
+efd_post(int efd)
+{
+    uint64_t one = 1;
+
+    if (write(efd, &one, sizeof(one)) != sizeof(one))
+        errExit("write eventfd");
+}
+
+// wait until ready() holds. the flag is raised before checking one last time, so a post made after that
+// check can't be missed; a post that turns out to be unneeded only makes a later sleep return early, and
+// the loop checks again
+static void
+wait_for(struct ring_ctl *ctl, int *waiting, int efd, int (*ready)(struct ring_ctl *))
+{
+    while (!ready(ctl)) {
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (ready(ctl)) {
+            __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+            break;
+        }
+        efd_wait(efd);
+    }
+}
+
+static int
+has_space(struct ring_ctl *ctl)
+{
+    return ctl->head - __atomic_load_n(&ctl->tail, __ATOMIC_SEQ_CST) < (unsigned long) ctl->nslots;
+}
+
+static int
+has_data(struct ring_ctl *ctl)
+{
+    return __atomic_load_n(&ctl->head, __ATOMIC_SEQ_CST) != ctl->tail;
+}
+
+long
+ring_wait_space(struct ring_ctl *ctl)
+{
+    wait_for(ctl, &ctl->producer_waiting, ctl->space_efd, has_space);
+    return ctl->head % ctl->nslots;
+}
+
+void
+ring_publish(struct ring_ctl *ctl)
+{
+    __atomic_store_n(&ctl->head, ctl->head + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ctl->consumer_waiting, 0, __ATOMIC_SEQ_CST))
+        efd_post(ctl->data_efd);
+}
+
+long
+ring_wait_data(struct ring_ctl *ctl)
+{
+    wait_for(ctl, &ctl->consumer_waiting, ctl->data_efd, has_data);
+    return ctl->tail % ctl->nslots;
+}
+
+void
+ring_release(struct ring_ctl *ctl)
+{
+    __atomic_store_n(&ctl->tail, ctl->tail + 1, __ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n(&ctl->producer_waiting, 0, __ATOMIC_SEQ_CST))
+        efd_post(ctl->space_efd);
+}
@@ -0,0 +1,31 @@
+#ifndef RING_CTL_H
+#define RING_CTL_H
+
+// control block of a single-producer single-consumer ring of slots, for the transports that don't move the
+// data through the kernel themselves (eventfd_shm_bandwidth.c, pvm_bandwidth.c).
+// the control block lives in a shared anonymous mapping, so it must be created before fork(); where the
+// slots live is up to the program. head and tail only ever grow; slot i is at index i % nslots.
+// a side that has to wait says so in a flag and sleeps in read() on an eventfd, and the other side makes the
+// write() to wake it only when the flag is set, so while both keep busy there are no system calls at all.
+struct ring_ctl {
+    unsigned long head;         // slots published by the producer
+    unsigned long tail;         // slots released by the consumer
+    int consumer_waiting;
+    int producer_waiting;
+    int data_efd;               // producer -> consumer wake-ups
+    int space_efd;              // consumer -> producer wake-ups
+    long nslots;
+};
+
+// map and initialize a control block for a ring of 'nslots' slots
+struct ring_ctl *ring_ctl_create(long nslots);
+
+// producer: wait for a free slot and return its index; then publish it once filled
+long ring_wait_space(struct ring_ctl *ctl);
+void ring_publish(struct ring_ctl *ctl);
+
+// consumer: wait for a published slot and return its index; then release it once done with it
+long ring_wait_data(struct ring_ctl *ctl);
+void ring_release(struct ring_ctl *ctl);
+
+#endif /* RING_CTL_H */
@@ -0,0 +1,182 @@
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "tlpi_hdr.h"
+#include "helper.h"
+
+// -l: round trips of block-size bytes over the socket pair, the child sending each message straight back
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    int sockfd[2];
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct latency_hist hist;
+    char *buffer;
+
+    buffer = malloc(opts->block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', opts->block_size);
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockfd) == -1)
+        errExit("socketpair");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - echoes every message back
+        set_cpu_affinity(opts->child_cpu); // pin child to core 0 (or as -c says)
+
+        if (close(sockfd[0]) == -1)
+            errExit("close child");
+
+        for (long i = 0; i < total; i++) {
+            if (recv(sockfd[1], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("recv");
+            if (send(sockfd[1], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("send");
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu); // pin parent to core 1 (or as -c says)
+
+        if (close(sockfd[1]) == -1)
+            errExit("close parent");
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            if (send(sockfd[0], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("send");
+            if (recv(sockfd[0], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("recv");
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        report_latency("seqpacket", opts, &hist);
+    }
+
+    free(buffer);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int sockfd[2];
+    pid_t child_pid;
+    int block_num, block_size;
+    char *buffer;
+    long long start_time, end_time, elapsed_ns;
+    double elapsed_sec;
+    int status;
+    char sync_byte;
+    struct bench_opts opts;
+
+    parse_bench_args(argc, argv, &opts, 0);
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
+
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
+
+    buffer = malloc(block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', block_size);
+
+    /* Create UNIX domain sequenced-packet socket pair (message boundaries like datagrams, but connected, with EOF) */
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sockfd) == -1)
+        errExit("socketpair");
+
+    switch (child_pid = fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - writer
+        set_cpu_affinity(opts.child_cpu);  // pin child to core 0 (or as -c says)
+        
+        if (close(sockfd[0]) == -1)  // close read end
+            errExit("close child read");
+
+        /* Send sync byte */
+        sync_byte = 1;
+        if (send(sockfd[1], &sync_byte, 1, 0) != 1)
+            errExit("send sync");
+
+        /* Send data blocks as fast as possible */
+        for (long i = 0; i < block_num; i++) {
+            if (send(sockfd[1], buffer, block_size, 0) != block_size)
+                errExit("send");
+        }
+
+        if (close(sockfd[1]) == -1)  // close write end
+            errExit("close child write");
+
+        free(buffer);
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - reader
+        set_cpu_affinity(opts.parent_cpu);  // pin parent to core 1 (or as -c says)
+        
+        if (close(sockfd[1]) == -1)  // close write end
+            errExit("close parent write");
+
+        /* Wait for sync byte */
+        if (recv(sockfd[0], &sync_byte, 1, 0) != 1)
+            errExit("recv sync");
+
+        /* Start timing after sync */
+        start_time = get_current_time_ns();
+
+        /* Read all data blocks */
+        int blocks_read = 0;
+        while (blocks_read < block_num) {
+            ssize_t bytes_received = recv(sockfd[0], buffer, block_size, 0);
+            
+            if (bytes_received == -1)
+                errExit("recv");
+            
+            if (bytes_received == 0)
+                break;  // connection closed
+            
+            if (bytes_received != block_size)
+                errExit("incomplete packet received");
+                
+            blocks_read++;
+        }
+
+        end_time = get_current_time_ns();
+
+        if (close(sockfd[0]) == -1)  // close read end
+            errExit("close parent read");
+
+        /* Wait for child to complete */
+        if (wait(&status) == -1)
+            errExit("wait");
+
+        elapsed_ns = end_time - start_time;
+        elapsed_sec = elapsed_ns / 1000000000.0;
+
+        report_bandwidth("seqpacket", &opts, blocks_read, elapsed_sec);
+
+        break;
+    }
+
+    free(buffer);
+    exit(EXIT_SUCCESS);
+}
@@ -13,6 +13,73 @@ struct msg_buf {
     char data[1];  // will be allocated dynamically
 };
 
+#define PING_TYPE 1  /* parent to child */
+#define PONG_TYPE 2  /* child to parent */
+
+// -l: round trips of block-size bytes on one queue, each direction with its own message type
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct latency_hist hist;
+    struct msg_buf *msg;
+    int msgq_id;
+
+    msg = malloc(sizeof(long) + opts->block_size);
+    if (msg == NULL)
+        errExit("malloc");
+    memset(msg->data, 'A', opts->block_size);
+
+    msgq_id = msgget(IPC_PRIVATE, IPC_CREAT | 0600);   // private: several of us may run at once
+    if (msgq_id == -1)
+        errExit("msgget");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - echoes every message back
+        set_cpu_affinity(opts->child_cpu); // pin child to core 0 (or as -c says)
+
+        for (long i = 0; i < total; i++) {
+            if (msgrcv(msgq_id, msg, opts->block_size, PING_TYPE, 0) != opts->block_size)
+                errExit("msgrcv");
+            msg->msg_type = PONG_TYPE;
+            if (msgsnd(msgq_id, msg, opts->block_size, 0) == -1)
+                errExit("msgsnd");
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu); // pin parent to core 1 (or as -c says)
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            msg->msg_type = PING_TYPE;
+            if (msgsnd(msgq_id, msg, opts->block_size, 0) == -1)
+                errExit("msgsnd");
+            if (msgrcv(msgq_id, msg, opts->block_size, PONG_TYPE, 0) != opts->block_size)
+                errExit("msgrcv");
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        if (msgctl(msgq_id, IPC_RMID, NULL) == -1)
+            errExit("msgctl");
+
+        report_latency("sysv_msgq", opts, &hist);
+    }
+
+    free(msg);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -21,17 +88,15 @@ main(int argc, char *argv[])
     long block_num, block_size;
     struct msg_buf *msg_buffer;
     long long start_time, end_time, elapsed_ns;
-    double elapsed_sec, total_bytes, bandwidth;
+    double elapsed_sec;
     int status;
-    key_t key;
     size_t msg_buf_size;
     struct msg_buf sync_msg;
+    struct bench_opts opts;
 
-    if (argc != 3)
-        show_usage(argv[0]);
-
-    block_num = getLong(argv[1], GN_GT_0, "num-blocks");
-    block_size = getLong(argv[2], GN_GT_0, "block-size");
+    parse_bench_args(argc, argv, &opts, 0);
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
 
     /* Skip test if block size exceeds 8192 bytes (POSIX mq limit) */
     if (block_size > 8192) {
@@ -39,6 +104,11 @@ main(int argc, char *argv[])
         exit(EXIT_SUCCESS);
     }
 
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
+
     /* Calculate message buffer size */
     msg_buf_size = sizeof(long) + block_size;
     
@@ -49,12 +119,8 @@ main(int argc, char *argv[])
     msg_buffer->msg_type = 1;
     memset(msg_buffer->data, 'A', block_size);
 
-    /* Create unique key and message queue */
-    key = ftok("/tmp", 'M');
-    if (key == -1)
-        errExit("ftok");
-
-    msgq_id = msgget(key, IPC_CREAT | IPC_EXCL | 0600);
+    /* Create a private message queue, as several instances may run at once (see ipc_scale.c) */
+    msgq_id = msgget(IPC_PRIVATE, IPC_CREAT | 0600);
     if (msgq_id == -1)
         errExit("msgget");
 
@@ -63,7 +129,7 @@ main(int argc, char *argv[])
         errExit("fork");
 
     case 0: // child - writer
-        set_cpu_affinity(0); // pin child to core 0
+        set_cpu_affinity(opts.child_cpu); // pin child to core 0 (or as -c says)
 
         sync_msg.msg_type = 999; // sync message type
         sync_msg.data[0] = 1;
@@ -81,7 +147,7 @@ main(int argc, char *argv[])
         _exit(EXIT_SUCCESS);
 
     default: // parent - reader
-        set_cpu_affinity(1); // pin parent to core 1
+        set_cpu_affinity(opts.parent_cpu); // pin parent to core 1 (or as -c says)
 
         // wait for sync message
         if (msgrcv(msgq_id, &sync_msg, 1, 999, 0) == -1)
@@ -114,13 +180,8 @@ main(int argc, char *argv[])
 
         elapsed_ns = end_time - start_time;
         elapsed_sec = elapsed_ns / 1000000000.0;
-        total_bytes = (double)(blocks_read * block_size);
-        bandwidth = total_bytes / elapsed_sec;
 
-        printf("  Blocks read: %ld\n", blocks_read);
-        printf("  Bytes transferred: %.0f\n", total_bytes);
-        printf("  Elapsed time: %.6f seconds\n", elapsed_sec);
-        printf("  Bandwidth: %.2f MB/second\n", bandwidth / (1024.0 * 1024.0));
+        report_bandwidth("sysv_msgq", &opts, blocks_read, elapsed_sec);
 
         break;
     }
@@ -0,0 +1,17 @@
+#!/bin/sh
+
+# Ping-pong latency of every IPC program, one JSON line per program and block size.
+# Usage: sh ./test_latency.sh [round-trips]
+
+ROUND_TRIPS=${1:-100000}
+
+PROGRAMS="pipe_bandwidth posix_msgq_bandwidth sysv_msgq_bandwidth uds_bandwidth unix_stream_bandwidth \
+          seqpacket_bandwidth vmsplice_bandwidth eventfd_shm_bandwidth pvm_bandwidth"
+BLOCK_SIZES="64 1024 4096 8192 65536"
+
+for prog in $PROGRAMS; do
+    for size in $BLOCK_SIZES; do
+        # the message queues skip (and say so) above 8192 bytes
+        ./$prog -l -m $ROUND_TRIPS $size | grep '^{'
+    done
+done
@@ -8,6 +8,155 @@
 #include "tlpi_hdr.h"
 #include "helper.h"
 
+// ask for 'size' bytes of socket buffer 'opt' (SO_SNDBUF or SO_RCVBUF) and return what the kernel set.
+// the plain options are capped by net.core.wmem_max and rmem_max; the FORCE variants aren't, but need
+// CAP_NET_ADMIN. the kernel doubles the size asked for, to leave room for its own bookkeeping.
+static int
+set_sock_buf(int fd, int opt, int force_opt, int size)
+{
+    socklen_t len = sizeof(size);
+
+    if (setsockopt(fd, SOL_SOCKET, force_opt, &size, sizeof(size)) == -1) {
+        if (errno != EPERM)
+            errExit("setsockopt force");
+        if (setsockopt(fd, SOL_SOCKET, opt, &size, sizeof(size)) == -1)
+            errExit("setsockopt");
+    }
+    if (getsockopt(fd, SOL_SOCKET, opt, &size, &len) == -1)
+        errExit("getsockopt");
+    return size;
+}
+
+// message headers for 'batch' datagrams of 'block_size' bytes, the i-th at buffer + i * stride
+static struct mmsghdr *
+alloc_msgs(char *buffer, long block_size, long stride, int batch)
+{
+    struct mmsghdr *msgs = calloc(batch, sizeof(struct mmsghdr));
+    struct iovec *iovs = calloc(batch, sizeof(struct iovec));
+
+    if (msgs == NULL || iovs == NULL)
+        errExit("calloc");
+    for (int i = 0; i < batch; i++) {
+        iovs[i].iov_base = buffer + i * stride;
+        iovs[i].iov_len = block_size;
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    return msgs;
+}
+
+// -b: send 'block_num' copies of the block, up to 'batch' of them per sendmmsg() call
+static void
+send_batched(int fd, char *buffer, long block_num, long block_size, int batch)
+{
+    struct mmsghdr *msgs = alloc_msgs(buffer, block_size, 0, batch);  // all point at the same block
+
+    for (long sent = 0; sent < block_num; ) {
+        int n = block_num - sent < batch ? block_num - sent : batch;
+
+        n = sendmmsg(fd, msgs, n, 0);   // may send fewer than asked, e.g. when interrupted
+        if (n == -1)
+            errExit("sendmmsg");
+        sent += n;
+    }
+
+    free(msgs[0].msg_hdr.msg_iov);
+    free(msgs);
+}
+
+// -b: receive up to 'block_num' blocks, up to 'batch' of them per recvmmsg() call, each into its own part of
+// 'buffer' (room for 'batch' blocks). MSG_WAITFORONE returns what is there once the first one has arrived,
+// rather than waiting for a whole batch. returns the number of blocks received
+static long
+recv_batched(int fd, char *buffer, long block_num, long block_size, int batch)
+{
+    struct mmsghdr *msgs = alloc_msgs(buffer, block_size, block_size, batch);
+    long blocks_read = 0;
+
+    while (blocks_read < block_num) {
+        int n = block_num - blocks_read < batch ? block_num - blocks_read : batch;
+
+        n = recvmmsg(fd, msgs, n, MSG_WAITFORONE, NULL);
+        if (n == -1)
+            errExit("recvmmsg");
+        if (n == 0)
+            break;
+
+        for (int i = 0; i < n; i++)
+            if (msgs[i].msg_len != block_size)
+                errExit("incomplete datagram received");
+        blocks_read += n;
+    }
+
+    free(msgs[0].msg_hdr.msg_iov);
+    free(msgs);
+    return blocks_read;
+}
+
+// -l: round trips of block-size bytes over the socket pair, the child sending each message straight back
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    int sockfd[2];
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct latency_hist hist;
+    char *buffer;
+
+    buffer = malloc(opts->block_size);
+    if (buffer == NULL)
+        errExit("malloc");
+    memset(buffer, 'A', opts->block_size);
+
+    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sockfd) == -1)
+        errExit("socketpair");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - echoes every message back
+        set_cpu_affinity(opts->child_cpu); // pin child to core 0 (or as -c says)
+
+        if (close(sockfd[0]) == -1)
+            errExit("close child");
+
+        for (long i = 0; i < total; i++) {
+            if (recv(sockfd[1], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("recv");
+            if (send(sockfd[1], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("send");
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu); // pin parent to core 1 (or as -c says)
+
+        if (close(sockfd[1]) == -1)
+            errExit("close parent");
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            if (send(sockfd[0], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("send");
+            if (recv(sockfd[0], buffer, opts->block_size, 0) != opts->block_size)
+                errExit("recv");
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        report_latency("uds", opts, &hist);
+    }
+
+    free(buffer);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -16,31 +165,41 @@ main(int argc, char *argv[])
     int block_num, block_size;
     char *buffer;
     long long start_time, end_time, elapsed_ns;
-    double elapsed_sec, total_bytes, bandwidth;
+    double elapsed_sec;
     int status;
     char sync_byte;
+    struct bench_opts opts;
 
-    if (argc != 3)
-        show_usage(argv[0]);
+    parse_bench_args(argc, argv, &opts, BENCH_MMSG_OPTS);
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
 
-    block_num = getInt(argv[1], GN_GT_0, "num-blocks");
-    block_size = getInt(argv[2], GN_GT_0, "block-size");
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
 
-    buffer = malloc(block_size);
+    buffer = malloc(block_size * opts.batch);   // the reader receives a whole batch at once
     if (buffer == NULL)
         errExit("malloc");
-    memset(buffer, 'A', block_size);
+    memset(buffer, 'A', block_size * opts.batch);
 
     /* Create UNIX domain datagram socket pair */
     if (socketpair(AF_UNIX, SOCK_DGRAM, 0, sockfd) == -1)
         errExit("socketpair");
 
+    /* -s: the writer's send buffer limits how much is in flight, so that is the size reported */
+    if (opts.sock_buf > 0) {
+        set_sock_buf(sockfd[0], SO_RCVBUF, SO_RCVBUFFORCE, opts.sock_buf);
+        opts.sock_buf = set_sock_buf(sockfd[1], SO_SNDBUF, SO_SNDBUFFORCE, opts.sock_buf);
+    }
+
     switch (child_pid = fork()) {
     case -1:
         errExit("fork");
 
     case 0: // child - writer
-        set_cpu_affinity(0);  // pin child to core 0
+        set_cpu_affinity(opts.child_cpu);  // pin child to core 0 (or as -c says)
         
         if (close(sockfd[0]) == -1)  // close read end
             errExit("close child read");
@@ -51,9 +210,13 @@ main(int argc, char *argv[])
             errExit("send sync");
 
         /* Send data blocks as fast as possible */
-        for (long i = 0; i < block_num; i++) {
-            if (send(sockfd[1], buffer, block_size, 0) != block_size)
-                errExit("send");
+        if (opts.batch > 1) {
+            send_batched(sockfd[1], buffer, block_num, block_size, opts.batch);
+        } else {
+            for (long i = 0; i < block_num; i++) {
+                if (send(sockfd[1], buffer, block_size, 0) != block_size)
+                    errExit("send");
+            }
         }
 
         if (close(sockfd[1]) == -1)  // close write end
@@ -63,7 +226,7 @@ main(int argc, char *argv[])
         _exit(EXIT_SUCCESS);
 
     default: // parent - reader
-        set_cpu_affinity(1);  // pin parent to core 1
+        set_cpu_affinity(opts.parent_cpu);  // pin parent to core 1 (or as -c says)
         
         if (close(sockfd[1]) == -1)  // close write end
             errExit("close parent write");
@@ -76,7 +239,9 @@ main(int argc, char *argv[])
         start_time = get_current_time_ns();
 
         /* Read all data blocks */
-        int blocks_read = 0;
+        long blocks_read = 0;
+        if (opts.batch > 1)
+            blocks_read = recv_batched(sockfd[0], buffer, block_num, block_size, opts.batch);
         while (blocks_read < block_num) {
             ssize_t bytes_received = recv(sockfd[0], buffer, block_size, 0);
             
@@ -103,13 +268,8 @@ main(int argc, char *argv[])
 
         elapsed_ns = end_time - start_time;
         elapsed_sec = elapsed_ns / 1000000000.0;
-        total_bytes = (double)(blocks_read * block_size);
-        bandwidth = total_bytes / elapsed_sec;
 
-        printf("  Blocks read: %d\n", blocks_read);
-        printf("  Bytes transferred: %.0f\n", total_bytes);
-        printf("  Elapsed time: %.6f seconds\n", elapsed_sec);
-        printf("  Bandwidth: %.2f MB/second\n", bandwidth / (1024.0 * 1024.0));
+        report_bandwidth("uds", &opts, blocks_read, elapsed_sec);
 
         break;
     }
@@ -0,0 +1,212 @@
+#define _BSD_SOURCE
+#define _GNU_SOURCE
+
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+
+#include "tlpi_hdr.h"
+#include "helper.h"
+
+#define WRITE_END   1
+#define READ_END    0
+
+// like pipe_bandwidth.c, but the writer vmsplice()s its buffer into the pipe: the pipe takes references to
+// the buffer's pages instead of a copy of the data, so the only copy is the reader's read().
+// (splice() itself moves data between two file descriptors, so it would only save that copy too if the
+// reader passed the data on to a file or socket rather than using it.)
+// since the pipe refers to the writer's pages until they are read, the writer must not change the buffer
+// in the meantime - here it never does.
+
+// give all of 'len' bytes at 'buf' to the pipe; vmsplice() may take less at a time than a full pipe holds
+static void
+vmsplice_fully(int fd, char *buf, size_t len)
+{
+    struct iovec iov;
+
+    while (len > 0) {
+        iov.iov_base = buf;
+        iov.iov_len = len;
+
+        ssize_t n = vmsplice(fd, &iov, 1, 0);
+        if (n == -1)
+            errExit("vmsplice");
+        buf += n;
+        len -= n;
+    }
+}
+
+// page-aligned buffer filled with 'A's, so that vmsplice() can pass whole pages
+static char *
+alloc_buffer(long block_size)
+{
+    void *buffer;
+
+    errno = posix_memalign(&buffer, sysconf(_SC_PAGESIZE), block_size);
+    if (errno != 0)
+        errExit("posix_memalign");
+    memset(buffer, 'A', block_size);
+    return buffer;
+}
+
+// -l: round trips of block-size bytes, to the child over one pipe and back over another, both vmsplice()d
+static void
+measure_latency(const struct bench_opts *opts)
+{
+    int to_child[2], to_parent[2];
+    long warmup = latency_warmup(opts->num_blocks);
+    long total = warmup + opts->num_blocks;
+    struct latency_hist hist;
+    char *out, *in;
+
+    // separate buffers for sending and receiving, as the pipe may still refer to what was sent
+    out = alloc_buffer(opts->block_size);
+    in = alloc_buffer(opts->block_size);
+
+    if (pipe(to_child) == -1 || pipe(to_parent) == -1)
+        errExit("pipe");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - echoes every message back
+        set_cpu_affinity(opts->child_cpu);  // pin child to core 0 (or as -c says)
+
+        if (close(to_child[WRITE_END]) == -1 || close(to_parent[READ_END]) == -1)
+            errExit("close - child");
+
+        for (long i = 0; i < total; i++) {
+            if (read_fully(to_child[READ_END], in, opts->block_size) != opts->block_size)
+                errExit("read");
+            memcpy(out, in, opts->block_size);
+            vmsplice_fully(to_parent[WRITE_END], out, opts->block_size);
+        }
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - sends each message and times its return
+        set_cpu_affinity(opts->parent_cpu);  // pin parent to core 1 (or as -c says)
+
+        if (close(to_child[READ_END]) == -1 || close(to_parent[WRITE_END]) == -1)
+            errExit("close - parent");
+
+        hist_init(&hist);
+        for (long i = 0; i < total; i++) {
+            long long start = get_current_time_ns();
+
+            vmsplice_fully(to_child[WRITE_END], out, opts->block_size);
+            if (read_fully(to_parent[READ_END], in, opts->block_size) != opts->block_size)
+                errExit("read");
+
+            if (i >= warmup)
+                hist_record(&hist, get_current_time_ns() - start);
+        }
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        report_latency("vmsplice", opts, &hist);
+    }
+
+    free(out);
+    free(in);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int pipefd[2];
+    long block_num, block_size;
+    char *buffer;
+    long long start_time, end_time, elapsed_ns;
+    double elapsed_sec;
+    char sync_byte;
+    struct bench_opts opts;
+
+    parse_bench_args(argc, argv, &opts, 0);
+    if (opts.latency) {
+        measure_latency(&opts);
+        exit(EXIT_SUCCESS);
+    }
+
+    block_num = opts.num_blocks;
+    block_size = opts.block_size;
+
+    buffer = alloc_buffer(block_size);
+
+    if (pipe(pipefd) == -1)
+        errExit("pipe");
+
+    switch (fork()) {
+    case -1:
+        errExit("fork");
+
+    case 0: // child - writer
+        set_cpu_affinity(opts.child_cpu);  // pin child to core 0 (or as -c says)
+
+        if (close(pipefd[READ_END]) == -1) // close read end of pipe
+            errExit("close - child");
+
+        // sync with parent - send ready signal
+        sync_byte = 1;
+        if (write(pipefd[WRITE_END], &sync_byte, 1) != 1)
+            errExit("sync write");
+
+        // splice data blocks into the pipe as fast as possible
+        for (long i = 0; i < block_num; i++)
+            vmsplice_fully(pipefd[WRITE_END], buffer, block_size);
+
+        // close write end to signal EOF to parent
+        if (close(pipefd[WRITE_END]) == -1)
+            errExit("close - child write end");
+
+        free(buffer);
+        _exit(EXIT_SUCCESS);
+
+    default: // parent - reader
+        set_cpu_affinity(opts.parent_cpu);  // pin parent to core 1 (or as -c says)
+
+        if (close(pipefd[WRITE_END]) == -1) // close write end of pipe
+            errExit("close - parent");
+
+        // sync with child - wait for ready signal
+        if (read(pipefd[READ_END], &sync_byte, 1) != 1)
+            errExit("sync read");
+
+        // start timing after sync
+        start_time = get_current_time_ns();
+
+        // read all data blocks
+        long blocks_read = 0;
+        while (blocks_read < block_num) {
+            ssize_t bytes_read = read_fully(pipefd[READ_END], buffer, block_size);
+
+            if (bytes_read == -1)
+                errExit("read");
+            if (bytes_read == 0)
+                break;  // EOF (child has closed write end)
+            if (bytes_read != block_size)
+                errExit("incomplete block due to EOF");
+
+            blocks_read++;
+        }
+
+        end_time = get_current_time_ns();
+
+        if (close(pipefd[READ_END]) == -1)
+            errExit("close - parent read end");
+
+        if (wait(NULL) == -1)
+            errExit("wait");
+
+        elapsed_ns = end_time - start_time;
+        elapsed_sec = elapsed_ns / 1000000000.0;
+
+        report_bandwidth("vmsplice", &opts, blocks_read, elapsed_sec);
+
+        break;
+    }
+
+    free(buffer);
+    exit(EXIT_SUCCESS);
+}
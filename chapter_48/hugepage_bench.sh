@@ -0,0 +1,58 @@
+#!/usr/bin/env bash
+# Compare svshm_xfr_ring_writer/reader with the segment in normal pages,
+# pre-faulted (-P), in huge pages (-H), and both, for a few ring sizes.
+# Prints MB/s (best of 3, timed like ring_bench.sh) and the page faults each
+# side took setting up and while transferring (from the last run), and checks
+# the output.
+# -H needs huge pages reserved, e.g.: echo 64 > /proc/sys/vm/nr_hugepages
+IN=$1
+OUT=$2
+SLOT_SIZE=65536
+SLOTS="16 256 1024"
+MODES="none -P -H -H_-P"
+
+# cleanup - remove shared-memory and semaphore IPC instances
+ipcrm -M 0x1234 -S 0x5678 2>/dev/null || true
+
+MB=$(( $(stat -c %s "$IN") / 1048576 ))
+
+# "Page faults: S setting up, X while transferring" -> "S / X"
+faults() {
+    sed -n 's/^Page faults: \([0-9]*\) setting up, \([0-9]*\) while.*/\1 \/ \2/p' "$1"
+}
+
+# run writer with options $1 and reader with options $2, best of 3;
+# print MB/s and both sides' faults
+xfr() {
+    local start end best=0
+    for i in 1 2 3; do
+        ./svshm_xfr_ring_writer $1 < "$IN" 2> /tmp/hp_writer.log &
+        until ipcs -s | grep -q 0x00005678; do :; done    # writer is set up
+        start=$(date +%s.%N)
+        ./svshm_xfr_ring_reader $2 > "$OUT" 2> /tmp/hp_reader.log
+        end=$(date +%s.%N)
+        wait
+        ipcrm -M 0x1234 -S 0x5678 2>/dev/null || true
+        cmp -s "$IN" "$OUT" || echo "output differs" >&2
+        best=$(awk -v mb=$MB -v s=$start -v e=$end -v b=$best \
+               'BEGIN { r = mb / (e - s); printf "%.1f", (r > b ? r : b) }')
+    done
+    printf " %7s | %14s | %14s |" $best "$(faults /tmp/hp_writer.log)" "$(faults /tmp/hp_reader.log)"
+}
+
+make -s svshm_xfr_ring_writer svshm_xfr_ring_reader
+
+printf "| %10s | %-7s | %7s | %14s | %14s |\n" "Ring" "Options" "MB/s" "Writer faults" "Reader faults"
+printf "|------------|---------|---------|----------------|----------------|\n"
+
+for N in $SLOTS; do
+    for M in $MODES; do
+        WOPTS=${M//_/ }
+        [ "$M" = none ] && WOPTS=""
+        ROPTS=""
+        [[ "$M" == *-P ]] && ROPTS=-P
+        printf "| %6d KiB | %-7s |" $(( N * SLOT_SIZE / 1024 )) "${WOPTS:-}"
+        xfr "$WOPTS $N $SLOT_SIZE" "$ROPTS"
+        printf "\n"
+    done
+done
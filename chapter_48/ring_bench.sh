@@ -0,0 +1,50 @@
+#!/usr/bin/env bash
+# Compare svshm_xfr_writer/reader (one buffer, lock-step) with
+# svshm_xfr_ring_writer/reader for several slot sizes and slot counts.
+# Times the reader, from the moment the writer has set up the IPC objects
+# (the writer can only get a ring ahead), and checks the output.
+IN=$1
+OUT=$2
+SIZES="1024 4096 16384 65536"
+SLOTS="1 4 16 64"
+
+# cleanup - remove shared-memory and semaphore IPC instances
+ipcrm -M 0x1234 -S 0x5678 2>/dev/null || true
+
+MB=$(( $(stat -c %s "$IN") / 1048576 ))
+
+# run writer ($1) and reader ($2), best of 3; print MB/s
+xfr() {
+    local start end best=0
+    for i in 1 2 3; do
+        $1 < "$IN" 2> /dev/null &
+        until ipcs -s | grep -q 0x00005678; do :; done    # writer is set up
+        start=$(date +%s.%N)
+        $2 > "$OUT" 2> /dev/null
+        end=$(date +%s.%N)
+        wait
+        ipcrm -M 0x1234 -S 0x5678 2>/dev/null || true
+        cmp -s "$IN" "$OUT" || echo "output differs" >&2
+        best=$(awk -v mb=$MB -v s=$start -v e=$end -v b=$best \
+               'BEGIN { r = mb / (e - s); printf "%.1f", (r > b ? r : b) }')
+    done
+    echo $best
+}
+
+printf "| %9s | %10s |" "Slot size" "Lock-step"
+for N in $SLOTS; do printf " %9s |" "$N slots"; done
+printf "\n|-----------|------------|"
+for N in $SLOTS; do printf -- "-----------|"; done
+printf "\n"
+
+for B in $SIZES; do
+    # rebuild the lock-step programs with BUF_SIZE
+    make -s clean
+    make -s BUF_SIZE=$B svshm_xfr_writer svshm_xfr_reader svshm_xfr_ring_writer svshm_xfr_ring_reader
+
+    printf "| %9d | %10s |" "$B" "$(xfr ./svshm_xfr_writer ./svshm_xfr_reader)"
+    for N in $SLOTS; do
+        printf " %9s |" "$(xfr "./svshm_xfr_ring_writer $N $B" ./svshm_xfr_ring_reader)"
+    done
+    printf "\n"
+done
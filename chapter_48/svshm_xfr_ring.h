@@ -0,0 +1,151 @@
+/*  svshm_xfr_ring.h
+
+   Header file used by svshm_xfr_ring_writer.c and svshm_xfr_ring_reader.c.
+
+   Instead of the single buffer of svshm_xfr.h, which the writer and the reader
+   hand back and forth with a semop() on every block, the segment holds a ring
+   of slots. The writer fills slots at 'head' and the reader empties them at
+   'tail'; each side only ever writes its own index, so the indexes are plain
+   atomic counters and no lock is needed. A side blocks (on its semaphore) only
+   when the ring is full (writer) or empty (reader), and the other side posts
+   the semaphore only if it sees the waiting flag set.
+
+   Both programs take -P to fault in the whole segment before the transfer
+   starts; the writer takes -H to create the segment with huge pages. See
+   hugepage_bench.sh.
+*/
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "svshm_xfr.h"
+
+#define DONE_SEM 2              /* Reader has seen EOF and let go of the segment */
+
+#define DEFAULT_NUM_SLOTS 16
+
+#define CACHE_LINE 64
+
+struct ringhdr {                /* Start of the shared memory segment */
+    size_t slotSize;            /* Bytes of data per slot */
+    int numSlots;
+
+    /* Each index on its own cache line, so that the writer updating 'head'
+       doesn't keep taking away the line the reader updates 'tail' in */
+
+    unsigned long head __attribute__((aligned(CACHE_LINE)));
+                                /* Slots ever filled (writer only) */
+    int readerWaiting;          /* Reader is (about to be) blocked on READ_SEM */
+
+    unsigned long tail __attribute__((aligned(CACHE_LINE)));
+                                /* Slots ever emptied (reader only) */
+    int writerWaiting;          /* Writer is (about to be) blocked on WRITE_SEM */
+};
+
+struct ringslot {
+    int cnt;                    /* Number of bytes used in 'buf'; 0 for EOF */
+    char buf[];                 /* slotSize bytes */
+};
+
+/* Slots start on a cache line boundary, after the header */
+
+static inline size_t
+slotStride(size_t slotSize)
+{
+    return (sizeof(struct ringslot) + slotSize + CACHE_LINE - 1) & ~(size_t) (CACHE_LINE - 1);
+}
+
+static inline size_t
+ringSegSize(size_t slotSize, int numSlots)
+{
+    return sizeof(struct ringhdr) + numSlots * slotStride(slotSize);
+}
+
+static inline struct ringslot *
+ringSlot(struct ringhdr *hdr, unsigned long idx)
+{
+    return (struct ringslot *) ((char *) (hdr + 1) +
+                                (idx % hdr->numSlots) * slotStride(hdr->slotSize));
+}
+
+/* Wait until cond(hdr) holds. 'waiting' is our flag, 'semNum' our semaphore.
+
+   The flag is set before checking the condition a last time, and the other
+   side changes its index before checking the flag (both sequentially
+   consistent), so either we see the change or the other side sees the flag.
+   Whoever clears a set flag decides who consumes the matching semaphore
+   post: the other side clears it and posts; if we clear it ourselves nobody
+   posts. So the semaphore never accumulates stale posts. */
+
+static inline int
+ringWait(int semid, int semNum, int *waiting, Boolean (*cond)(struct ringhdr *),
+         struct ringhdr *hdr)
+{
+    while (!cond(hdr)) {
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (cond(hdr)) {
+            if (__atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST) == 1)
+                return 0;       /* Withdrawn before the other side saw it */
+            /* The other side cleared it and posts (or posted) - take that post */
+        }
+        if (reserveSem(semid, semNum) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* Called after changing our index: wake the other side if it waits */
+
+static inline int
+ringWake(int semid, int semNum, int *waiting)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) == 1 &&
+            __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST) == 1)
+        return releaseSem(semid, semNum);
+    return 0;
+}
+
+/* Size of a huge page (Hugepagesize in /proc/meminfo), or 0 if unknown. A
+   SHM_HUGETLB segment is a whole number of these */
+
+static inline size_t
+hugePageSize(void)
+{
+    FILE *fp;
+    char line[128];
+    unsigned long kb = 0;
+
+    fp = fopen("/proc/meminfo", "r");
+    if (fp == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1)
+            break;
+    fclose(fp);
+    return kb * 1024;
+}
+
+/* Fault in every page of the segment we attached at 'addr', so that the
+   transfer loop doesn't take the first-touch faults. MADV_POPULATE_WRITE
+   (Linux 5.14) does this without pinning the pages; on older kernels we
+   fall back to mlock(), which also keeps them in RAM */
+
+static inline int
+prefault(void *addr, size_t len)
+{
+    if (madvise(addr, len, MADV_POPULATE_WRITE) == 0)
+        return 0;
+    if (errno != EINVAL)
+        return -1;
+    return mlock(addr, len);
+}
+
+/* Minor plus major page faults taken by this process so far */
+
+static inline long
+pageFaults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        return -1;
+    return ru.ru_minflt + ru.ru_majflt;
+}
@@ -0,0 +1,89 @@
+/*  svshm_xfr_ring_reader.c
+
+   Read data from the ring of slots in a System V shared memory segment; see
+   svshm_xfr_ring_writer.c. -P faults in the whole segment before the transfer
+   starts: the writer's -P only fills in its own page tables.
+*/
+#include "svshm_xfr_ring.h"
+
+static Boolean
+notEmpty(struct ringhdr *hdr)
+{
+    return __atomic_load_n(&hdr->head, __ATOMIC_SEQ_CST) != hdr->tail;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int semid, shmid, xfrs, opt;
+    long bytes, setupFaults, xfrFaults;
+    Boolean populate = FALSE;
+    struct ringhdr *hdr;
+    struct ringslot *slot;
+    struct shmid_ds ds;
+
+    while ((opt = getopt(argc, argv, "P")) != -1) {
+        switch (opt) {
+        case 'P': populate = TRUE;  break;
+        default: usageErr("%s [-P] > out_file\n", argv[0]);
+        }
+    }
+
+    /* Get IDs for semaphore set and shared memory created by writer */
+
+    semid = semget(SEM_KEY, 0, 0);
+    if (semid == -1)
+        errExit("semget");
+
+    shmid  = shmget(SHM_KEY, 0, 0);
+    if (shmid == -1)
+        errExit("shmget");
+
+    /* Attach read-write: unlike svshm_xfr_reader.c, we update 'tail' */
+
+    hdr = shmat(shmid, NULL, 0);
+    if (hdr == (void *) -1)
+        errExit("shmat");
+
+    if (populate) {
+        if (shmctl(shmid, IPC_STAT, &ds) == -1)
+            errExit("shmctl");
+        if (prefault(hdr, ds.shm_segsz) == -1)
+            errExit("prefault");
+    }
+
+    /* Transfer blocks of data from the ring to stdout */
+
+    setupFaults = pageFaults();
+    for (xfrs = 0, bytes = 0; ; xfrs++) {
+        if (ringWait(semid, READ_SEM, &hdr->readerWaiting, notEmpty, hdr) == -1)
+            errExit("ringWait");    /* Wait for a filled slot */
+
+        slot = ringSlot(hdr, hdr->tail);
+        if (slot->cnt == 0)                     /* Writer encountered EOF */
+            break;
+        bytes += slot->cnt;
+
+        if (write(STDOUT_FILENO, slot->buf, slot->cnt) != slot->cnt)
+            fatal("partial/failed write");
+
+        /* Hand the slot back, then wake the writer if it waits for one */
+
+        __atomic_store_n(&hdr->tail, hdr->tail + 1, __ATOMIC_SEQ_CST);
+        if (ringWake(semid, WRITE_SEM, &hdr->writerWaiting) == -1)
+            errExit("ringWake");
+    }
+
+    xfrFaults = pageFaults() - setupFaults;
+    if (shmdt(hdr) == -1)
+        errExit("shmdt");
+
+    /* Let the writer clean up */
+
+    if (releaseSem(semid, DONE_SEM) == -1)
+        errExit("releaseSem");
+
+    fprintf(stderr, "Received %ld bytes (%d xfrs)\n", bytes, xfrs);
+    fprintf(stderr, "Page faults: %ld setting up, %ld while transferring\n", setupFaults, xfrFaults);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,134 @@
+/*  svshm_xfr_ring_writer.c
+
+   Like svshm_xfr_writer.c, but the shared memory segment holds a ring of
+   slots (see svshm_xfr_ring.h), so the writer can run up to 'num-slots'
+   blocks ahead of the reader instead of waiting for it after every block.
+
+   This program needs to be started before the reader process as it creates the
+   shared memory and semaphores used by both processes:
+
+        $ svshm_xfr_ring_writer [-H] [-P] [num-slots [slot-size]] < infile &
+        $ svshm_xfr_ring_reader [-P] > out_file
+
+   slot-size defaults to BUF_SIZE, so with 1 slot this is the original
+   lock-step protocol. -H creates the segment with huge pages (SHM_HUGETLB;
+   some must be reserved in /proc/sys/vm/nr_hugepages), and -P faults it in
+   before the transfer starts.
+*/
+#include "semun.h"              /* Definition of semun union */
+#include "svshm_xfr_ring.h"
+
+static Boolean
+notFull(struct ringhdr *hdr)
+{
+    return hdr->head - __atomic_load_n(&hdr->tail, __ATOMIC_SEQ_CST) <
+           (unsigned long) hdr->numSlots;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int semid, shmid, xfrs, numSlots, opt, shmFlags = 0;
+    long bytes, setupFaults, xfrFaults;
+    size_t slotSize, segSize, pageSize;
+    Boolean populate = FALSE;
+    struct ringhdr *hdr;
+    struct ringslot *slot;
+    union semun dummy;
+
+    while ((opt = getopt(argc, argv, "HP")) != -1) {
+        switch (opt) {
+        case 'H': shmFlags |= SHM_HUGETLB;  break;
+        case 'P': populate = TRUE;          break;
+        default: usageErr("%s [-H] [-P] [num-slots [slot-size]] < infile\n", argv[0]);
+        }
+    }
+    if (argc - optind > 2)
+        usageErr("%s [-H] [-P] [num-slots [slot-size]] < infile\n", argv[0]);
+
+    numSlots = (argc > optind) ? getInt(argv[optind], GN_GT_0, "num-slots") : DEFAULT_NUM_SLOTS;
+    slotSize = (argc > optind + 1) ? getLong(argv[optind + 1], GN_GT_0, "slot-size") : BUF_SIZE;
+
+    /* A huge page segment is a whole number of huge pages; say so in its
+       size, so that the reader (-P) faults in all of it */
+
+    segSize = ringSegSize(slotSize, numSlots);
+    if (shmFlags & SHM_HUGETLB) {
+        pageSize = hugePageSize();
+        if (pageSize == 0)
+            fatal("can't find the huge page size");
+        segSize = (segSize + pageSize - 1) / pageSize * pageSize;
+    }
+
+    /* Create shared memory; attach at address chosen by system */
+
+    shmid = shmget(SHM_KEY, segSize, IPC_CREAT | OBJ_PERMS | shmFlags);
+    if (shmid == -1)
+        errExit("shmget");
+
+    hdr = shmat(shmid, NULL, 0);
+    if (hdr == (void *) -1)
+        errExit("shmat");
+
+    if (populate && prefault(hdr, segSize) == -1)
+        errExit("prefault");
+
+    /* A new segment is zeroed, so the indexes start at 0 */
+
+    hdr->slotSize = slotSize;
+    hdr->numSlots = numSlots;
+
+    /* Create set containing three semaphores, all in use: a side blocked on
+       its semaphore gets it from the other side (see ringWait()). The
+       reader looks for the set first, so by the time it finds it the
+       segment is ready */
+
+    semid = semget(SEM_KEY, 3, IPC_CREAT | OBJ_PERMS);
+    if (semid == -1)
+        errExit("semget");
+
+    if (initSemInUse(semid, WRITE_SEM) == -1 || initSemInUse(semid, READ_SEM) == -1 ||
+            initSemInUse(semid, DONE_SEM) == -1)
+        errExit("initSemInUse");
+
+    /* Transfer blocks of data from stdin to the ring */
+
+    setupFaults = pageFaults();
+    for (xfrs = 0, bytes = 0; ; xfrs++) {
+        if (ringWait(semid, WRITE_SEM, &hdr->writerWaiting, notFull, hdr) == -1)
+            errExit("ringWait");    /* Wait for a free slot */
+
+        slot = ringSlot(hdr, hdr->head);
+        slot->cnt = read(STDIN_FILENO, slot->buf, slotSize);
+        if (slot->cnt == -1)
+            errExit("read");
+        bytes += slot->cnt;
+
+        /* Publish the slot, then wake the reader if it waits for one */
+
+        __atomic_store_n(&hdr->head, hdr->head + 1, __ATOMIC_SEQ_CST);
+        if (ringWake(semid, READ_SEM, &hdr->readerWaiting) == -1)
+            errExit("ringWake");
+
+        if (slot->cnt == 0)         /* EOF slot sent */
+            break;
+    }
+
+    /* Wait until the reader has seen EOF. We then know it has finished with
+       the segment, and so we can delete the IPC objects. */
+
+    if (reserveSem(semid, DONE_SEM) == -1)
+        errExit("reserveSem");
+    xfrFaults = pageFaults() - setupFaults;
+
+    if (semctl(semid, 0, IPC_RMID, dummy) == -1)
+        errExit("semctl");
+    if (shmdt(hdr) == -1)
+        errExit("shmdt");
+    if (shmctl(shmid, IPC_RMID, NULL) == -1)
+        errExit("shmctl");
+
+    fprintf(stderr, "Sent %ld bytes (%d xfrs, %d slots of %zu bytes)\n", bytes, xfrs, numSlots, slotSize);
+    fprintf(stderr, "Page faults: %ld setting up, %ld while transferring\n", setupFaults, xfrFaults);
+    exit(EXIT_SUCCESS);
+}
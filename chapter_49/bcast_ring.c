@@ -0,0 +1,470 @@
+/* bcast_ring.c
+
+   Implementation of bcast_ring.h.
+
+   Record 'pos' goes in slot pos % num_slots. The slot's 'seq' works like a
+   seqlock: the writer sets it to 2 * pos + 1 before it touches the slot and to
+   2 * pos + 2 when the record is complete. A reader copies the record out and
+   then checks that 'seq' is still 2 * pos + 2; if it isn't, the writer has
+   overwritten the record (BCAST_DROP), and the reader counts it as lost.
+
+   Sleeping follows the same pattern as spsc_queue.c (chapter 53), with a
+   counter instead of a flag on the readers' side, since several of them may
+   sleep at once: the sleeper registers itself before checking a last time,
+   and the other side moves on before looking for sleepers (both
+   sequentially consistent).
+
+   A reader that attaches publishes cursor 0 first, and only then reads 'head'
+   and publishes that. A writer that looks at the reader table in between sees
+   a reader a whole ring behind and waits, so it can't overwrite the slot the
+   new reader starts at before it sees the real cursor.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/magic.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "bcast_ring.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+#define CACHE_LINE 64
+#define BCAST_MAGIC 0x42434153          /* "BCAS" */
+
+struct bcast_slot {
+    uint64_t seq;
+    int cnt;                            /* Bytes used in 'buf'; 0 for EOF */
+    char buf[];
+};
+
+struct bcast_reader {
+    uint64_t cursor;                    /* Next record the reader will read */
+    pid_t pid;                          /* 0 if the entry is free */
+} __attribute__((aligned(CACHE_LINE)));
+
+struct bcast_shared {
+    uint32_t magic;
+    uint32_t num_slots;
+    uint32_t slot_size;
+    uint32_t policy;
+    uint64_t stride;                    /* Bytes from one slot to the next */
+    uint64_t map_size;
+    pid_t writer_pid;
+
+    /* Written by the writer */
+    uint64_t head __attribute__((aligned(CACHE_LINE)));
+                                        /* Records committed */
+    uint32_t head_futex;                /* Low 32 bits of 'head' */
+
+    uint32_t readers_waiting __attribute__((aligned(CACHE_LINE)));
+    uint32_t writer_waiting;
+    uint32_t space_futex;               /* Bumped when a reader wakes the writer */
+    uint32_t readers_futex;             /* Bumped when a reader attaches or detaches */
+
+    struct bcast_reader readers[BCAST_MAX_READERS];
+
+    char slots[] __attribute__((aligned(CACHE_LINE)));
+};
+
+
+static long
+futex_wait(uint32_t *uaddr, uint32_t val, int timeout_ms)
+{
+    struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    return syscall(SYS_futex, uaddr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+
+static void
+futex_wake(uint32_t *uaddr, int n)
+{
+    syscall(SYS_futex, uaddr, FUTEX_WAKE, n, NULL, NULL, 0);
+}
+
+
+static int
+process_gone(pid_t pid)
+{
+    return kill(pid, 0) == -1 && errno == ESRCH;
+}
+
+
+static struct bcast_slot *
+slot_at(struct bcast_shared *shm, uint64_t pos)
+{
+    return (struct bcast_slot *) (shm->slots + (pos % shm->num_slots) * shm->stride);
+}
+
+
+/* Tell a writer waiting in bcast_wait_readers() that the reader table changed */
+static void
+readers_changed(struct bcast_shared *shm)
+{
+    __atomic_fetch_add(&shm->readers_futex, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&shm->readers_futex, INT_MAX);
+}
+
+
+/* Map the ring, faulting it all in with BCAST_POPULATE. The writer fills
+   the slots, and a reader stores its cursor in the same mapping, so both
+   want the pages writable before streaming. MAP_POPULATE maps them
+   read-only, so MADV_POPULATE_WRITE follows it; a kernel without that
+   (EINVAL, before 5.14) leaves the write faults to the first pass around
+   the ring. Other errors fail, with errno set */
+static struct bcast_shared *
+map_ring(int fd, size_t size, int flags)
+{
+    struct bcast_shared *shm = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | (flags & BCAST_POPULATE ? MAP_POPULATE : 0), fd, 0);
+    if (shm == MAP_FAILED)
+        return NULL;
+    if ((flags & BCAST_POPULATE) && madvise(shm, size, MADV_POPULATE_WRITE) == -1 &&
+            errno != EINVAL) {
+        int saved_errno = errno;
+        munmap(shm, size);
+        errno = saved_errno;
+        return NULL;
+    }
+    return shm;
+}
+
+
+/* Store our cursor in the reader table, and wake the writer if it waits */
+static void
+publish_cursor(BcastRing *r)
+{
+    struct bcast_shared *shm = r->shm;
+
+    if (shm->policy == BCAST_DROP) {            /* The writer never looks */
+        __atomic_store_n(&shm->readers[r->reader].cursor, r->cursor, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_store_n(&shm->readers[r->reader].cursor, r->cursor, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->writer_waiting, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_add(&shm->space_futex, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&shm->space_futex, 1);
+    }
+}
+
+
+int
+bcast_create(BcastRing *r, const char *path, unsigned int num_slots, size_t slot_size,
+             enum bcast_policy policy, int flags)
+{
+    struct statfs sfs;
+
+    if (num_slots == 0 || slot_size == 0 || slot_size > INT_MAX) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    size_t stride = (sizeof(struct bcast_slot) + slot_size + CACHE_LINE - 1) &
+                    ~(size_t) (CACHE_LINE - 1);
+    size_t map_size = sizeof(struct bcast_shared) + num_slots * stride;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP);
+    if (fd == -1)
+        return -1;
+
+    /* -f on a hugetlbfs mount: round the file up to whole huge pages, the
+       only sizes ftruncate() there accepts */
+    if (fstatfs(fd, &sfs) == 0 && sfs.f_type == HUGETLBFS_MAGIC)
+        map_size = (map_size + sfs.f_bsize - 1) / sfs.f_bsize * sfs.f_bsize;
+
+    if (ftruncate(fd, map_size) == -1) {
+        close(fd);
+        return -1;
+    }
+    struct bcast_shared *shm = map_ring(fd, map_size, flags);
+    close(fd);
+    if (shm == NULL)
+        return -1;
+
+    /* ftruncate() gave us zeros: no readers, no records */
+    shm->num_slots = num_slots;
+    shm->slot_size = slot_size;
+    shm->policy = policy;
+    shm->stride = stride;
+    shm->map_size = map_size;
+    shm->writer_pid = getpid();
+    __atomic_store_n(&shm->magic, BCAST_MAGIC, __ATOMIC_RELEASE);
+
+    memset(r, 0, sizeof(BcastRing));
+    r->shm = shm;
+    r->reader = -1;
+    return 0;
+}
+
+
+int
+bcast_attach(BcastRing *r, const char *path, int spin, int flags)
+{
+    struct stat sb;
+
+    if (spin < -1) {
+        errno = EINVAL;
+        return -1;
+    }
+    int fd = open(path, O_RDWR);        /* Read-write: our cursor lives in there */
+    if (fd == -1)
+        return -1;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (sb.st_size < (off_t) sizeof(struct bcast_shared)) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    struct bcast_shared *shm = map_ring(fd, sb.st_size, flags);
+    close(fd);
+    if (shm == NULL)
+        return -1;
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != BCAST_MAGIC ||
+            shm->map_size != (uint64_t) sb.st_size) {
+        munmap(shm, sb.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(r, 0, sizeof(BcastRing));
+    r->shm = shm;
+    r->spin = spin == -1 ? (sysconf(_SC_NPROCESSORS_ONLN) > 1 ? BCAST_DEFAULT_SPIN : 0) : spin;
+
+    pid_t me = getpid();
+    for (r->reader = 0; r->reader < BCAST_MAX_READERS; r->reader++) {
+        pid_t free_entry = 0;
+        if (__atomic_compare_exchange_n(&shm->readers[r->reader].pid, &free_entry, me, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            break;
+    }
+    if (r->reader == BCAST_MAX_READERS) {
+        munmap(shm, sb.st_size);
+        errno = EBUSY;
+        return -1;
+    }
+
+    struct bcast_reader *rd = &shm->readers[r->reader];
+    __atomic_store_n(&rd->cursor, 0, __ATOMIC_SEQ_CST);
+    r->cursor = __atomic_load_n(&shm->head, __ATOMIC_SEQ_CST);
+    publish_cursor(r);
+    readers_changed(shm);
+    return 0;
+}
+
+
+int
+bcast_detach(BcastRing *r)
+{
+    struct bcast_shared *shm = r->shm;
+
+    if (r->reader >= 0) {
+        r->cursor = UINT64_MAX;                 /* Never the slowest again; wakes a writer */
+        publish_cursor(r);                      /* waiting for us */
+        __atomic_store_n(&shm->readers[r->reader].pid, 0, __ATOMIC_SEQ_CST);
+        readers_changed(shm);
+    }
+    return munmap(shm, shm->map_size);
+}
+
+
+size_t
+bcast_slot_size(BcastRing *r)
+{
+    return r->shm->slot_size;
+}
+
+
+enum bcast_policy
+bcast_policy(BcastRing *r)
+{
+    return r->shm->policy;
+}
+
+
+/* Free the entries of readers that died without detaching */
+static void
+drop_dead_readers(struct bcast_shared *shm)
+{
+    for (int i = 0; i < BCAST_MAX_READERS; i++) {
+        pid_t pid = __atomic_load_n(&shm->readers[i].pid, __ATOMIC_SEQ_CST);
+        if (pid != 0 && process_gone(pid))
+            __atomic_compare_exchange_n(&shm->readers[i].pid, &pid, 0, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED);
+    }
+}
+
+
+int
+bcast_num_readers(BcastRing *r)
+{
+    int n = 0;
+    drop_dead_readers(r->shm);
+    for (int i = 0; i < BCAST_MAX_READERS; i++)
+        if (__atomic_load_n(&r->shm->readers[i].pid, __ATOMIC_SEQ_CST) != 0)
+            n++;
+    return n;
+}
+
+
+int
+bcast_wait_readers(BcastRing *r, int min, int max)
+{
+    struct bcast_shared *shm = r->shm;
+
+    for (;;) {
+        /* Read the futex word before counting, so a change after the count
+           makes the wait return at once; dead readers wake nobody, hence the
+           timeout */
+        uint32_t v = __atomic_load_n(&shm->readers_futex, __ATOMIC_SEQ_CST);
+        int n = bcast_num_readers(r);
+        if (n >= min && n <= max)
+            return n;
+        futex_wait(&shm->readers_futex, v, BCAST_CHECK_MS);
+    }
+}
+
+
+/* The cursor of the slowest reader; 'head' if there are none */
+static uint64_t
+slowest_reader(struct bcast_shared *shm, uint64_t head)
+{
+    uint64_t min = head;
+    for (int i = 0; i < BCAST_MAX_READERS; i++) {
+        if (__atomic_load_n(&shm->readers[i].pid, __ATOMIC_SEQ_CST) == 0)
+            continue;
+        uint64_t c = __atomic_load_n(&shm->readers[i].cursor, __ATOMIC_SEQ_CST);
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+
+
+void *
+bcast_write_slot(BcastRing *r)
+{
+    struct bcast_shared *shm = r->shm;
+    uint64_t pos = r->cursor;
+
+    /* only look at the reader table when the cached cursor says we're full */
+    while (shm->policy == BCAST_BLOCK && pos - r->cached_min >= shm->num_slots) {
+        r->cached_min = slowest_reader(shm, pos);
+        if (pos - r->cached_min < shm->num_slots)
+            break;
+
+        __atomic_store_n(&shm->writer_waiting, 1, __ATOMIC_SEQ_CST);
+        uint32_t v = __atomic_load_n(&shm->space_futex, __ATOMIC_SEQ_CST);
+        r->cached_min = slowest_reader(shm, pos);
+        if (pos - r->cached_min >= shm->num_slots) {
+            r->waits++;
+            if (futex_wait(&shm->space_futex, v, BCAST_CHECK_MS) == -1 && errno == ETIMEDOUT)
+                drop_dead_readers(shm);
+        }
+        __atomic_store_n(&shm->writer_waiting, 0, __ATOMIC_SEQ_CST);
+    }
+
+    struct bcast_slot *slot = slot_at(shm, pos);
+    __atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);    /* Readers see the mark before any new data */
+    return slot->buf;
+}
+
+
+void
+bcast_commit(BcastRing *r, int cnt)
+{
+    struct bcast_shared *shm = r->shm;
+    struct bcast_slot *slot = slot_at(shm, r->cursor);
+
+    slot->cnt = cnt;
+    __atomic_store_n(&slot->seq, 2 * r->cursor + 2, __ATOMIC_RELEASE);
+
+    r->cursor++;
+    __atomic_store_n(&shm->head, r->cursor, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&shm->head_futex, (uint32_t) r->cursor, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->readers_waiting, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&shm->head_futex, INT_MAX);
+}
+
+
+/* Poll, then sleep, until 'head' moves past our cursor.
+   Return -1 if the writer is gone */
+static int
+wait_for_writer(BcastRing *r)
+{
+    struct bcast_shared *shm = r->shm;
+
+    for (int i = 0; i < r->spin; i++) {
+        if (__atomic_load_n(&shm->head, __ATOMIC_ACQUIRE) != r->cursor)
+            return 0;
+        cpu_relax();
+    }
+
+    int gone = 0;
+    __atomic_fetch_add(&shm->readers_waiting, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&shm->head, __ATOMIC_SEQ_CST) == r->cursor) {
+        r->waits++;
+        if (futex_wait(&shm->head_futex, (uint32_t) r->cursor, BCAST_CHECK_MS) == -1 &&
+                errno == ETIMEDOUT)
+            gone = process_gone(shm->writer_pid);
+    }
+    __atomic_fetch_sub(&shm->readers_waiting, 1, __ATOMIC_SEQ_CST);
+    return gone ? -1 : 0;
+}
+
+
+int
+bcast_read(BcastRing *r, void *buf)
+{
+    struct bcast_shared *shm = r->shm;
+
+    for (;;) {
+        uint64_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+        if (head == r->cursor) {
+            if (wait_for_writer(r) == -1)
+                return 0;
+            continue;
+        }
+
+        /* Lapped: everything before the oldest slot still in the ring is gone */
+        if (head - r->cursor > shm->num_slots) {
+            r->lost += head - shm->num_slots - r->cursor;
+            r->cursor = head - shm->num_slots;
+        }
+
+        struct bcast_slot *slot = slot_at(shm, r->cursor);
+        uint64_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == 2 * r->cursor + 2) {
+            int cnt = slot->cnt;
+            if (cnt >= 0 && cnt <= (int) shm->slot_size) {  /* Else torn by the writer */
+                memcpy(buf, slot->buf, cnt);
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq) {
+                    r->cursor++;
+                    publish_cursor(r);
+                    return cnt;
+                }
+            }
+        }
+
+        r->lost++;                              /* Overwritten before or while we read it */
+        r->cursor++;
+        publish_cursor(r);
+    }
+}
@@ -0,0 +1,88 @@
+/* bcast_ring.h
+
+   Single-writer, multi-reader broadcast ring in a shared file mapping, for
+   streaming the same data to several readers at once (see
+   mmap_bcast_writer.c and mmap_bcast_reader.c).
+
+   The writer appends records at 'head'. Every reader has its own cursor in
+   the mapping and reads every record from where it attached, at its own pace.
+   What happens when the writer comes round to a slot that a slow reader hasn't
+   read yet depends on the ring's policy:
+
+       BCAST_BLOCK   the writer waits for the slowest reader
+       BCAST_DROP    the writer overwrites the slot; the reader notices
+                     when it gets there, skips ahead and reports the gap
+
+   Readers poll 'head' with plain loads, so reading costs no system call while
+   there is data. A reader that runs out sleeps on a futex, and the writer makes
+   the wake-up call only if somebody sleeps. A blocked writer likewise sleeps
+   until a reader moves on, and every BCAST_CHECK_MS it drops readers whose
+   process no longer exists, so a dead reader can't stop it for good.
+
+   The ring can live in a file on a hugetlbfs mount, to have it in huge pages,
+   and BCAST_POPULATE faults in the whole mapping up front (MAP_POPULATE), so
+   that neither side takes first-touch page faults while streaming.
+
+   Usage:
+       writer:  buf = bcast_write_slot(r); ...fill up to slot_size bytes...; bcast_commit(r, cnt);
+       reader:  cnt = bcast_read(r, buf);  ...records lost so far in r->lost...
+*/
+#ifndef BCAST_RING_H
+#define BCAST_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BCAST_MAX_READERS 64
+#define BCAST_CHECK_MS 100      /* How often a blocked writer looks for dead readers */
+#define BCAST_DEFAULT_SPIN 200  /* Polls before an idle reader goes to sleep */
+
+enum bcast_policy { BCAST_BLOCK, BCAST_DROP };
+
+#define BCAST_POPULATE 1        /* Flag for bcast_create() and bcast_attach() */
+
+typedef struct {                /* Process-local handle */
+    struct bcast_shared *shm;
+    int reader;                 /* Our index in the reader table; -1 for the writer */
+    uint64_t cursor;            /* Reader: next record to read; writer: next to write */
+    uint64_t cached_min;        /* Writer: slowest reader's cursor at our last look */
+    int spin;
+    long waits;                 /* Times we slept */
+    uint64_t lost;              /* Reader: records overwritten before we read them */
+} BcastRing;
+
+/* Create (or truncate) 'path' and map a ring of 'num_slots' slots of
+   'slot_size' bytes in it, for the writer. On hugetlbfs the file is rounded
+   up to a whole number of huge pages. 'flags' is 0 or BCAST_POPULATE.
+   Return 0 on success, -1 with errno set on error */
+int bcast_create(BcastRing *r, const char *path, unsigned int num_slots, size_t slot_size,
+                 enum bcast_policy policy, int flags);
+
+/* Map the ring in 'path' and take a free reader entry. The reader starts with
+   the next record the writer commits. 'spin' is the number of polls before
+   sleeping; -1 for BCAST_DEFAULT_SPIN if more than one CPU is online, and 0
+   otherwise. 'flags' is 0 or BCAST_POPULATE. Return 0 on success, -1 with
+   errno set on error (EBUSY: no free reader entry) */
+int bcast_attach(BcastRing *r, const char *path, int spin, int flags);
+
+/* Give up the reader entry (if any) and unmap the ring */
+int bcast_detach(BcastRing *r);
+
+size_t bcast_slot_size(BcastRing *r);
+enum bcast_policy bcast_policy(BcastRing *r);
+int bcast_num_readers(BcastRing *r);    /* Not counting readers that died */
+
+/* Writer: sleep until bcast_num_readers() is between 'min' and 'max', and
+   return it. Attaching and detaching readers wake the writer at once */
+int bcast_wait_readers(BcastRing *r, int min, int max);
+
+/* Writer */
+void *bcast_write_slot(BcastRing *r);   /* Blocks (BCAST_BLOCK) while a reader lags a whole ring behind */
+void bcast_commit(BcastRing *r, int cnt);
+
+/* Reader: copy the next record into 'buf' (room for bcast_slot_size() bytes)
+   and return its length. Blocks while there is nothing new; returns 0 (as for
+   the writer's end-of-file record) if the writer is gone */
+int bcast_read(BcastRing *r, void *buf);
+
+#endif
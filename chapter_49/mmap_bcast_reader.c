@@ -0,0 +1,76 @@
+/* mmap_bcast_reader.c
+
+   Copy the stream of mmap_bcast_writer.c from the broadcast ring to stdout.
+   Any number of these can read the same stream at once.
+
+   If the writer runs with -d and this reader falls a whole ring behind, the
+   records it missed are gone; each gap is reported on stderr. -u makes the
+   reader slow on purpose, by sleeping that many microseconds after each
+   record. -f and -P are as for the writer: the ring file, and faulting in
+   the whole ring before reading.
+
+        $ mmap_bcast_reader [-u delay-usecs] [-f ring-file] [-P] > out_file
+*/
+#include <time.h>
+
+#include "mmap_xfr.h"
+#include "bcast_ring.h"
+
+int
+main(int argc, char *argv[])
+{
+    long bytes, xfrs, delay_us = 0, setup_faults, xfr_faults;
+    uint64_t lost = 0;
+    int cnt, opt, flags = 0;
+    const char *path = MMAP_FILE;
+    BcastRing ring;
+
+    while ((opt = getopt(argc, argv, "u:f:P")) != -1) {
+        switch (opt) {
+        case 'u': delay_us = getLong(optarg, GN_NONNEG, "delay-usecs"); break;
+        case 'f': path = optarg; break;
+        case 'P': flags |= BCAST_POPULATE; break;
+        default: usageErr("%s [-u delay-usecs] [-f ring-file] [-P] > out_file\n", argv[0]);
+        }
+    }
+    struct timespec delay = { delay_us / 1000000, (delay_us % 1000000) * 1000 };
+
+    if (bcast_attach(&ring, path, -1, flags) == -1)
+        errExit("bcast_attach");
+
+    char *buf = malloc(bcast_slot_size(&ring));
+    if (buf == NULL)
+        errExit("malloc");
+
+    /* Transfer blocks of data from the ring to stdout */
+
+    setup_faults = page_faults();
+    for (xfrs = 0, bytes = 0; ; xfrs++) {
+        cnt = bcast_read(&ring, buf);           /* Waits while there is nothing new */
+
+        if (ring.lost != lost) {
+            fprintf(stderr, "[PID %ld] gap: %llu records lost after %ld bytes\n", (long) getpid(),
+                    (unsigned long long) (ring.lost - lost), bytes);
+            lost = ring.lost;
+        }
+        if (cnt == 0)                           /* Writer encountered EOF */
+            break;
+        bytes += cnt;
+
+        if (write(STDOUT_FILENO, buf, cnt) != cnt)
+            fatal("partial/failed write");
+
+        if (delay_us > 0)
+            nanosleep(&delay, NULL);
+    }
+    xfr_faults = page_faults() - setup_faults;
+
+    if (bcast_detach(&ring) == -1)
+        errExit("bcast_detach");
+
+    fprintf(stderr, "[PID %ld] Received %ld bytes (%ld xfrs, %llu records lost, slept %ld times)\n",
+            (long) getpid(), bytes, xfrs, (unsigned long long) lost, ring.waits);
+    fprintf(stderr, "[PID %ld] Page faults: %ld setting up, %ld while transferring\n",
+            (long) getpid(), setup_faults, xfr_faults);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,106 @@
+/* mmap_bcast_writer.c
+
+   Like mmap_xfr_writer.c, but the data goes through a broadcast ring
+   (bcast_ring.c) in the mapped file, so any number of mmap_bcast_reader
+   processes each get the whole stream, at their own pace.
+
+   With -d, the writer never waits: a reader that falls a whole ring behind
+   loses records (and says so). Otherwise the writer waits for the slowest
+   reader. Readers start with the next record written after they attach, so
+   -r makes the writer wait until that many readers are there. -u paces the
+   writer, the way a feed that produces data over time would be paced, by
+   sleeping that many microseconds after each record.
+
+   -f puts the ring in another file than MMAP_FILE; a file on a hugetlbfs
+   mount gets the ring huge pages. -P faults in the whole ring before
+   sending. Either way, the writer reports the page faults it took.
+
+   The writer is started first, as it creates the ring:
+
+        $ mmap_bcast_writer -r 2 < infile &
+        $ mmap_bcast_reader > out_file1 &
+        $ mmap_bcast_reader > out_file2
+*/
+#include <time.h>
+
+#include "mmap_xfr.h"
+#include "bcast_ring.h"
+
+#define DEFAULT_NUM_SLOTS 64
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-d] [-r readers] [-n num-slots] [-s slot-size] [-u delay-usecs] "
+            "[-f ring-file] [-P] < infile\n", progName);
+    fprintf(stderr, "  -d: drop records for slow readers instead of waiting for them\n");
+    fprintf(stderr, "  -r readers: wait for this many readers before sending (default 1)\n");
+    fprintf(stderr, "  -n num-slots: slots in the ring (default %d)\n", DEFAULT_NUM_SLOTS);
+    fprintf(stderr, "  -s slot-size: bytes per slot (default %d)\n", BUF_SIZE);
+    fprintf(stderr, "  -u delay-usecs: sleep after each record (default 0)\n");
+    fprintf(stderr, "  -f ring-file: file to map the ring in (default %s)\n", MMAP_FILE);
+    fprintf(stderr, "  -P: fault in the whole ring before sending\n");
+    exit(EXIT_FAILURE);
+}
+
+int
+main(int argc, char *argv[])
+{
+    enum bcast_policy policy = BCAST_BLOCK;
+    int num_readers = 1, num_slots = DEFAULT_NUM_SLOTS, slot_size = BUF_SIZE, opt, flags = 0;
+    long bytes, xfrs, delay_us = 0, setup_faults, xfr_faults;
+    const char *path = MMAP_FILE;
+    int cnt;
+    BcastRing ring;
+
+    while ((opt = getopt(argc, argv, "dr:n:s:u:f:P")) != -1) {
+        switch (opt) {
+        case 'd': policy = BCAST_DROP; break;
+        case 'r': num_readers = getInt(optarg, GN_NONNEG, "readers"); break;
+        case 'n': num_slots = getInt(optarg, GN_GT_0, "num-slots"); break;
+        case 's': slot_size = getInt(optarg, GN_GT_0, "slot-size"); break;
+        case 'u': delay_us = getLong(optarg, GN_NONNEG, "delay-usecs"); break;
+        case 'f': path = optarg; break;
+        case 'P': flags |= BCAST_POPULATE; break;
+        default: usageError(argv[0]);
+        }
+    }
+    struct timespec delay = { delay_us / 1000000, (delay_us % 1000000) * 1000 };
+
+    if (bcast_create(&ring, path, num_slots, slot_size, policy, flags) == -1)
+        errExit("bcast_create");
+
+    bcast_wait_readers(&ring, num_readers, BCAST_MAX_READERS);
+
+    /* Transfer blocks of data from stdin to the ring */
+
+    setup_faults = page_faults();
+    for (xfrs = 0, bytes = 0; ; xfrs++, bytes += cnt) {
+        char *buf = bcast_write_slot(&ring);    /* Waits for the slowest reader unless -d */
+
+        cnt = read(STDIN_FILENO, buf, slot_size);
+        if (cnt == -1)
+            errExit("read");
+
+        bcast_commit(&ring, cnt);               /* 0 tells the readers we're done */
+        if (cnt == 0)
+            break;
+
+        if (delay_us > 0)
+            nanosleep(&delay, NULL);
+    }
+    xfr_faults = page_faults() - setup_faults;
+
+    /* Wait until the readers have let go of the ring, then remove it */
+
+    bcast_wait_readers(&ring, 0, 0);
+
+    if (bcast_detach(&ring) == -1)
+        errExit("bcast_detach");
+    if (unlink(path) == -1)
+        errExit("unlink");
+
+    fprintf(stderr, "Sent %ld bytes (%ld xfrs, slept %ld times)\n", bytes, xfrs, ring.waits);
+    fprintf(stderr, "Page faults: %ld setting up, %ld while transferring\n", setup_faults, xfr_faults);
+    exit(EXIT_SUCCESS);
+}
@@ -16,6 +16,7 @@
 */
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/resource.h>
 #include <sys/sem.h>
 #include "binary_sems.h"        /* Declares our binary semaphore functions */
 #include "tlpi_hdr.h"
@@ -38,6 +39,18 @@
 #define BUF_SIZE 4096           /* Size of transfer buffer */
 #endif
 
+/* Page faults (minor plus major) this process has taken so far, for the
+   programs that report them */
+static inline long
+page_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_SELF, &ru) == -1)
+        errExit("getrusage");
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
 struct sharedseg {              /* Defines structure of shared memory segment */
     int cnt;                    /* Number of bytes used in 'buf' */
     char buf[BUF_SIZE];         /* Data being transferred */
@@ -1,9 +1,14 @@
 #include <sys/time.h>
 #include <fcntl.h>
-#include <semaphore.h>
 #include <time.h>
 #include "tlpi_hdr.h"
 
+#ifdef USE_POSIX_SEM_IMPL
+#include "posix_sem.h"      // benchmark_posix_sem_impl - our implementation (Exercise 53.3)
+#else
+#include <semaphore.h>
+#endif
+
 static void
 usageError(const char *progName)
 {
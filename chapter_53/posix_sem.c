@@ -2,35 +2,47 @@
 
   Solution for Exercise 53.3
   
-  Implementation of POSIX semaphores using System V semaphores.
+  Implementation of POSIX semaphores using System V IPC.
   
   This implementation provides the POSIX semaphore API on top of System V
-  semaphore primitives. Named semaphores are managed using a combination
-  of a System V semaphore for the actual counting and a shared memory
-  segment for metadata.
+  IPC primitives. Every named semaphore is a System V shared memory
+  segment, holding its metadata and its value.
+  
+  Like glibc's semaphores, the value is changed with atomic instructions
+  in user space, so sem_wait() and sem_post() make no system call as long
+  as nobody has to block. A waiter that finds the value 0 sleeps on it
+  with futex(FUTEX_WAIT), and sem_post() calls futex(FUTEX_WAKE) only if
+  the metadata shows that somebody is waiting. (The first version kept the
+  value in a System V semaphore, and every operation was a semop() call.)
+  
+  sem_timedwait() hands its absolute deadline to the same futex wait
+  (FUTEX_WAIT_BITSET with FUTEX_CLOCK_REALTIME), so it times out when the
+  deadline passes, and leaves the signal dispositions, the signal mask and
+  the process's alarm timer alone. (The first version armed alarm() with a
+  SIGALRM handler, which rounded the timeout up to whole seconds and
+  could not be used by two threads at a time.)
 */
 
 #define _GNU_SOURCE
 #include <sys/types.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include <sys/stat.h>
 #include <sys/ipc.h>
 #include <fcntl.h>
 #include <time.h>
 #include <limits.h>
 #include <stdarg.h>
-#include <signal.h>
 
 #include "tlpi_hdr.h"
-#include "semun.h"      // system V semaphore union definition
 #include "posix_sem.h"  // our POSIX semaphore API header
 
 
 /* Internal structure to represent a POSIX semaphore */
 struct posix_sem {
-    int semid;          // system V semaphore ID
     int shmid;          // shared memory ID for metadata
+    struct sem_metadata *metadata; // attached from sem_open() to sem_close()
     char *name;         // semaphore name (for unlink)
     int ref_count;      // reference count for this process
 };
@@ -42,17 +54,81 @@ struct sem_metadata {
     int ref_count;       // total reference count across all processes
     mode_t mode;         // permission bits
     char name[NAME_MAX]; // semaphore name
+    int value;           // semaphore value; also the futex word waiters sleep on
+    int nwaiters;        // number of waiters in (or about to enter) FUTEX_WAIT
 };
 
 #define SEM_MAGIC 0x53454D00  // magic number for initialized semaphores
 #define SEM_FAILED_INTERNAL ((struct posix_sem *) -1)
 
-/* Dummy signal handler for SIGALRM - does nothing but allows signal to interrupt system calls */
-static void
-dummy_alarm_handler(int sig)
+/* Sleep while *uaddr == val, until abs_timeout (CLOCK_REALTIME) if it isn't NULL */
+static int
+futex_wait(int *uaddr, int val, const struct timespec *abs_timeout)
+{
+    // not FUTEX_WAIT_PRIVATE - the word is in memory shared between processes.
+    // Plain FUTEX_WAIT takes a relative CLOCK_MONOTONIC timeout; the bitset
+    // variant takes an absolute one, on CLOCK_REALTIME if asked to - which is
+    // exactly what sem_timedwait() gets. FUTEX_WAKE wakes bitset waiters too
+    return syscall(SYS_futex, uaddr, FUTEX_WAIT_BITSET | FUTEX_CLOCK_REALTIME, val,
+                   abs_timeout, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+
+static int
+futex_wake(int *uaddr, int count)
 {
-    // Do nothing - we just need the signal to interrupt semop()
-    (void) sig;  // Suppress unused parameter warning
+    return syscall(SYS_futex, uaddr, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+
+/* Decrement the value if it's above 0; the fast path of all the wait functions */
+static int
+try_decrement(struct sem_metadata *metadata)
+{
+    int value = __atomic_load_n(&metadata->value, __ATOMIC_RELAXED);
+    
+    while (value > 0) {
+        if (__atomic_compare_exchange_n(&metadata->value, &value, value - 1, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return 1;
+    }
+    
+    return 0;
+}
+
+
+/* Block until the value can be decremented, or until abs_timeout (if not
+   NULL) passes - ETIMEDOUT. With interruptible set, a signal handler
+   interrupting the wait makes it fail with EINTR */
+static int
+wait_slow(struct sem_metadata *metadata, const struct timespec *abs_timeout,
+          int interruptible)
+{
+    int result = 0;
+    
+    // announce ourselves before checking the value: a sem_post() that comes
+    // after our check sees nwaiters > 0 and wakes us (both sides are seq_cst)
+    __atomic_fetch_add(&metadata->nwaiters, 1, __ATOMIC_SEQ_CST);
+    
+    while (!try_decrement(metadata)) {
+        // sleeps only if the value is still 0 (EAGAIN otherwise)
+        if (futex_wait(&metadata->value, 0, abs_timeout) == 0 || errno == EAGAIN ||
+            (errno == EINTR && !interruptible))
+            continue;
+        
+        // ETIMEDOUT, EINTR for sem_timedwait(), or an error we can't retry
+        // (EINVAL for a bad deadline, ...). A post may have come in just
+        // before the deadline
+        int saved_errno = errno;
+        if (try_decrement(metadata))
+            break;
+        errno = saved_errno;
+        result = -1;
+        break;
+    }
+    
+    __atomic_fetch_sub(&metadata->nwaiters, 1, __ATOMIC_RELAXED);
+    return result;
 }
 
 
@@ -91,9 +167,8 @@ sem_open(const char *name, int oflag, ...)
 {
     struct posix_sem *sem;
     key_t key;
-    int semid, shmid;
+    int shmid;
     struct sem_metadata *metadata;
-    union semun arg;
     mode_t mode = S_IRUSR | S_IWUSR;
     unsigned int value = 0;
     va_list ap;
@@ -134,10 +209,9 @@ sem_open(const char *name, int oflag, ...)
     }
     
     // try to get existing semaphore first
-    semid = semget(key, 1, 0);
     shmid = shmget(key, sizeof(struct sem_metadata), 0);
     
-    if (semid == -1 || shmid == -1) {
+    if (shmid == -1) {
         // semaphore doesn't exist
         if (!(oflag & O_CREAT)) {
             free(sem);
@@ -145,9 +219,10 @@ sem_open(const char *name, int oflag, ...)
             return SEM_FAILED;
         }
         
-        // create new semaphore
-        semid = semget(key, 1, IPC_CREAT | IPC_EXCL | (mode & 0777));
-        if (semid == -1) {
+        // create shared memory for metadata and value
+        shmid = shmget(key, sizeof(struct sem_metadata), 
+                       IPC_CREAT | IPC_EXCL | (mode & 0777));
+        if (shmid == -1) {
             if (errno == EEXIST) {
                 // race condition: another process created it
                 if (oflag & O_EXCL) {
@@ -156,9 +231,8 @@ sem_open(const char *name, int oflag, ...)
                     return SEM_FAILED;
                 }
                 // try to get the existing one
-                semid = semget(key, 1, 0);
                 shmid = shmget(key, sizeof(struct sem_metadata), 0);
-                if (semid == -1 || shmid == -1) {
+                if (shmid == -1) {
                     free(sem);
                     return SEM_FAILED;
                 }
@@ -168,41 +242,24 @@ sem_open(const char *name, int oflag, ...)
             return SEM_FAILED;
         }
         
-        // create shared memory for metadata
-        shmid = shmget(key, sizeof(struct sem_metadata), 
-                       IPC_CREAT | IPC_EXCL | (mode & 0777));
-        if (shmid == -1) {
-            semctl(semid, 0, IPC_RMID);  // clean up semaphore
-            free(sem);
-            return SEM_FAILED;
-        }
-        
-        // initialize semaphore value
-        arg.val = value;
-        if (semctl(semid, 0, SETVAL, arg) == -1) {
-            semctl(semid, 0, IPC_RMID);
-            shmctl(shmid, IPC_RMID, NULL);
-            free(sem);
-            return SEM_FAILED;
-        }
-        
         // initialize metadata
         metadata = shmat(shmid, NULL, 0);
         if (metadata == (void *) -1) {
-            semctl(semid, 0, IPC_RMID);
             shmctl(shmid, IPC_RMID, NULL);
             free(sem);
             return SEM_FAILED;
         }
         
-        metadata->initialized = SEM_MAGIC;
         metadata->unlinked = 0;
         metadata->ref_count = 1;
         metadata->mode = mode;
         strncpy(metadata->name, name, NAME_MAX - 1);
         metadata->name[NAME_MAX - 1] = '\0';
+        metadata->value = value;
+        metadata->nwaiters = 0;
         
-        shmdt(metadata);
+        // publish the semaphore only once everything above is in place
+        __atomic_store_n(&metadata->initialized, SEM_MAGIC, __ATOMIC_RELEASE);
         
     } else {
         // existing semaphore
@@ -220,7 +277,7 @@ sem_open(const char *name, int oflag, ...)
             return SEM_FAILED;
         }
         
-        if (metadata->initialized != SEM_MAGIC) {
+        if (__atomic_load_n(&metadata->initialized, __ATOMIC_ACQUIRE) != SEM_MAGIC) {
             shmdt(metadata);
             free(sem);
             errno = EINVAL;
@@ -234,18 +291,18 @@ sem_open(const char *name, int oflag, ...)
             return SEM_FAILED;
         }
         
-        // increment reference count
-        metadata->ref_count++;
-        shmdt(metadata);
+        // increment reference count (other processes may be opening or closing it too)
+        __atomic_fetch_add(&metadata->ref_count, 1, __ATOMIC_SEQ_CST);
     }
     
     // initialize our semaphore structure
-    sem->semid = semid;
     sem->shmid = shmid;
+    sem->metadata = metadata;
     sem->name = strdup(name);
     sem->ref_count = 1;
     
     if (sem->name == NULL) {
+        shmdt(metadata);
         free(sem);
         errno = ENOMEM;
         return SEM_FAILED;
@@ -259,23 +316,16 @@ int
 sem_wait(sem_t *sem_ptr)
 {
     struct posix_sem *sem = (struct posix_sem *) sem_ptr;
-    struct sembuf sop;
     
     if (sem == NULL || sem == SEM_FAILED_INTERNAL) {
         errno = EINVAL;
         return -1;
     }
     
-    sop.sem_num = 0;
-    sop.sem_op = -1;    // decrement
-    sop.sem_flg = 0;    // block if necessary
+    if (try_decrement(sem->metadata))
+        return 0;   // fast path - no system call
     
-    while (semop(sem->semid, &sop, 1) == -1) {
-        if (errno != EINTR)
-            return -1;
-    }
-    
-    return 0;
+    return wait_slow(sem->metadata, NULL, 0);  // restarts after signal handlers
 }
 
 
@@ -283,20 +333,14 @@ int
 sem_trywait(sem_t *sem_ptr)
 {
     struct posix_sem *sem = (struct posix_sem *) sem_ptr;
-    struct sembuf sop;
     
     if (sem == NULL || sem == SEM_FAILED_INTERNAL) {
         errno = EINVAL;
         return -1;
     }
     
-    sop.sem_num = 0;
-    sop.sem_op = -1;        // decrement
-    sop.sem_flg = IPC_NOWAIT;  // don't block
-    
-    if (semop(sem->semid, &sop, 1) == -1) {
-        if (errno == EAGAIN)
-            errno = EAGAIN;  // POSIX expects EAGAIN for try operations
+    if (!try_decrement(sem->metadata)) {
+        errno = EAGAIN;  // POSIX expects EAGAIN for try operations
         return -1;
     }
     
@@ -308,119 +352,34 @@ int
 sem_timedwait(sem_t *sem_ptr, const struct timespec *abs_timeout)
 {
     struct posix_sem *sem = (struct posix_sem *) sem_ptr;
-    struct timespec current_time;
-    struct sembuf sop;
     
-    if (sem == NULL || sem == SEM_FAILED_INTERNAL || abs_timeout == NULL) {
+    if (sem == NULL || sem == SEM_FAILED_INTERNAL) {
         errno = EINVAL;
         return -1;
     }
     
-    if (abs_timeout->tv_nsec < 0 || abs_timeout->tv_nsec >= 1000000000) {
+    // like sem_wait() if the semaphore is available - POSIX doesn't even
+    // require the timeout to be valid then
+    if (try_decrement(sem->metadata))
+        return 0;
+    
+    if (abs_timeout == NULL || abs_timeout->tv_nsec < 0 || abs_timeout->tv_nsec >= 1000000000) {
         errno = EINVAL;
         return -1;
     }
     
-    // get current time
-    if (clock_gettime(CLOCK_REALTIME, &current_time) == -1)
-        return -1;
-    
-    // check if timeout has already passed
-    if (current_time.tv_sec > abs_timeout->tv_sec ||
-        (current_time.tv_sec == abs_timeout->tv_sec && 
-         current_time.tv_nsec >= abs_timeout->tv_nsec)) {
+    // a deadline before the epoch has passed; the kernel would reject it
+    // with EINVAL rather than time out, so answer as glibc does
+    if (abs_timeout->tv_sec < 0) {
         errno = ETIMEDOUT;
         return -1;
     }
     
-    // try non-blocking first
-    sop.sem_num = 0;
-    sop.sem_op = -1;
-    sop.sem_flg = IPC_NOWAIT;
-    
-    if (semop(sem->semid, &sop, 1) == 0)
-        return 0;  // success
-    
-    if (errno != EAGAIN)
-        return -1;  // real error
-    
-    // need to wait with timeout - System V semaphores don't support timeouts natively
-    // we use a signal-based approach for better efficiency
-    
-    struct timespec remaining_time;
-    remaining_time.tv_sec = abs_timeout->tv_sec - current_time.tv_sec;
-    remaining_time.tv_nsec = abs_timeout->tv_nsec - current_time.tv_nsec;
-    
-    if (remaining_time.tv_nsec < 0) {
-        remaining_time.tv_sec--;
-        remaining_time.tv_nsec += 1000000000;
-    }
-    
-    // set up alarm for timeout
-    struct sigaction old_action, new_action;
-    sigset_t old_mask, new_mask;
-    
-    // block SIGALRM initially
-    sigemptyset(&new_mask);
-    sigaddset(&new_mask, SIGALRM);
-    sigprocmask(SIG_BLOCK, &new_mask, &old_mask);
-    
-    // set up dummy signal handler - we don't need to do anything in it
-    // but we need a real handler (not SIG_IGN) for the signal to interrupt semop()
-    new_action.sa_handler = dummy_alarm_handler;
-    sigemptyset(&new_action.sa_mask);
-    new_action.sa_flags = 0;
-    
-    if (sigaction(SIGALRM, &new_action, &old_action) == -1) {
-        sigprocmask(SIG_SETMASK, &old_mask, NULL);
-        return -1;
-    }
-    
-    // set alarm
-    alarm(remaining_time.tv_sec + (remaining_time.tv_nsec > 0 ? 1 : 0));
-    
-    // unblock SIGALRM so it can interrupt semop()
-    sigprocmask(SIG_SETMASK, &old_mask, NULL);
-    
-    // try blocking semop - it will be interrupted by SIGALRM
-    sop.sem_flg = 0;  // blocking operation
-    int result = semop(sem->semid, &sop, 1);
-    int saved_errno = errno;
-    
-    // clean up alarm and signal handler
-    alarm(0);
-    sigaction(SIGALRM, &old_action, NULL);
-    // signal mask already restored above
-    
-    if (result == 0) {
-        return 0;  // success
-    }
-    
-    if (saved_errno == EINTR) {
-        // interrupted by alarm - check if timeout expired
-        if (clock_gettime(CLOCK_REALTIME, &current_time) == -1)
-            return -1;
-            
-        if (current_time.tv_sec > abs_timeout->tv_sec ||
-            (current_time.tv_sec == abs_timeout->tv_sec && 
-             current_time.tv_nsec >= abs_timeout->tv_nsec)) {
-            errno = ETIMEDOUT;
-            return -1;
-        }
-        
-        // interrupted but timeout not reached - try once more non-blocking
-        sop.sem_flg = IPC_NOWAIT;
-        if (semop(sem->semid, &sop, 1) == 0)
-            return 0;
-            
-        if (errno == EAGAIN) {
-            errno = ETIMEDOUT;  // close enough to timeout
-        }
-        return -1;
-    }
-    
-    errno = saved_errno;
-    return -1;
+    // the kernel checks the deadline against CLOCK_REALTIME itself (a
+    // deadline that already passed fails at once with ETIMEDOUT), and keeps
+    // to it if the clock is set while we sleep. Signal handlers interrupt the
+    // wait with EINTR, as POSIX specifies for sem_timedwait()
+    return wait_slow(sem->metadata, abs_timeout, 1);
 }
 
 /* Implementation of sem_post() */
@@ -428,18 +387,28 @@ int
 sem_post(sem_t *sem_ptr)
 {
     struct posix_sem *sem = (struct posix_sem *) sem_ptr;
-    struct sembuf sop;
+    struct sem_metadata *metadata;
     
     if (sem == NULL || sem == SEM_FAILED_INTERNAL) {
         errno = EINVAL;
         return -1;
     }
     
-    sop.sem_num = 0;
-    sop.sem_op = 1;     // increment
-    sop.sem_flg = 0;
+    metadata = sem->metadata;
+    int value = __atomic_load_n(&metadata->value, __ATOMIC_RELAXED);
+    do {
+        if (value == SEM_VALUE_MAX) {
+            errno = EOVERFLOW;
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&metadata->value, &value, value + 1, 1,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    
+    // only a system call if somebody waits (see wait_slow())
+    if (__atomic_load_n(&metadata->nwaiters, __ATOMIC_SEQ_CST) > 0)
+        futex_wake(&metadata->value, 1);
     
-    return semop(sem->semid, &sop, 1);
+    return 0;
 }
 
 
@@ -455,19 +424,14 @@ sem_close(sem_t *sem_ptr)
     }
     
     // decrement reference count in shared memory
-    metadata = shmat(sem->shmid, NULL, 0);
-    if (metadata != (void *) -1) {
-        metadata->ref_count--;
-        
-        // if this was the last reference and semaphore was unlinked,
+    metadata = sem->metadata;
+    if (__atomic_sub_fetch(&metadata->ref_count, 1, __ATOMIC_SEQ_CST) == 0 && metadata->unlinked) {
+        // this was the last reference and semaphore was unlinked,
         // clean up resources
-        if (metadata->ref_count == 0 && metadata->unlinked) {
-            shmdt(metadata);
-            semctl(sem->semid, 0, IPC_RMID);
-            shmctl(sem->shmid, IPC_RMID, NULL);
-        } else {
-            shmdt(metadata);
-        }
+        shmdt(metadata);
+        shmctl(sem->shmid, IPC_RMID, NULL);
+    } else {
+        shmdt(metadata);
     }
     
     // free our local resources
@@ -482,7 +446,7 @@ int
 sem_unlink(const char *name)
 {
     key_t key;
-    int semid, shmid;
+    int shmid;
     struct sem_metadata *metadata;
     
     if (name == NULL || name[0] != '/') {
@@ -501,10 +465,9 @@ sem_unlink(const char *name)
     key = name_to_key(name);
     
     // try to get existing semaphore
-    semid = semget(key, 1, 0);
     shmid = shmget(key, sizeof(struct sem_metadata), 0);
     
-    if (semid == -1 || shmid == -1) {
+    if (shmid == -1) {
         errno = ENOENT;
         return -1;
     }
@@ -523,9 +486,8 @@ sem_unlink(const char *name)
     metadata->unlinked = 1;
     
     // if no processes have it open, clean up immediately
-    if (metadata->ref_count == 0) {
+    if (__atomic_load_n(&metadata->ref_count, __ATOMIC_SEQ_CST) == 0) {
         shmdt(metadata);
-        semctl(semid, 0, IPC_RMID);
         shmctl(shmid, IPC_RMID, NULL);
     } else {
         shmdt(metadata);
@@ -545,9 +507,6 @@ sem_getvalue(sem_t *sem_ptr, int *sval)
         return -1;
     }
     
-    *sval = semctl(sem->semid, 0, GETVAL);
-    if (*sval == -1)
-        return -1;
-        
+    *sval = __atomic_load_n(&sem->metadata->value, __ATOMIC_RELAXED);
     return 0;
 }
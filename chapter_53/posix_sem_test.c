@@ -247,6 +247,48 @@ main(int argc, char *argv[])
         printf("SUCCESS: sem_timedwait() succeeded when semaphore available\n");
     }
     
+    // Test a sub-second timeout - it must not be rounded up to whole seconds,
+    // nor disturb a timer the caller set with alarm()
+    alarm(100);
+    if (clock_gettime(CLOCK_REALTIME, &timeout) == -1) {
+        perror("clock_gettime");
+        exit(EXIT_FAILURE);
+    }
+    struct timespec end_ts;
+    timeout.tv_nsec += 100000000;  // 100 ms timeout
+    if (timeout.tv_nsec >= 1000000000) {
+        timeout.tv_sec++;
+        timeout.tv_nsec -= 1000000000;
+    }
+
+    if (sem_timedwait(sem, &timeout) == -1 && errno == ETIMEDOUT) {
+        clock_gettime(CLOCK_REALTIME, &end_ts);
+        long late_ms = ((end_ts.tv_sec - timeout.tv_sec) * 1000000000L +
+                        (end_ts.tv_nsec - timeout.tv_nsec)) / 1000000;
+        if (late_ms >= 0 && late_ms < 50) {
+            printf("SUCCESS: 100ms sem_timedwait() timed out %ld ms after the deadline\n", late_ms);
+        } else {
+            printf("FAILED: 100ms sem_timedwait() timed out %ld ms after the deadline\n", late_ms);
+        }
+    } else {
+        perror("FAILED: 100ms sem_timedwait() should have timed out");
+    }
+
+    if (alarm(0) > 0) {
+        printf("SUCCESS: sem_timedwait() left the caller's alarm() timer alone\n");
+    } else {
+        printf("FAILED: sem_timedwait() cancelled the caller's alarm() timer\n");
+    }
+
+    // A deadline before the epoch has passed already: it must time out at
+    // once, not be retried
+    struct timespec before_epoch = { -1, 0 };
+    if (sem_timedwait(sem, &before_epoch) == -1 && errno == ETIMEDOUT) {
+        printf("SUCCESS: sem_timedwait() with a negative deadline timed out at once\n");
+    } else {
+        perror("FAILED: sem_timedwait() with a negative deadline should have timed out");
+    }
+
     // Restore semaphore to available state
     if (sem_post(sem) == -1) {
         perror("sem_post restore");
@@ -0,0 +1,102 @@
+/* pthread_xfr_spsc.c
+
+   Like pthread_xfr.c, but the threads exchange data through a lock-free
+   ring of slots (spsc_queue.c) instead of one buffer guarded by a pair of
+   semaphores, so the writer can run ahead of the reader, and neither makes
+   a system call unless the ring is full or empty.
+
+        $ ./pthread_xfr_spsc [num-slots [slot-size]] < infile > outfile
+*/
+#include "tlpi_hdr.h"
+#include "pthread_xfr.h"
+#include "spsc_queue.h"
+
+#define DEFAULT_NUM_SLOTS 16
+
+static SpscQueue queue;
+
+
+/* Writer thread: reads from stdin into the queue's slots */
+static void *
+spsc_writer_thread(void *arg)
+{
+    int bytes = 0, xfrs = 0, cnt;
+
+    do {
+        char *buf = spsc_write_slot(&queue);     /* Wait for a free slot */
+
+        cnt = read(STDIN_FILENO, buf, queue.slot_size);
+        if (cnt == -1)
+            errExit("read");
+
+        bytes += cnt;
+        xfrs++;
+
+        spsc_commit(&queue, cnt);               /* 0 tells the reader we're done */
+    } while (cnt != 0);
+
+    fprintf(stderr, "Writer: sent %d bytes (%d xfrs, slept %ld times)\n", bytes, xfrs,
+            queue.producer_waits);
+    return NULL;
+}
+
+
+/* Reader thread: writes the queue's slots to stdout */
+static void *
+spsc_reader_thread(void *arg)
+{
+    int bytes = 0, xfrs = 0, cnt;
+
+    for (;;) {
+        char *buf = spsc_read_slot(&queue, &cnt); /* Wait for a filled slot */
+
+        if (cnt == 0)                           /* Writer encountered EOF */
+            break;
+
+        bytes += cnt;
+        xfrs++;
+
+        if (write(STDOUT_FILENO, buf, cnt) != cnt)
+            fatal("partial/failed write");
+
+        spsc_release(&queue);                   /* Hand the slot back */
+    }
+
+    fprintf(stderr, "Reader: received %d bytes (%d xfrs, slept %ld times)\n", bytes, xfrs,
+            queue.consumer_waits);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    pthread_t writer_tid, reader_tid;
+    int s;
+
+    if (argc > 3 || (argc > 1 && strcmp(argv[1], "--help") == 0))
+        usageErr("%s [num-slots [slot-size]] < infile > outfile\n", argv[0]);
+
+    if (spsc_init(&queue, (argc > 1) ? getInt(argv[1], GN_GT_0, "num-slots") : DEFAULT_NUM_SLOTS,
+                  (argc > 2) ? getLong(argv[2], GN_GT_0, "slot-size") : BUF_SIZE,
+                  -1) == -1)
+        errExit("spsc_init");
+
+    s = pthread_create(&writer_tid, NULL, spsc_writer_thread, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_create writer");
+
+    s = pthread_create(&reader_tid, NULL, spsc_reader_thread, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_create reader");
+
+    s = pthread_join(writer_tid, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_join writer");
+
+    s = pthread_join(reader_tid, NULL);
+    if (s != 0)
+        errExitEN(s, "pthread_join reader");
+
+    spsc_destroy(&queue);
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,383 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+#include "latency_hist.h"       // from ../chapter_43
+
+// Contended semaphores: N processes, each pinned to a CPU, hammering the same semaphores.
+//
+// * pingpong - the processes form a ring, and a single token goes around it: process i waits on semaphore i
+//   and posts semaphore i + 1. Every handoff has to wake a sleeping process, so this measures wake-up latency:
+//   the time from the sem_post() to the moment the woken process runs
+// * mutex - all processes take turns on one semaphore with initial value 1, holding it for a short critical
+//   section. This measures how long acquiring it takes, and how many acquisitions per second get through
+//
+// The same source is built against each of the semaphore implementations (see the Makefile):
+// sem_contention_glibc     glibc's named POSIX semaphores
+// sem_contention_impl      posix_sem.c (Exercise 53.3)
+// sem_contention_sysv      System V semaphores
+// sem_contention_npipe     ../chapter_47/npipe_sem.c, the FIFO based semaphore of Exercise 47.6
+//
+// Latencies go into the histogram of ../chapter_43/latency_hist.c.
+
+#define MAX_PROCS 64
+
+#if defined(USE_SYSV_SEM)
+
+#include <sys/sem.h>
+#include "semun.h"
+#define BACKEND_NAME "System V semaphores"
+
+static int semId;
+
+static void
+bsem_create(int nsems, int first_value)
+{
+    union semun arg;
+
+    semId = semget(IPC_PRIVATE, nsems, IPC_CREAT | S_IRUSR | S_IWUSR);
+    if (semId == -1)
+        errExit("semget");
+    for (int i = 0; i < nsems; i++) {
+        arg.val = i == 0 ? first_value : 0;
+        if (semctl(semId, i, SETVAL, arg) == -1)
+            errExit("semctl SETVAL");
+    }
+}
+
+static void
+bsem_op(int i, int op)
+{
+    struct sembuf sop = { .sem_num = i, .sem_op = op, .sem_flg = 0 };
+    while (semop(semId, &sop, 1) == -1)
+        if (errno != EINTR)
+            errExit("semop");
+}
+
+static void bsem_wait(int i) { bsem_op(i, -1); }
+static void bsem_post(int i) { bsem_op(i, 1); }
+
+static void
+bsem_remove(int nsems)
+{
+    (void) nsems;
+    if (semctl(semId, 0, IPC_RMID) == -1)
+        errExit("semctl IPC_RMID");
+}
+
+#elif defined(USE_NPIPE_SEM)
+
+#include "npipe_sem.h"
+#define BACKEND_NAME "FIFO semaphores (npipe_sem.c)"
+
+static npipe_sem_t sems[MAX_PROCS];
+static char paths[MAX_PROCS][64];
+
+static void
+bsem_create(int nsems, int first_value)
+{
+    for (int i = 0; i < nsems; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "/tmp/sem_contention_%ld_%d", (long) getpid(), i);
+        unlink(paths[i]); // a leftover FIFO could still hold tokens
+        if (sem_init(&sems[i], paths[i]) == -1)
+            fatal("sem_init %s", paths[i]);
+        // sem_init() leaves one token in the FIFO
+        if ((i != 0 || first_value == 0) && sem_try_reserve(&sems[i]) != 0)
+            fatal("draining %s", paths[i]);
+    }
+}
+
+static void bsem_wait(int i) { sem_reserve(&sems[i]); }
+static void bsem_post(int i) { sem_release(&sems[i]); }
+
+static void
+bsem_remove(int nsems)
+{
+    for (int i = 0; i < nsems; i++) {
+        sem_destroy(&sems[i]);
+        unlink(paths[i]);
+    }
+}
+
+#else
+
+#ifdef USE_POSIX_SEM_IMPL
+#include "posix_sem.h"
+#define BACKEND_NAME "posix_sem.c"
+#else
+#include <semaphore.h>
+#define BACKEND_NAME "glibc sem_t"
+#endif
+
+static sem_t *sems[MAX_PROCS];
+static char names[MAX_PROCS][64];
+
+static void
+bsem_create(int nsems, int first_value)
+{
+    // opened before fork(), so every process uses the same handles
+    for (int i = 0; i < nsems; i++) {
+        snprintf(names[i], sizeof(names[i]), "/sem_cont_%ld_%d", (long) getpid(), i);
+        sems[i] = sem_open(names[i], O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, i == 0 ? first_value : 0);
+        if (sems[i] == SEM_FAILED)
+            errExit("sem_open %s", names[i]);
+    }
+}
+
+static void
+bsem_wait(int i)
+{
+    while (sem_wait(sems[i]) == -1)
+        if (errno != EINTR)
+            errExit("sem_wait");
+}
+
+static void
+bsem_post(int i)
+{
+    if (sem_post(sems[i]) == -1)
+        errExit("sem_post");
+}
+
+static void
+bsem_remove(int nsems)
+{
+    for (int i = 0; i < nsems; i++) {
+        sem_close(sems[i]);
+        sem_unlink(names[i]);
+    }
+}
+
+#endif
+
+enum { PINGPONG, MUTEX, NUM_PATTERNS };
+static const char *pattern_names[] = { "pingpong", "mutex" };
+
+typedef struct {
+    long ops;
+    long start_ns, end_ns;
+    struct latency_hist hist;
+} ProcStats;
+
+// shared by all the processes of a run
+typedef struct {
+    long counter;               // mutex: incremented while holding the semaphore
+    long posted_ns[MAX_PROCS];  // pingpong: when semaphore i was last posted
+    ProcStats stats[MAX_PROCS];
+} Shared;
+
+static Shared *shared;
+static long iterations = 100000;
+static long cs_ns = 0;
+static int pin = 1;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-i iterations] [-p pingpong|mutex] [-c cs-ns] [-u] num-procs...\n", progName);
+    fprintf(stderr, "  -i iterations: handoffs/acquisitions per process (default 100000)\n");
+    fprintf(stderr, "  -p pattern: run only this pattern (default both)\n");
+    fprintf(stderr, "  -c cs-ns: mutex critical section length, busy waiting (default 0)\n");
+    fprintf(stderr, "  -u: don't pin the processes to CPUs\n");
+    fprintf(stderr, "  num-procs: process counts to run with (default 2 4 8)\n");
+    exit(EXIT_FAILURE);
+}
+
+static long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts); // the same clock in every process
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// pin the calling process to the n-th CPU it may run on (wrapping around)
+static void
+pin_to_cpu(int n)
+{
+    cpu_set_t allowed, set;
+    int cpus[CPU_SETSIZE], ncpus = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        errExit("sched_getaffinity");
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[ncpus++] = cpu;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpus[n % ncpus], &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1)
+        errExit("sched_setaffinity");
+}
+
+static void
+record(ProcStats *st, long ns)
+{
+    hist_record(&st->hist, ns < 0 ? 0 : ns);
+    st->ops++;
+}
+
+static void
+run_pingpong(int id, int nprocs, ProcStats *st)
+{
+    int next = (id + 1) % nprocs;
+
+    for (long i = 0; i < iterations; i++) {
+        bsem_wait(id);
+        long now = now_ns();
+        if (id != 0 || i != 0) // nobody posted the initial token
+            record(st, now - shared->posted_ns[id]);
+        shared->posted_ns[next] = now_ns(); // published by the post
+        bsem_post(next);
+    }
+    // process 0 got the token first, so the last one it passes on is still in flight - take it back
+    if (id == 0)
+        bsem_wait(id);
+}
+
+static void
+run_mutex(int id, ProcStats *st)
+{
+    (void) id;
+    for (long i = 0; i < iterations; i++) {
+        long start = now_ns();
+        bsem_wait(0);
+        record(st, now_ns() - start);
+
+        shared->counter++; // a lost update here means the semaphore isn't exclusive
+        if (cs_ns > 0)
+            for (long until = now_ns() + cs_ns; now_ns() < until; )
+                ;
+
+        bsem_post(0);
+    }
+}
+
+static void
+run(int pattern, int nprocs)
+{
+    int start_pipe[2];
+
+    memset(shared, 0, sizeof(*shared));
+    bsem_create(pattern == PINGPONG ? nprocs : 1, 1);
+
+    // the children start together when the parent closes the pipe's write end
+    if (pipe(start_pipe) == -1)
+        errExit("pipe");
+
+    for (int id = 0; id < nprocs; id++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0: {
+            char dummy;
+            close(start_pipe[1]);
+            if (pin)
+                pin_to_cpu(id);
+            if (read(start_pipe[0], &dummy, 1) != 0)
+                fatal("start pipe");
+
+            ProcStats *st = &shared->stats[id];
+            hist_init(&st->hist);
+            st->start_ns = now_ns();
+            if (pattern == PINGPONG)
+                run_pingpong(id, nprocs, st);
+            else
+                run_mutex(id, st);
+            st->end_ns = now_ns();
+            _exit(EXIT_SUCCESS);
+        }
+        default:
+            break;
+        }
+    }
+
+    close(start_pipe[0]);
+    close(start_pipe[1]);
+    for (int id = 0; id < nprocs; id++) {
+        int status;
+        if (wait(&status) == -1)
+            errExit("wait");
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("a child failed");
+    }
+    bsem_remove(pattern == PINGPONG ? nprocs : 1);
+
+    // each process timed itself; the run goes from the first start to the last end
+    static struct latency_hist hist;
+    long ops = 0, start = shared->stats[0].start_ns, end = shared->stats[0].end_ns;
+    hist_init(&hist);
+    for (int id = 0; id < nprocs; id++) {
+        ProcStats *st = &shared->stats[id];
+        ops += st->ops;
+        start = st->start_ns < start ? st->start_ns : start;
+        end = st->end_ns > end ? st->end_ns : end;
+        hist_merge(&hist, &st->hist);
+    }
+
+    double secs = (end - start) / 1e9;
+    printf("| %-8s | %5d | %9ld | %8.3f | %10.0f | %8lld | %8lld | %8lld | %10lld | %10lld |",
+           pattern_names[pattern], nprocs, ops, secs, ops / secs,
+           hist_percentile(&hist, 0.5), hist_percentile(&hist, 0.9), hist_percentile(&hist, 0.99),
+           hist_percentile(&hist, 0.999), hist.max);
+    if (pattern == MUTEX && shared->counter != nprocs * iterations)
+        printf(" LOST UPDATES: counter %ld, expected %ld", shared->counter, nprocs * iterations);
+    printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    int patterns[NUM_PATTERNS] = { 1, 1 };
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:p:c:u")) != -1) {
+        switch (opt) {
+        case 'i': iterations = getLong(optarg, GN_GT_0, "iterations"); break;
+        case 'c': cs_ns = getLong(optarg, GN_NONNEG, "cs-ns"); break;
+        case 'u': pin = 0; break;
+        case 'p':
+            if (strcmp(optarg, "pingpong") == 0)
+                patterns[MUTEX] = 0;
+            else if (strcmp(optarg, "mutex") == 0)
+                patterns[PINGPONG] = 0;
+            else
+                usageError(argv[0]);
+            break;
+        default: usageError(argv[0]);
+        }
+    }
+
+    int default_procs[] = { 2, 4, 8 };
+    int num_counts = optind < argc ? argc - optind : 3;
+    int proc_counts[num_counts];
+    for (int i = 0; i < num_counts; i++) {
+        proc_counts[i] = optind < argc ? getInt(argv[optind + i], GN_GT_0, "num-procs") : default_procs[i];
+        if (proc_counts[i] > MAX_PROCS)
+            usageError(argv[0]);
+    }
+
+    shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+        errExit("mmap");
+
+    printf("%s: %s, %ld iterations per process, critical section %ld ns, %s, %ld CPUs\n\n", argv[0],
+           BACKEND_NAME, iterations, cs_ns, pin ? "pinned" : "not pinned", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| Pattern  | Procs |       Ops | Time (s) |      Ops/s | p50 (ns) | p90 (ns) | p99 (ns) | p99.9 (ns) |   max (ns) |\n");
+    printf("|----------|-------|-----------|----------|------------|----------|----------|----------|------------|------------|\n");
+
+    for (int p = 0; p < NUM_PATTERNS; p++)
+        for (int i = 0; i < num_counts; i++)
+            if (patterns[p]) {
+                if (p == PINGPONG && proc_counts[i] < 2)
+                    continue; // a ring needs two processes
+                run(p, proc_counts[i]);
+                fflush(stdout);
+            }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+#include "spsc_queue.h"
+
+// Throughput of moving blocks between two threads: pthread_xfr.c's one buffer handed back and forth with two
+// semaphores, against the SPSC queue of spsc_queue.c (with and without spinning before sleeping).
+//
+// Everything stays in memory: the producer copies blocks from a source buffer into the slots, and the consumer
+// checksums them, so the numbers are about the hand-off and not about read()/write(). Both threads are pinned,
+// either to the same CPU or to two different ones.
+
+#define SRC_SIZE (1 << 20)
+
+typedef struct {
+    size_t slot_size;
+    long total;                 // bytes to move
+    int cpu;
+    // results
+    unsigned long sum;
+    long start_ns, end_ns;
+} Side;
+
+static char *src;
+
+// lock-step transfer, as in pthread_xfr.c
+static struct {
+    int cnt;
+    char *buf;
+} shared_buffer;
+static sem_t write_sem, read_sem;
+
+static SpscQueue queue;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m MiB] [-n num-slots] [-s spin] [slot-size...]\n", progName);
+    fprintf(stderr, "  -m MiB: data to move per run (default 256)\n");
+    fprintf(stderr, "  -n num-slots: slots in the SPSC queue (default 16)\n");
+    fprintf(stderr, "  -s spin: checks before sleeping, for the spinning queue (default %d)\n", SPSC_DEFAULT_SPIN);
+    fprintf(stderr, "  slot-size: block sizes to run with (default 64 256 1024 4096 16384 65536)\n");
+    exit(EXIT_FAILURE);
+}
+
+static long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void
+pin_self(int cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int s = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (s != 0)
+        errExitEN(s, "pthread_setaffinity_np");
+}
+
+static unsigned long
+checksum(const char *buf, int cnt)
+{
+    unsigned long sum = 0, w;
+    int i;
+    for (i = 0; i + 8 <= cnt; i += 8) {
+        memcpy(&w, buf + i, 8);
+        sum += w;
+    }
+    for (; i < cnt; i++)
+        sum += (unsigned char) buf[i];
+    return sum;
+}
+
+// the next block of the source, wrapping around
+static int
+fill(char *buf, Side *side, long sent)
+{
+    long left = side->total - sent;
+    int cnt = left < (long) side->slot_size ? left : (long) side->slot_size;
+    long off = sent % SRC_SIZE;
+    if (off + cnt > SRC_SIZE)
+        off = 0;
+    memcpy(buf, src + off, cnt);
+    side->sum += checksum(buf, cnt);
+    return cnt;
+}
+
+static void *
+sem_producer(void *arg)
+{
+    Side *side = arg;
+    pin_self(side->cpu);
+    side->start_ns = now_ns();
+    for (long sent = 0; ; ) {
+        if (sem_wait(&write_sem) == -1)
+            errExit("sem_wait");
+        shared_buffer.cnt = fill(shared_buffer.buf, side, sent);
+        sent += shared_buffer.cnt;
+        int cnt = shared_buffer.cnt;
+        if (sem_post(&read_sem) == -1)
+            errExit("sem_post");
+        if (cnt == 0)
+            break;
+    }
+    return NULL;
+}
+
+static void *
+sem_consumer(void *arg)
+{
+    Side *side = arg;
+    pin_self(side->cpu);
+    for (;;) {
+        if (sem_wait(&read_sem) == -1)
+            errExit("sem_wait");
+        if (shared_buffer.cnt == 0)
+            break;
+        side->sum += checksum(shared_buffer.buf, shared_buffer.cnt);
+        if (sem_post(&write_sem) == -1)
+            errExit("sem_post");
+    }
+    side->end_ns = now_ns();
+    return NULL;
+}
+
+static void *
+spsc_producer(void *arg)
+{
+    Side *side = arg;
+    pin_self(side->cpu);
+    side->start_ns = now_ns();
+    for (long sent = 0; ; ) {
+        char *buf = spsc_write_slot(&queue);
+        int cnt = fill(buf, side, sent);
+        sent += cnt;
+        spsc_commit(&queue, cnt);
+        if (cnt == 0)
+            break;
+    }
+    return NULL;
+}
+
+static void *
+spsc_consumer(void *arg)
+{
+    Side *side = arg;
+    int cnt;
+    pin_self(side->cpu);
+    for (;;) {
+        char *buf = spsc_read_slot(&queue, &cnt);
+        if (cnt == 0)
+            break;
+        side->sum += checksum(buf, cnt);
+        spsc_release(&queue);
+    }
+    side->end_ns = now_ns();
+    return NULL;
+}
+
+// one transfer; returns MB/s
+static double
+run(void *(*producer)(void *), void *(*consumer)(void *), size_t slot_size, long total, int cpu1, int cpu2)
+{
+    Side p = { .slot_size = slot_size, .total = total, .cpu = cpu1 };
+    Side c = { .slot_size = slot_size, .total = total, .cpu = cpu2 };
+    pthread_t pt, ct;
+
+    int s = pthread_create(&pt, NULL, producer, &p);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+    s = pthread_create(&ct, NULL, consumer, &c);
+    if (s != 0)
+        errExitEN(s, "pthread_create");
+    pthread_join(pt, NULL);
+    pthread_join(ct, NULL);
+
+    if (p.sum != c.sum)
+        fatal("checksum mismatch: sent %lx, received %lx", p.sum, c.sum);
+    return total / 1e6 / ((c.end_ns - p.start_ns) / 1e9);
+}
+
+int
+main(int argc, char *argv[])
+{
+    long total = 256L << 20;
+    int num_slots = 16, spin = SPSC_DEFAULT_SPIN, opt;
+
+    while ((opt = getopt(argc, argv, "m:n:s:")) != -1) {
+        switch (opt) {
+        case 'm': total = getLong(optarg, GN_GT_0, "MiB") << 20; break;
+        case 'n': num_slots = getInt(optarg, GN_GT_0, "num-slots"); break;
+        case 's': spin = getInt(optarg, GN_NONNEG, "spin"); break;
+        default: usageError(argv[0]);
+        }
+    }
+
+    long default_sizes[] = { 64, 256, 1024, 4096, 16384, 65536 };
+    int num_sizes = optind < argc ? argc - optind : 6;
+    long sizes[num_sizes];
+    for (int i = 0; i < num_sizes; i++) {
+        sizes[i] = optind < argc ? getLong(argv[optind + i], GN_GT_0, "slot-size") : default_sizes[i];
+        if (sizes[i] > SRC_SIZE)    // fill() copies each slot from one stretch of src
+            cmdLineErr("slot-size %ld is larger than %d\n", sizes[i], SRC_SIZE);
+    }
+
+    src = malloc(SRC_SIZE);
+    if (src == NULL)
+        errExit("malloc");
+    srandom(1);
+    for (int i = 0; i < SRC_SIZE; i++)
+        src[i] = random();
+
+    // the first two CPUs we may run on
+    cpu_set_t allowed;
+    int cpus[2], ncpus = 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1)
+        errExit("sched_getaffinity");
+    for (int cpu = 0; cpu < CPU_SETSIZE && ncpus < 2; cpu++)
+        if (CPU_ISSET(cpu, &allowed))
+            cpus[ncpus++] = cpu;
+
+    printf("%s: %ld MiB per run, %d slots, spin %d, %ld CPUs\n", argv[0], total >> 20, num_slots, spin,
+           sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (int placement = 0; placement < 2; placement++) {
+        int cpu1 = cpus[0], cpu2 = placement == 0 ? cpus[0] : cpus[1];
+        if (placement == 1 && ncpus < 2) {
+            printf("\nDifferent CPUs: skipped, only one CPU available\n");
+            break;
+        }
+
+        printf("\n%s (CPU %d and CPU %d)\n\n", placement == 0 ? "Same CPU" : "Different CPUs", cpu1, cpu2);
+        printf("| Slot size | Lock-step sem (MB/s) | SPSC spin (MB/s) |  Sleeps (P/C) | SPSC no spin (MB/s) |  Sleeps (P/C) |\n");
+        printf("|-----------|----------------------|------------------|---------------|---------------------|---------------|\n");
+
+        for (int i = 0; i < num_sizes; i++) {
+            shared_buffer.buf = malloc(sizes[i]);
+            if (shared_buffer.buf == NULL)
+                errExit("malloc");
+            if (sem_init(&write_sem, 0, 1) == -1 || sem_init(&read_sem, 0, 0) == -1)
+                errExit("sem_init");
+            double sem_mbs = run(sem_producer, sem_consumer, sizes[i], total, cpu1, cpu2);
+            sem_destroy(&write_sem);
+            sem_destroy(&read_sem);
+            free(shared_buffer.buf);
+
+            double spsc_mbs[2];
+            long waits[2][2];
+            for (int k = 0; k < 2; k++) {
+                if (spsc_init(&queue, num_slots, sizes[i], k == 0 ? spin : 0) == -1)
+                    errExit("spsc_init");
+                spsc_mbs[k] = run(spsc_producer, spsc_consumer, sizes[i], total, cpu1, cpu2);
+                waits[k][0] = queue.producer_waits;
+                waits[k][1] = queue.consumer_waits;
+                spsc_destroy(&queue);
+            }
+
+            char w0[32], w1[32];
+            snprintf(w0, sizeof(w0), "%ld/%ld", waits[0][0], waits[0][1]);
+            snprintf(w1, sizeof(w1), "%ld/%ld", waits[1][0], waits[1][1]);
+            printf("| %9ld | %20.1f | %16.1f | %13s | %19.1f | %13s |\n", sizes[i], sem_mbs, spsc_mbs[0], w0,
+                   spsc_mbs[1], w1);
+            fflush(stdout);
+        }
+    }
+
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,173 @@
+/* spsc_queue.c
+
+   Implementation of spsc_queue.h.
+
+   Sleeping follows the same pattern as the futex semaphores in posix_sem.c:
+   the sleeper sets its waiting flag before checking the queue a last time,
+   and the other thread moves its index before checking the flag (both
+   sequentially consistent), so either the sleeper sees the queue change or
+   the other thread sees the flag. FUTEX_WAIT only sleeps while the flag is
+   still set, so a wake-up that comes before the sleep isn't lost either.
+*/
+#define _GNU_SOURCE
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "spsc_queue.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define cpu_relax() __builtin_ia32_pause()
+#else
+#define cpu_relax() ((void) 0)
+#endif
+
+struct spsc_slot {
+    int cnt;                    /* Number of bytes used in 'buf'; 0 for EOF */
+    char buf[];
+};
+
+
+static void
+futex_wait(int *uaddr, int val)
+{
+    /* the queue is private to the process */
+    syscall(SYS_futex, uaddr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+
+static void
+futex_wake(int *uaddr)
+{
+    syscall(SYS_futex, uaddr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+
+static struct spsc_slot *
+slot_at(SpscQueue *q, unsigned long idx)
+{
+    return (struct spsc_slot *) (q->slots + (idx % q->num_slots) * q->stride);
+}
+
+
+/* Spin, then sleep, until 'other' (the other thread's index) is different
+   from 'not' - i.e. the queue is no longer full/empty. Returns the index */
+static unsigned long
+wait_for(SpscQueue *q, unsigned long *other, unsigned long not, int *waiting, long *waits)
+{
+    unsigned long idx;
+
+    for (int i = 0; i < q->spin; i++) {
+        idx = __atomic_load_n(other, __ATOMIC_ACQUIRE);
+        if (idx != not)
+            return idx;
+        cpu_relax();
+    }
+
+    for (;;) {
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        idx = __atomic_load_n(other, __ATOMIC_SEQ_CST);
+        if (idx != not) {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return idx;
+        }
+        (*waits)++;
+        futex_wait(waiting, 1);
+    }
+}
+
+
+/* Called after moving our index: wake the other thread if it sleeps */
+static void
+wake(int *waiting)
+{
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST) &&
+            __atomic_exchange_n(waiting, 0, __ATOMIC_SEQ_CST))
+        futex_wake(waiting);
+}
+
+
+int
+spsc_init(SpscQueue *q, unsigned int num_slots, size_t slot_size, int spin)
+{
+    if (num_slots == 0 || slot_size == 0 || spin < -1) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (spin == -1)
+        spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPSC_DEFAULT_SPIN : 0;
+
+    q->head = q->cached_tail = 0;
+    q->tail = q->cached_head = 0;
+    q->producer_waits = q->consumer_waits = 0;
+    q->producer_waiting = q->consumer_waiting = 0;
+    q->num_slots = num_slots;
+    q->slot_size = slot_size;
+    q->stride = (sizeof(struct spsc_slot) + slot_size + SPSC_CACHE_LINE - 1) &
+                ~(size_t) (SPSC_CACHE_LINE - 1);
+    q->spin = spin;
+
+    int s = posix_memalign((void **) &q->slots, SPSC_CACHE_LINE, num_slots * q->stride);
+    if (s != 0) {
+        errno = s;
+        return -1;
+    }
+    return 0;
+}
+
+
+void
+spsc_destroy(SpscQueue *q)
+{
+    free(q->slots);
+    q->slots = NULL;
+}
+
+
+void *
+spsc_write_slot(SpscQueue *q)
+{
+    /* only look at the consumer's index when the cached one says we're full */
+    if (q->head - q->cached_tail == q->num_slots) {
+        q->cached_tail = __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE);
+        if (q->head - q->cached_tail == q->num_slots)
+            q->cached_tail = wait_for(q, &q->tail, q->head - q->num_slots,
+                                      &q->producer_waiting, &q->producer_waits);
+    }
+    return slot_at(q, q->head)->buf;
+}
+
+
+void
+spsc_commit(SpscQueue *q, int cnt)
+{
+    slot_at(q, q->head)->cnt = cnt;
+    __atomic_store_n(&q->head, q->head + 1, __ATOMIC_SEQ_CST); /* publishes the slot */
+    wake(&q->consumer_waiting);
+}
+
+
+void *
+spsc_read_slot(SpscQueue *q, int *cnt)
+{
+    if (q->cached_head == q->tail) {
+        q->cached_head = __atomic_load_n(&q->head, __ATOMIC_ACQUIRE);
+        if (q->cached_head == q->tail)
+            q->cached_head = wait_for(q, &q->head, q->tail,
+                                      &q->consumer_waiting, &q->consumer_waits);
+    }
+
+    struct spsc_slot *slot = slot_at(q, q->tail);
+    *cnt = slot->cnt;
+    return slot->buf;
+}
+
+
+void
+spsc_release(SpscQueue *q)
+{
+    __atomic_store_n(&q->tail, q->tail + 1, __ATOMIC_SEQ_CST); /* hands the slot back */
+    wake(&q->producer_waiting);
+}
@@ -0,0 +1,68 @@
+/* spsc_queue.h
+
+   Lock-free single-producer/single-consumer queue of fixed size slots, for
+   moving blocks of data between two threads (see pthread_xfr_spsc.c).
+
+   The producer fills the slot at 'head' and the consumer empties the one at
+   'tail'. Each index is written by one thread only and lives on its own cache
+   line, next to the writer's cached copy of the other index, so in the common
+   case neither thread touches the other's cache line.
+
+   A thread that finds the queue full (producer) or empty (consumer) spins for
+   a while, then sleeps on a futex. The other thread makes the futex call only
+   if it sees the sleeper's waiting flag, so as long as nobody has to wait, no
+   system calls are made at all.
+
+   Usage:
+       producer:  buf = spsc_write_slot(q); ...fill up to slot_size bytes...; spsc_commit(q, cnt);
+       consumer:  buf = spsc_read_slot(q, &cnt); ...use cnt bytes...; spsc_release(q);
+*/
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stddef.h>
+
+#define SPSC_CACHE_LINE 64
+#define SPSC_DEFAULT_SPIN 200   /* Checks before going to sleep (a few us) */
+
+typedef struct {
+    /* Producer's cache line */
+    unsigned long head __attribute__((aligned(SPSC_CACHE_LINE)));
+                                /* Slots ever committed */
+    unsigned long cached_tail;  /* Producer's last look at 'tail' */
+    long producer_waits;        /* Times the producer slept */
+
+    /* Consumer's cache line */
+    unsigned long tail __attribute__((aligned(SPSC_CACHE_LINE)));
+                                /* Slots ever released */
+    unsigned long cached_head;  /* Consumer's last look at 'head' */
+    long consumer_waits;        /* Times the consumer slept */
+
+    /* Futex words; each is set by its sleeper and cleared by whoever wakes it */
+    int producer_waiting __attribute__((aligned(SPSC_CACHE_LINE)));
+    int consumer_waiting __attribute__((aligned(SPSC_CACHE_LINE)));
+
+    /* Read only after spsc_init() */
+    unsigned int num_slots __attribute__((aligned(SPSC_CACHE_LINE)));
+    size_t slot_size;
+    size_t stride;              /* Bytes from one slot to the next */
+    int spin;
+    char *slots;
+} SpscQueue;
+
+/* 'spin' is the number of checks before sleeping; -1 for SPSC_DEFAULT_SPIN if
+   more than one CPU is online, and 0 (sleep at once) otherwise - with one CPU
+   the other thread can't make progress while we spin.
+   Returns 0 on success, -1 with errno set on error */
+int spsc_init(SpscQueue *q, unsigned int num_slots, size_t slot_size, int spin);
+void spsc_destroy(SpscQueue *q);
+
+/* Producer */
+void *spsc_write_slot(SpscQueue *q);    /* Blocks while the queue is full */
+void spsc_commit(SpscQueue *q, int cnt);
+
+/* Consumer */
+void *spsc_read_slot(SpscQueue *q, int *cnt);   /* Blocks while the queue is empty */
+void spsc_release(SpscQueue *q);
+
+#endif
@@ -0,0 +1,155 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <fcntl.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+#ifdef USE_POSIX_SEM_IMPL
+#include "posix_sem.h"      // timedwait_accuracy_impl - our implementation (Exercise 53.3)
+#else
+#include <semaphore.h>
+#endif
+
+// How late does sem_timedwait() time out? Every thread waits on its own semaphore (which nobody posts) with
+// each of the timeouts in turn, and measures how long after the requested deadline the call returned.
+// All threads wait at the same time, so an implementation that keeps process wide timer state shows here.
+
+#define MAX_TIMEOUTS 16
+
+static long timeouts_us[MAX_TIMEOUTS] = { 50, 200, 1000, 5000, 20000, 100000 };
+static int num_timeouts = 6;
+static int iterations = 10;
+
+typedef struct {
+    int id;
+    long *overshoot_ns;  // [num_timeouts][iterations]
+    long errors;         // returns other than ETIMEDOUT
+} ThreadArg;
+
+static pthread_barrier_t barrier;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-t threads] [timeout-us...]\n", progName);
+    fprintf(stderr, "  -n iterations: waits per timeout and thread (default 10)\n");
+    fprintf(stderr, "  -t threads: threads waiting at the same time (default 1)\n");
+    fprintf(stderr, "  timeout-us: timeouts to measure, in microseconds (default 50 200 1000 5000 20000 100000)\n");
+    exit(EXIT_FAILURE);
+}
+
+static long
+ts_diff_ns(const struct timespec *a, const struct timespec *b)
+{
+    return (a->tv_sec - b->tv_sec) * 1000000000L + (a->tv_nsec - b->tv_nsec);
+}
+
+static int
+cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *) a, y = *(const long *) b;
+    return (x > y) - (x < y);
+}
+
+static void *
+waiter(void *arg)
+{
+    ThreadArg *ta = arg;
+    char name[64];
+
+    snprintf(name, sizeof(name), "/tw_acc_%ld_%d", (long) getpid(), ta->id);
+    sem_t *sem = sem_open(name, O_CREAT | O_EXCL, S_IRUSR | S_IWUSR, 0);
+    if (sem == SEM_FAILED)
+        errExit("sem_open");
+
+    for (int t = 0; t < num_timeouts; t++) {
+        pthread_barrier_wait(&barrier); // all threads wait with the same timeout at the same time
+        for (int i = 0; i < iterations; i++) {
+            struct timespec deadline, end;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += timeouts_us[t] * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+
+            int s = sem_timedwait(sem, &deadline);
+            clock_gettime(CLOCK_REALTIME, &end);
+            if (s == 0 || errno != ETIMEDOUT)
+                ta->errors++;
+            ta->overshoot_ns[t * iterations + i] = ts_diff_ns(&end, &deadline);
+        }
+    }
+
+    sem_close(sem);
+    sem_unlink(name);
+    return NULL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int num_threads = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+        switch (opt) {
+        case 'n': iterations = getInt(optarg, GN_GT_0, "iterations"); break;
+        case 't': num_threads = getInt(optarg, GN_GT_0, "threads"); break;
+        default: usageError(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        if (argc - optind > MAX_TIMEOUTS)
+            usageError(argv[0]);
+        for (num_timeouts = 0; optind < argc; optind++)
+            timeouts_us[num_timeouts++] = getLong(argv[optind], GN_GT_0, "timeout-us");
+    }
+
+    // a timer the program set for itself must survive the waits
+    alarm(1000);
+
+    ThreadArg *args = calloc(num_threads, sizeof(ThreadArg));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    if (args == NULL || threads == NULL)
+        errExit("calloc");
+    pthread_barrier_init(&barrier, NULL, num_threads);
+
+    for (int i = 0; i < num_threads; i++) {
+        args[i].id = i;
+        args[i].overshoot_ns = calloc(num_timeouts * iterations, sizeof(long));
+        if (args[i].overshoot_ns == NULL)
+            errExit("calloc");
+        if (pthread_create(&threads[i], NULL, waiter, &args[i]) != 0)
+            errExit("pthread_create");
+    }
+    for (int i = 0; i < num_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    unsigned int alarm_left = alarm(0);
+
+    printf("%s: %d iterations, %d threads, %ld CPUs\n\n", argv[0], iterations, num_threads,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| Timeout (us) | Min late (us) | Median late (us) | Max late (us) |\n");
+    printf("|--------------|---------------|------------------|---------------|\n");
+
+    long n = (long) num_threads * iterations;
+    long *all = malloc(n * sizeof(long));
+    if (all == NULL)
+        errExit("malloc");
+    long errors = 0;
+    for (int i = 0; i < num_threads; i++)
+        errors += args[i].errors;
+
+    for (int t = 0; t < num_timeouts; t++) {
+        for (int i = 0; i < num_threads; i++)
+            memcpy(all + (long) i * iterations, args[i].overshoot_ns + t * iterations, iterations * sizeof(long));
+        qsort(all, n, sizeof(long), cmp_long);
+        printf("| %12ld | %13.1f | %16.1f | %13.1f |\n", timeouts_us[t], all[0] / 1000.0,
+               all[n / 2] / 1000.0, all[n - 1] / 1000.0);
+    }
+
+    printf("\nWrong returns (success or an error other than ETIMEDOUT): %ld\n", errors);
+    printf("alarm() timer set before the waits: %s\n", alarm_left > 0 ? "still pending" : "LOST");
+
+    exit(EXIT_SUCCESS);
+}
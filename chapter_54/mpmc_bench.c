@@ -0,0 +1,448 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+#include "mpmc_queue.h"
+
+// Throughput of the shared memory MPMC queue (mpmc_queue.c) with P writer and C reader processes.
+//
+// Every writer sends -n records of 16 to -s bytes (the length varies from record to record) and every reader
+// checks each record it gets: who sent it, its sequence number and a checksum of its contents. At the end the
+// number and the sequence numbers of the records received from each writer must add up to what it sent. The
+// last writer to finish sends one empty record per reader to stop them.
+//
+// Finally two crash tests. In the first, one process dies holding a slot it's writing and another one holding a
+// slot it's reading, and then a few writers and readers use the queue as before. In the second, a writer and then
+// a reader die right after claiming a slot, before they move the shared position on, and their slots are taken
+// over before anybody else moves the position past them.
+//
+// -f puts the queue in a file instead of the POSIX shared memory object SHM_NAME (on a hugetlbfs mount, to get
+// huge pages), and -P has every process fault in the whole queue when it maps it. The page faults column counts
+// the faults of all the processes of a run, setup included.
+
+#define SHM_NAME "/mpmc_bench"
+#define MAX_PROCS 64
+#define MIN_RECORD 16
+#define SRC_SIZE (1 << 20)
+
+typedef struct {                // start of each record
+    uint32_t writer;
+    uint32_t seq;
+    uint64_t sum;               // of the rest of the record
+} RecordHdr;
+
+typedef struct {                // in memory shared by all the processes of a run
+    int writers_left;
+    long start_ns[MAX_PROCS * 2];
+    long end_ns[MAX_PROCS * 2];
+    // filled in by the readers
+    long received[MAX_PROCS];
+    unsigned long seq_sum[MAX_PROCS];
+    long bytes;
+    long bad_records;
+    long full_waits, empty_waits;
+} Results;
+
+static char *src;
+static Results *results;
+static size_t max_record = 256;
+static long num_records = 100000;
+static const char *queue_name = SHM_NAME;
+static int queue_flags = 0;
+
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-n records] [-s max-record] [-q capacity] [-f queue-file] [-P] [writers:readers...]\n",
+            progName);
+    fprintf(stderr, "  -n records: records sent by each writer (default 100000)\n");
+    fprintf(stderr, "  -s max-record: largest record, in bytes (%d to %d, default 256)\n", MIN_RECORD, SRC_SIZE - 1);
+    fprintf(stderr, "  -q capacity: records the queue holds (default 1024)\n");
+    fprintf(stderr, "  -f queue-file: put the queue in this file (default: POSIX shared memory %s)\n", SHM_NAME);
+    fprintf(stderr, "  -P: fault in the whole queue when mapping it\n");
+    fprintf(stderr, "  writers:readers: process counts, up to %d each (default 1:1 2:2 4:4 8:8 16:16 1:16 16:1)\n",
+            MAX_PROCS);
+    exit(EXIT_FAILURE);
+}
+
+static long
+now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static uint64_t
+checksum(const char *buf, size_t cnt)
+{
+    uint64_t sum = 0, w;
+    size_t i;
+    for (i = 0; i + 8 <= cnt; i += 8) {
+        memcpy(&w, buf + i, 8);
+        sum += w;
+    }
+    for (; i < cnt; i++)
+        sum += (unsigned char) buf[i];
+    return sum;
+}
+
+// length and contents of record 'seq' of writer 'w', fixed so that a reader can't tell it from any other
+static size_t
+record_len(uint32_t w, uint32_t seq)
+{
+    return MIN_RECORD + (w * 2654435761u + seq * 40503u) % (max_record - MIN_RECORD + 1);
+}
+
+// minor plus major page faults of the children we waited for so far
+static long
+children_faults(void)
+{
+    struct rusage ru;
+
+    if (getrusage(RUSAGE_CHILDREN, &ru) == -1)
+        errExit("getrusage");
+    return ru.ru_minflt + ru.ru_majflt;
+}
+
+static MpmcQueue *
+open_queue(void)
+{
+    MpmcQueue *q = mpmc_open(queue_name, queue_flags);
+    if (q == NULL)
+        errExit("mpmc_open");
+    return q;
+}
+
+static void
+writer(int id, int num_readers, int barrier_fd)
+{
+    MpmcQueue *q = open_queue();
+    MpmcSlotRef ref;
+    MpmcStats st;
+    char c;
+
+    read(barrier_fd, &c, 1);            // returns at EOF, when the parent lets everybody go
+    results->start_ns[id] = now_ns();
+
+    for (long i = 0; i < num_records; i++) {
+        size_t len = record_len(id, i);
+        char *buf = mpmc_push_begin(q, &ref);
+        RecordHdr *hdr = (RecordHdr *) buf;
+        long off = (i * 64) % (SRC_SIZE - max_record);
+        memcpy(buf + sizeof(RecordHdr), src + off, len - sizeof(RecordHdr));
+        hdr->writer = id;
+        hdr->seq = i;
+        hdr->sum = checksum(buf + sizeof(RecordHdr), len - sizeof(RecordHdr));
+        mpmc_push_commit(q, &ref, len);
+    }
+
+    if (__atomic_sub_fetch(&results->writers_left, 1, __ATOMIC_SEQ_CST) == 0)
+        for (int r = 0; r < num_readers; r++)
+            if (mpmc_push(q, NULL, 0) == -1)
+                errExit("mpmc_push");
+
+    results->end_ns[id] = now_ns();
+    mpmc_stats(q, &st);
+    __atomic_fetch_add(&results->full_waits, st.full_waits, __ATOMIC_RELAXED);
+    _exit(EXIT_SUCCESS);
+}
+
+static void
+reader(int id, int num_writers, int barrier_fd)
+{
+    MpmcQueue *q = open_queue();
+    MpmcSlotRef ref;
+    MpmcStats st;
+    long received[MAX_PROCS] = { 0 }, bytes = 0, bad = 0;
+    unsigned long seq_sum[MAX_PROCS] = { 0 };
+    size_t len;
+    char c;
+
+    read(barrier_fd, &c, 1);
+    results->start_ns[MAX_PROCS + id] = now_ns();
+
+    for (;;) {
+        char *buf = mpmc_pop_begin(q, &ref, &len);
+        if (len == 0) {
+            mpmc_pop_end(q, &ref);
+            break;
+        }
+        RecordHdr *hdr = (RecordHdr *) buf;
+        if (len < sizeof(RecordHdr) || hdr->writer >= (uint32_t) num_writers ||
+                len != record_len(hdr->writer, hdr->seq) ||
+                hdr->sum != checksum(buf + sizeof(RecordHdr), len - sizeof(RecordHdr))) {
+            bad++;
+        } else {
+            received[hdr->writer]++;
+            seq_sum[hdr->writer] += hdr->seq;
+        }
+        bytes += len;
+        mpmc_pop_end(q, &ref);
+    }
+
+    results->end_ns[MAX_PROCS + id] = now_ns();
+    for (int w = 0; w < num_writers; w++) {
+        __atomic_fetch_add(&results->received[w], received[w], __ATOMIC_RELAXED);
+        __atomic_fetch_add(&results->seq_sum[w], seq_sum[w], __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&results->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&results->bad_records, bad, __ATOMIC_RELAXED);
+    mpmc_stats(q, &st);
+    __atomic_fetch_add(&results->empty_waits, st.empty_waits, __ATOMIC_RELAXED);
+    _exit(EXIT_SUCCESS);
+}
+
+// P writers and C readers on the existing queue; returns the elapsed time in seconds
+static double
+run(int num_writers, int num_readers)
+{
+    int barrier[2];
+
+    memset(results, 0, sizeof(Results));
+    results->writers_left = num_writers;
+    if (pipe(barrier) == -1)
+        errExit("pipe");
+
+    for (int i = 0; i < num_writers + num_readers; i++) {
+        switch (fork()) {
+        case -1:
+            errExit("fork");
+        case 0:
+            close(barrier[1]);
+            if (i < num_writers)
+                writer(i, num_readers, barrier[0]);
+            else
+                reader(i - num_writers, num_writers, barrier[0]);
+        }
+    }
+    close(barrier[0]);
+    close(barrier[1]);                  // go
+
+    int status;
+    while (wait(&status) != -1)
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            fatal("a child failed");
+
+    long start = results->start_ns[0], end = results->end_ns[0];
+    for (int i = 0; i < MAX_PROCS * 2; i++) {
+        if (results->end_ns[i] == 0)
+            continue;
+        if (results->start_ns[i] < start)
+            start = results->start_ns[i];
+        if (results->end_ns[i] > end)
+            end = results->end_ns[i];
+    }
+
+    unsigned long expected_sum = (unsigned long) num_records * (num_records - 1) / 2;
+    for (int w = 0; w < num_writers; w++) {
+        if (results->received[w] != num_records || results->seq_sum[w] != expected_sum)
+            fatal("writer %d: %ld of %ld records received", w, results->received[w], num_records);
+    }
+    if (results->bad_records != 0)
+        fatal("%ld corrupted records", results->bad_records);
+
+    return (end - start) / 1e9;
+}
+
+// a child that claims a slot and exits without handing it on
+static void
+die_holding_slot(int reading)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        MpmcQueue *q = open_queue();
+        MpmcSlotRef ref;
+        size_t len;
+        if (reading)
+            mpmc_pop_begin(q, &ref, &len);
+        else
+            mpmc_push_begin(q, &ref);
+        _exit(EXIT_SUCCESS);
+    }
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+}
+
+static void
+die_now(void)
+{
+    _exit(EXIT_SUCCESS);
+}
+
+// a child that claims a slot and exits before it moves the shared position on
+static void
+die_before_moving_on(int reading)
+{
+    pid_t pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        MpmcQueue *q = open_queue();
+        MpmcSlotRef ref;
+        size_t len;
+        mpmc_claim_hook = die_now;
+        if (reading)
+            mpmc_pop_begin(q, &ref, &len);
+        else
+            mpmc_push_begin(q, &ref);
+        _exit(EXIT_FAILURE);
+    }
+    if (waitpid(pid, NULL, 0) == -1)
+        errExit("waitpid");
+}
+
+// a writer and then a reader die between claiming a slot and moving the position on, and their slots are taken
+// over before anybody else moves the position past them; the queue must go on working (capacity 16)
+static void
+crash_before_moving_on(MpmcQueue *q)
+{
+    char buf[max_record];
+    MpmcStats st;
+    int status;
+
+    // a reader takes over the dead writer's slot 0; then our push finds the slot past position 0
+    die_before_moving_on(0);
+    pid_t pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        MpmcQueue *rq = open_queue();
+        _exit(mpmc_pop(rq, buf) == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    do {
+        usleep(1000);
+        mpmc_stats(q, &st);
+    } while (st.lost_writes == 0);
+    if (mpmc_push(q, "w", 1) == -1)
+        errExit("mpmc_push");
+    if (waitpid(pid, &status, 0) == -1)
+        errExit("waitpid");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("the record after the dead writer's slot wasn't delivered");
+
+    // the reader of position 2 dies; a full lap later our push takes its slot over, and our pops find that slot
+    // past position 2
+    if (mpmc_push(q, "r", 1) == -1)
+        errExit("mpmc_push");
+    die_before_moving_on(1);
+    for (int i = 0; i < 16; i++)
+        if (mpmc_push(q, "x", 1) == -1)
+            errExit("mpmc_push");
+    for (int i = 0; i < 16; i++)
+        if (mpmc_pop(q, buf) != 1 || buf[0] != 'x')
+            fatal("record %d after the dead reader's slot wasn't delivered", i);
+
+    mpmc_stats(q, &st);
+    printf("Crash test: a writer and a reader died between claiming a slot and moving the position on: "
+           "all records delivered, lost records %lu/%lu (W/R)\n",
+           (unsigned long) st.lost_writes, (unsigned long) st.lost_reads);
+    if (st.lost_writes != 1 || st.lost_reads != 1)
+        fatal("the dead processes' slots weren't taken over");
+}
+
+int
+main(int argc, char *argv[])
+{
+    unsigned int capacity = 1024;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:q:f:P")) != -1) {
+        switch (opt) {
+        case 'n': num_records = getLong(optarg, GN_GT_0, "records"); break;
+        case 's': max_record = getLong(optarg, GN_GT_0, "max-record"); break;
+        case 'q': capacity = getInt(optarg, GN_GT_0, "capacity"); break;
+        case 'f': queue_name = optarg; break;
+        case 'P': queue_flags |= MPMC_POPULATE; break;
+        default: usageError(argv[0]);
+        }
+    }
+    if (max_record < MIN_RECORD || max_record >= SRC_SIZE)   // records are copied from one stretch of src
+        usageError(argv[0]);
+
+    const char *default_pairs[] = { "1:1", "2:2", "4:4", "8:8", "16:16", "1:16", "16:1" };
+    int num_pairs = optind < argc ? argc - optind : 7;
+    int pairs[num_pairs][2];
+    for (int i = 0; i < num_pairs; i++) {
+        const char *arg = optind < argc ? argv[optind + i] : default_pairs[i];
+        if (sscanf(arg, "%d:%d", &pairs[i][0], &pairs[i][1]) != 2 || pairs[i][0] < 1 ||
+                pairs[i][0] > MAX_PROCS || pairs[i][1] < 1 || pairs[i][1] > MAX_PROCS)
+            usageError(argv[0]);
+    }
+
+    src = malloc(SRC_SIZE);
+    if (src == NULL)
+        errExit("malloc");
+    srandom(1);
+    for (int i = 0; i < SRC_SIZE; i++)
+        src[i] = random();
+
+    results = mmap(NULL, sizeof(Results), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+        errExit("mmap");
+
+    mpmc_unlink(queue_name);            // left over from an earlier run that was killed
+    printf("%s: %ld records per writer, %d-%zu bytes, capacity %u, queue in %s%s, %ld CPUs\n\n", argv[0],
+           num_records, MIN_RECORD, max_record, capacity, queue_name,
+           queue_flags & MPMC_POPULATE ? " (populated)" : "", sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| Writers:readers | Records/s | MB/s | Sleeps (W/R) | Page faults |\n");
+    printf("|-----------------|-----------|------|--------------|-------------|\n");
+
+    for (int i = 0; i < num_pairs; i++) {
+        MpmcQueue *q = mpmc_create(queue_name, capacity, max_record, S_IRUSR | S_IWUSR, queue_flags);
+        if (q == NULL)
+            errExit("mpmc_create");
+
+        long faults = children_faults();
+        double secs = run(pairs[i][0], pairs[i][1]);
+        faults = children_faults() - faults;
+
+        char rw[16], waits[32];
+        snprintf(rw, sizeof(rw), "%d:%d", pairs[i][0], pairs[i][1]);
+        snprintf(waits, sizeof(waits), "%ld/%ld", results->full_waits, results->empty_waits);
+        printf("| %15s | %9.0f | %4.0f | %12s | %11ld |\n", rw, pairs[i][0] * num_records / secs,
+               results->bytes / 1e6 / secs, waits, faults);
+        fflush(stdout);
+
+        mpmc_close(q);
+        mpmc_unlink(queue_name);
+    }
+
+    // crash test, on a small queue so that the writers come round to the slot of the dead reader
+    MpmcQueue *q = mpmc_create(queue_name, 16, max_record, S_IRUSR | S_IWUSR, queue_flags);
+    if (q == NULL)
+        errExit("mpmc_create");
+    MpmcStats st;
+
+    die_holding_slot(0);                // a writer dies in slot 0
+    RecordHdr victim = { .writer = UINT32_MAX };        // counts as corrupted if anybody gets it
+    if (mpmc_push(q, &victim, sizeof(victim)) == -1)    // in slot 1
+        errExit("mpmc_push");
+    die_holding_slot(1);                // a reader takes over slot 0, skips it, and dies in slot 1
+
+    double secs = run(4, 4);
+    mpmc_stats(q, &st);
+    printf("\nCrash test: 4 writers and 4 readers after a writer and a reader died holding slots: "
+           "%.2f s, all records delivered, lost records %lu/%lu (W/R)\n", secs,
+           (unsigned long) st.lost_writes, (unsigned long) st.lost_reads);
+    if (st.lost_writes != 1 || st.lost_reads != 1)
+        fatal("the dead processes' slots weren't taken over");
+
+    mpmc_close(q);
+    mpmc_unlink(queue_name);
+
+    q = mpmc_create(queue_name, 16, max_record, S_IRUSR | S_IWUSR, queue_flags);
+    if (q == NULL)
+        errExit("mpmc_create");
+    crash_before_moving_on(q);
+
+    mpmc_close(q);
+    mpmc_unlink(queue_name);
+    exit(EXIT_SUCCESS);
+}
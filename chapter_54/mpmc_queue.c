@@ -0,0 +1,471 @@
+/* mpmc_queue.c
+
+   Implementation of mpmc_queue.h.
+
+   Slot 'i' starts with sequence number 'i'. For the record at position 'pos'
+   (slot pos % capacity):
+
+       seq == pos             free for the writer of 'pos'
+       seq == pos + 1         holds the record, for the reader of 'pos'
+       seq == pos + capacity  read; free for the writer of the next lap
+
+   A writer (reader) claims the slot by setting its PID as owner with the
+   sequence number unchanged, and hands it on by storing the next sequence
+   number with owner 0. The shared positions 'enqueue_pos' and 'dequeue_pos'
+   only say where to look: whoever finds the slot at a position claimed, or
+   already past that position, moves the position on, so a claimer that dies
+   before doing it doesn't stop the others (not even once a sleeper has taken
+   its slot over and handed it on). Sequence numbers are 32 bits and compared by their difference, so
+   they may wrap around.
+
+   Sleeping follows the same pattern as the futex semaphores in posix_sem.c:
+   the sleeper counts itself in the slot's 'waiters' before checking the slot a
+   last time, and the process handing the slot on changes it before looking at
+   'waiters' (both sequentially consistent), so either the sleeper sees the
+   change or the other process sees the sleeper. The futex word is the
+   sequence number half of the slot's state, so a sleeper only wakes up when
+   the slot moves on, not when it's claimed.
+*/
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/magic.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+
+#include "mpmc_queue.h"
+
+#define CACHE_LINE 64
+#define MPMC_MAGIC 0x4d504d43           /* "MPMC" */
+#define READER 0x80000000u              /* Owner flag: the slot is being read */
+#define LOST_RECORD UINT32_MAX          /* 'len' of a slot whose writer died */
+
+typedef union {
+    uint64_t word;                      /* Both halves, for compare-and-swap */
+    struct {
+        uint32_t seq;                   /* Futex word */
+        uint32_t owner;                 /* PID (| READER) of the claimer, or 0 */
+    } h;
+} SlotState;
+
+struct mpmc_slot {
+    SlotState state;
+    uint32_t waiters;                   /* Processes sleeping on 'state.h.seq' */
+    uint32_t len;
+    char buf[];
+};
+
+struct mpmc_shared {
+    uint32_t magic;
+    uint32_t capacity;                  /* Power of 2 */
+    uint64_t max_record;
+    uint64_t stride;                    /* Bytes from one slot to the next */
+    uint64_t map_size;
+    uint64_t lost_writes;
+    uint64_t lost_reads;
+
+    uint64_t enqueue_pos __attribute__((aligned(CACHE_LINE)));
+    uint64_t dequeue_pos __attribute__((aligned(CACHE_LINE)));
+
+    char slots[] __attribute__((aligned(CACHE_LINE)));
+};
+
+void (*mpmc_claim_hook)(void);
+
+struct mpmc_queue {
+    struct mpmc_shared *shm;
+    uint32_t me;                        /* Our PID */
+    long full_waits;
+    long empty_waits;
+};
+
+
+static struct mpmc_slot *
+slot_at(MpmcQueue *q, uint64_t pos)
+{
+    struct mpmc_shared *shm = q->shm;
+    return (struct mpmc_slot *) (shm->slots + (pos & (shm->capacity - 1)) * shm->stride);
+}
+
+
+static int
+owner_alive(uint32_t owner)
+{
+    pid_t pid = owner & ~READER;
+    return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+
+/* Move 'enqueue_pos' or 'dequeue_pos' past the slot at 'pos', unless somebody
+   has done it already */
+static void
+move_on(uint64_t *shared_pos, uint64_t pos)
+{
+    __atomic_compare_exchange_n(shared_pos, &pos, pos + 1, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+
+/* Hand the slot on with sequence number 'seq', and wake its sleepers */
+static void
+set_seq(struct mpmc_slot *slot, uint32_t seq)
+{
+    SlotState st = { .h = { seq, 0 } };
+
+    __atomic_store_n(&slot->state.word, st.word, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->waiters, __ATOMIC_SEQ_CST) > 0)
+        syscall(SYS_futex, &slot->state.h.seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+
+/* The owner of 'slot', whose state was 'seen', is gone: take the slot over
+   and do what it would have done with it, minus the record */
+static void
+take_over(MpmcQueue *q, struct mpmc_slot *slot, SlotState seen)
+{
+    SlotState mine = { .h = { seen.h.seq, q->me | (seen.h.owner & READER) } };
+
+    /* We own it now (if somebody else was faster, they do). Should we die
+       too, the next sleeper takes over from us */
+    if (!__atomic_compare_exchange_n(&slot->state.word, &seen.word, mine.word, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return;
+
+    if (seen.h.owner & READER) {        /* seq == pos + 1: free it for the next lap */
+        __atomic_fetch_add(&q->shm->lost_reads, 1, __ATOMIC_RELAXED);
+        set_seq(slot, seen.h.seq - 1 + q->shm->capacity);
+    } else {                            /* seq == pos: "publish" an empty record */
+        __atomic_fetch_add(&q->shm->lost_writes, 1, __ATOMIC_RELAXED);
+        slot->len = LOST_RECORD;
+        set_seq(slot, seen.h.seq + 1);
+    }
+}
+
+
+/* Sleep until the sequence number of 'slot' is no longer that of 'seen', for
+   at most MPMC_CHECK_MS. If the time runs out and the slot's owner is gone,
+   take the slot over */
+static void
+wait_slot(MpmcQueue *q, struct mpmc_slot *slot, SlotState seen, long *waits)
+{
+    struct timespec timeout = { 0, MPMC_CHECK_MS * 1000000L };
+    int timed_out = 0;
+
+    __atomic_fetch_add(&slot->waiters, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&slot->state.word, __ATOMIC_SEQ_CST) == seen.word) {
+        (*waits)++;
+        timed_out = syscall(SYS_futex, &slot->state.h.seq, FUTEX_WAIT, seen.h.seq,
+                            &timeout, NULL, 0) == -1 && errno == ETIMEDOUT;
+    }
+    __atomic_fetch_sub(&slot->waiters, 1, __ATOMIC_SEQ_CST);
+
+    if (timed_out && seen.h.owner != 0 && !owner_alive(seen.h.owner))
+        take_over(q, slot, seen);
+}
+
+
+/* A POSIX shared memory object, or a file if the name has a second slash */
+static int
+is_path(const char *name)
+{
+    return strchr(name + 1, '/') != NULL;
+}
+
+
+static int
+open_object(const char *name, int oflag, mode_t perms)
+{
+    return is_path(name) ? open(name, oflag, perms) : shm_open(name, oflag, perms);
+}
+
+
+/* Map the queue. With MPMC_POPULATE, every process that maps it faults in
+   the whole queue here, not on the first push or pop that reaches a page.
+   Writers and readers both store to the slots, so the pages must be
+   writable: MAP_POPULATE alone leaves shared file pages read-only.
+   MADV_POPULATE_WRITE does that part, where the kernel has it (EINVAL
+   before Linux 5.14). Any other error, e.g. ENOMEM with no free huge pages,
+   fails the call */
+static struct mpmc_shared *
+map_queue(int fd, size_t size, int flags)
+{
+    struct mpmc_shared *shm = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | (flags & MPMC_POPULATE ? MAP_POPULATE : 0), fd, 0);
+    if (shm == MAP_FAILED)
+        return NULL;
+    if ((flags & MPMC_POPULATE) && madvise(shm, size, MADV_POPULATE_WRITE) == -1 &&
+            errno != EINVAL) {
+        int saved_errno = errno;
+        munmap(shm, size);
+        errno = saved_errno;
+        return NULL;
+    }
+    return shm;
+}
+
+
+static MpmcQueue *
+new_handle(struct mpmc_shared *shm)
+{
+    MpmcQueue *q = calloc(1, sizeof(MpmcQueue));
+    if (q == NULL)
+        return NULL;
+    q->shm = shm;
+    q->me = getpid();
+    return q;
+}
+
+
+MpmcQueue *
+mpmc_create(const char *name, unsigned int capacity, size_t max_record, mode_t perms,
+            int flags)
+{
+    struct statfs sfs;
+
+    if (capacity == 0 || capacity > (1u << 30) || max_record == 0 || max_record >= LOST_RECORD) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    uint32_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+    size_t stride = (sizeof(struct mpmc_slot) + max_record + CACHE_LINE - 1) &
+                    ~(size_t) (CACHE_LINE - 1);
+    size_t map_size = sizeof(struct mpmc_shared) + cap * stride;
+
+    int fd = open_object(name, O_RDWR | O_CREAT | O_EXCL, perms);
+    if (fd == -1)
+        return NULL;
+
+    /* A queue file on hugetlbfs (a path name) is sized in whole huge pages,
+       as ftruncate() there rejects anything else; mpmc_open() takes the
+       size from the file, so the slack just goes unused */
+    if (fstatfs(fd, &sfs) == 0 && sfs.f_type == HUGETLBFS_MAGIC)
+        map_size = (map_size + sfs.f_bsize - 1) / sfs.f_bsize * sfs.f_bsize;
+
+    if (ftruncate(fd, map_size) == -1) {
+        close(fd);
+        mpmc_unlink(name);
+        return NULL;
+    }
+    struct mpmc_shared *shm = map_queue(fd, map_size, flags);
+    close(fd);
+    if (shm == NULL) {
+        mpmc_unlink(name);
+        return NULL;
+    }
+
+    /* ftruncate() gave us zeros; only the sequence numbers need setting */
+    shm->capacity = cap;
+    shm->max_record = max_record;
+    shm->stride = stride;
+    shm->map_size = map_size;
+
+    MpmcQueue *q = new_handle(shm);
+    if (q == NULL) {
+        munmap(shm, map_size);
+        mpmc_unlink(name);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < cap; i++)
+        slot_at(q, i)->state.h.seq = i;
+
+    __atomic_store_n(&shm->magic, MPMC_MAGIC, __ATOMIC_RELEASE);
+    return q;
+}
+
+
+MpmcQueue *
+mpmc_open(const char *name, int flags)
+{
+    struct stat sb;
+
+    int fd = open_object(name, O_RDWR, 0);
+    if (fd == -1)
+        return NULL;
+    if (fstat(fd, &sb) == -1) {
+        close(fd);
+        return NULL;
+    }
+    if (sb.st_size < (off_t) sizeof(struct mpmc_shared)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    struct mpmc_shared *shm = map_queue(fd, sb.st_size, flags);
+    close(fd);
+    if (shm == NULL)
+        return NULL;
+
+    if (__atomic_load_n(&shm->magic, __ATOMIC_ACQUIRE) != MPMC_MAGIC ||
+            shm->map_size != (uint64_t) sb.st_size) {
+        munmap(shm, sb.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    MpmcQueue *q = new_handle(shm);
+    if (q == NULL)
+        munmap(shm, sb.st_size);
+    return q;
+}
+
+
+int
+mpmc_close(MpmcQueue *q)
+{
+    int s = munmap(q->shm, q->shm->map_size);
+    free(q);
+    return s;
+}
+
+
+int
+mpmc_unlink(const char *name)
+{
+    return is_path(name) ? unlink(name) : shm_unlink(name);
+}
+
+
+size_t
+mpmc_max_record(MpmcQueue *q)
+{
+    return q->shm->max_record;
+}
+
+
+void
+mpmc_stats(MpmcQueue *q, MpmcStats *stats)
+{
+    stats->full_waits = q->full_waits;
+    stats->empty_waits = q->empty_waits;
+    stats->lost_writes = __atomic_load_n(&q->shm->lost_writes, __ATOMIC_RELAXED);
+    stats->lost_reads = __atomic_load_n(&q->shm->lost_reads, __ATOMIC_RELAXED);
+}
+
+
+void *
+mpmc_push_begin(MpmcQueue *q, MpmcSlotRef *ref)
+{
+    struct mpmc_shared *shm = q->shm;
+
+    for (;;) {
+        uint64_t pos = __atomic_load_n(&shm->enqueue_pos, __ATOMIC_RELAXED);
+        struct mpmc_slot *slot = slot_at(q, pos);
+        SlotState st = { .word = __atomic_load_n(&slot->state.word, __ATOMIC_ACQUIRE) };
+        int32_t diff = (int32_t) (st.h.seq - (uint32_t) pos);
+
+        if (diff == 0 && st.h.owner == 0) {             /* Free: claim it */
+            SlotState mine = { .h = { st.h.seq, q->me } };
+            if (__atomic_compare_exchange_n(&slot->state.word, &st.word, mine.word, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                if (mpmc_claim_hook != NULL)
+                    mpmc_claim_hook();
+                move_on(&shm->enqueue_pos, pos);
+                ref->slot = slot;
+                ref->pos = pos;
+                return slot->buf;
+            }
+        } else if (diff == 0) {         /* Claimed, but the claimer may not have moved on yet */
+            move_on(&shm->enqueue_pos, pos);
+        } else if (diff < 0) {          /* Holds the record of the previous lap: full */
+            wait_slot(q, slot, st, &q->full_waits);
+        } else {                        /* Done with 'pos': another writer took it since we looked,
+                                           or its claimer died before moving on and it was taken over */
+            move_on(&shm->enqueue_pos, pos);
+        }
+    }
+}
+
+
+void
+mpmc_push_commit(MpmcQueue *q, MpmcSlotRef *ref, size_t len)
+{
+    struct mpmc_slot *slot = ref->slot;
+
+    slot->len = len;
+    set_seq(slot, (uint32_t) ref->pos + 1);
+}
+
+
+void *
+mpmc_pop_begin(MpmcQueue *q, MpmcSlotRef *ref, size_t *len)
+{
+    struct mpmc_shared *shm = q->shm;
+
+    for (;;) {
+        uint64_t pos = __atomic_load_n(&shm->dequeue_pos, __ATOMIC_RELAXED);
+        struct mpmc_slot *slot = slot_at(q, pos);
+        SlotState st = { .word = __atomic_load_n(&slot->state.word, __ATOMIC_ACQUIRE) };
+        int32_t diff = (int32_t) (st.h.seq - (uint32_t) (pos + 1));
+
+        if (diff == 0 && st.h.owner == 0) {             /* Holds a record: claim it */
+            SlotState mine = { .h = { st.h.seq, q->me | READER } };
+            if (__atomic_compare_exchange_n(&slot->state.word, &st.word, mine.word, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                if (mpmc_claim_hook != NULL)
+                    mpmc_claim_hook();
+                move_on(&shm->dequeue_pos, pos);
+                if (slot->len == LOST_RECORD) {         /* Its writer died; skip it */
+                    set_seq(slot, (uint32_t) pos + shm->capacity);
+                    continue;
+                }
+                ref->slot = slot;
+                ref->pos = pos;
+                *len = slot->len;
+                return slot->buf;
+            }
+        } else if (diff == 0) {         /* Claimed, but the claimer may not have moved on yet */
+            move_on(&shm->dequeue_pos, pos);
+        } else if (diff < 0) {          /* Not written yet: empty, or a writer is at it */
+            wait_slot(q, slot, st, &q->empty_waits);
+        } else {                        /* Done with 'pos': another reader took it since we looked,
+                                           or its claimer died before moving on and it was taken over */
+            move_on(&shm->dequeue_pos, pos);
+        }
+    }
+}
+
+
+void
+mpmc_pop_end(MpmcQueue *q, MpmcSlotRef *ref)
+{
+    set_seq(ref->slot, (uint32_t) ref->pos + q->shm->capacity);
+}
+
+
+int
+mpmc_push(MpmcQueue *q, const void *rec, size_t len)
+{
+    MpmcSlotRef ref;
+
+    if (len > q->shm->max_record) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    memcpy(mpmc_push_begin(q, &ref), rec, len);
+    mpmc_push_commit(q, &ref, len);
+    return 0;
+}
+
+
+ssize_t
+mpmc_pop(MpmcQueue *q, void *buf)
+{
+    MpmcSlotRef ref;
+    size_t len;
+
+    void *rec = mpmc_pop_begin(q, &ref, &len);
+    memcpy(buf, rec, len);
+    mpmc_pop_end(q, &ref);
+    return len;
+}
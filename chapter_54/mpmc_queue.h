@@ -0,0 +1,95 @@
+/* mpmc_queue.h
+
+   Bounded multi-producer/multi-consumer queue of variable-length records in a
+   POSIX shared memory object, for any number of writer and reader processes
+   (see mpmc_bench.c).
+
+   The queue is a ring of slots, each holding one record of up to 'max_record'
+   bytes. Every slot carries a sequence number that says which lap of the ring
+   it's on and whether it's free or holds a record (the scheme of Dmitry
+   Vyukov's bounded MPMC queue), next to the PID of the process working on it,
+   if any. A process claims a slot with a single compare-and-swap of the pair,
+   so no locks are taken.
+
+   A process that finds the queue full (writer) or empty (reader) sleeps on
+   the futex of the slot it waits for. The process that hands the slot on
+   makes the wake-up call only if somebody sleeps there.
+
+   A process that dies while it holds a slot doesn't wedge the queue: sleepers
+   wake up every MPMC_CHECK_MS, and if the slot they wait for belongs to a
+   process that no longer exists, they take it over. The record of a writer
+   that died is dropped, and so is a record whose reader died before
+   mpmc_pop_end(); mpmc_stats() counts both. Owners are identified by PID, so
+   the death of one thread in a multithreaded process isn't noticed, and a
+   slot whose owner's PID is reused stays stuck until that process is gone too.
+
+   A handle belongs to the process that created or opened it; a child must
+   mpmc_open() the queue itself rather than use its parent's handle.
+
+   A name with a slash after the first character is taken as a file path
+   instead, so that the queue can live in a file on a hugetlbfs mount and get
+   huge pages. MPMC_POPULATE faults in the whole mapping when the queue is
+   created or opened, so that no process takes first-touch page faults while
+   moving records.
+*/
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define MPMC_CHECK_MS 100       /* How often sleepers look for dead owners */
+#define MPMC_POPULATE 1         /* Flag for mpmc_create() and mpmc_open() */
+
+typedef struct mpmc_queue MpmcQueue;    /* Process-local handle */
+
+typedef struct {                        /* A slot being written or read */
+    void *slot;
+    uint64_t pos;
+} MpmcSlotRef;
+
+typedef struct {
+    long full_waits;            /* Times this handle slept on a full queue */
+    long empty_waits;           /* ... and on an empty one */
+    uint64_t lost_writes;       /* Records dropped because the writer died */
+    uint64_t lost_reads;        /* ... because the reader died */
+} MpmcStats;
+
+/* Create the object 'name' (for shm_open()) with room for 'capacity' records
+   (rounded up to a power of 2) of up to 'max_record' bytes. On hugetlbfs the
+   file is rounded up to a whole number of huge pages. 'flags' is 0 or
+   MPMC_POPULATE. Return NULL with errno set on error */
+MpmcQueue *mpmc_create(const char *name, unsigned int capacity, size_t max_record, mode_t perms,
+                       int flags);
+
+/* Map an existing queue */
+MpmcQueue *mpmc_open(const char *name, int flags);
+
+int mpmc_close(MpmcQueue *q);
+int mpmc_unlink(const char *name);
+
+size_t mpmc_max_record(MpmcQueue *q);
+void mpmc_stats(MpmcQueue *q, MpmcStats *stats);
+
+/* Copying interface. mpmc_push() blocks while the queue is full, and fails
+   with EMSGSIZE if the record is too long. mpmc_pop() blocks while the queue
+   is empty and returns the record's length; 'buf' must have room for
+   mpmc_max_record() bytes */
+int mpmc_push(MpmcQueue *q, const void *rec, size_t len);
+ssize_t mpmc_pop(MpmcQueue *q, void *buf);
+
+/* In-place interface:
+       writer:  buf = mpmc_push_begin(q, &ref); ...fill up to max_record bytes...; mpmc_push_commit(q, &ref, len);
+       reader:  buf = mpmc_pop_begin(q, &ref, &len); ...use len bytes...; mpmc_pop_end(q, &ref);
+*/
+void *mpmc_push_begin(MpmcQueue *q, MpmcSlotRef *ref);
+void mpmc_push_commit(MpmcQueue *q, MpmcSlotRef *ref, size_t len);
+void *mpmc_pop_begin(MpmcQueue *q, MpmcSlotRef *ref, size_t *len);
+void mpmc_pop_end(MpmcQueue *q, MpmcSlotRef *ref);
+
+/* For crash tests: if set, called right after a push or pop has claimed its
+   slot, before it moves the shared position on */
+extern void (*mpmc_claim_hook)(void);
+
+#endif
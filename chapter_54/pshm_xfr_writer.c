@@ -34,6 +34,7 @@
 #include <sys/mman.h>
 #include <unistd.h>
 
+#include "semun.h"              /* Definition of semun union */
 #include "pshm_xfr.h"
 
 int
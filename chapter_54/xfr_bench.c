@@ -0,0 +1,373 @@
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sem.h>
+#include <sys/shm.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+#include "tlpi_hdr.h"
+
+// Runs every program in this tree that copies stdin to stdout through shared memory over the same input, for
+// a list of buffer sizes, and checks the output against a checksum of the input. For each variant and size it
+// records the best of -r runs (lowest wall time) in a CSV file: wall time, user and system CPU time and context
+// switches of the writer and reader processes together (from wait4()), and MB/s.
+//
+// Run from this directory; the other chapters are found relative to it. Variants with the buffer size built in
+// (BUF_SIZE) are rebuilt with make for every size, and rebuilt with their default once we're done. The ring
+// variants take the size as their slot size, with 16 slots.
+//
+// The copies of svshm_xfr in chapters 49, 53 and 54 are the same source as chapter 48's, so only that one runs.
+
+#define IN_FILE "/tmp/xfr_bench.in"
+#define OUT_FILE "/tmp/xfr_bench.out"
+
+// the IPC objects the writers create, from svshm_xfr.h, mmap_xfr.h, pshm_xfr.h and bcast_ring.c
+#define SEM_KEY 0x5678
+#define SHM_KEY 0x1234
+#define MMAP_FILE "/tmp/xfr"
+#define PSHM_NAME "/xfr"
+#define PSHM_FILE "/dev/shm/xfr"
+#define BCAST_MAGIC 0x42434153
+
+enum ready {                    // how to tell that the writer has set up, so the reader can start
+    READY_SYSV,                 // semaphore set and segment exist
+    READY_MMAP,                 // semaphore set exists, and the file MMAP_FILE has its size
+    READY_PSHM,                 // ... and PSHM_FILE
+    READY_BCAST,                // MMAP_FILE holds an initialized broadcast ring
+    READY_NONE                  // one process: there is no reader program
+};
+
+typedef struct {
+    const char *name;
+    const char *dir;
+    const char *writer;         // program; the only one if there is no reader
+    const char *reader;
+    enum ready ready;
+    int built_in_size;          // BUF_SIZE is a compile-time constant
+    const char *size_args;      // otherwise: writer's arguments, %d being the size
+} Variant;
+
+static const Variant variants[] = {
+    { "svshm_xfr",          "../chapter_48", "svshm_xfr_writer",      "svshm_xfr_reader",      READY_SYSV,  1, NULL },
+    { "svshm_xfr_mod",      "../chapter_48", "svshm_xfr_writer_mod",  "svshm_xfr_reader_mod",  READY_SYSV,  1, NULL },
+    { "svshm_xfr_ring",     "../chapter_48", "svshm_xfr_ring_writer", "svshm_xfr_ring_reader", READY_SYSV,  0, "16 %d" },
+    { "mmap_xfr",           "../chapter_49", "mmap_xfr_writer",       "mmap_xfr_reader",       READY_MMAP,  1, NULL },
+    { "mmap_bcast",         "../chapter_49", "mmap_bcast_writer",     "mmap_bcast_reader",     READY_BCAST, 0, "-n 16 -s %d" },
+    { "pshm_xfr",           "../chapter_54", "pshm_xfr_writer",       "pshm_xfr_reader",       READY_PSHM,  1, NULL },
+    { "pthread_xfr",        "../chapter_53", "pthread_xfr",           NULL,                    READY_NONE,  1, NULL },
+    { "pthread_xfr_spsc",   "../chapter_53", "pthread_xfr_spsc",      NULL,                    READY_NONE,  0, "16 %d" },
+};
+#define NUM_VARIANTS (int) (sizeof(variants) / sizeof(variants[0]))
+
+typedef struct {
+    double wall, user, sys;
+    long vcsw, ivcsw;
+} Sample;
+
+static void
+usageError(const char *progName)
+{
+    fprintf(stderr, "Usage: %s [-m input-MiB] [-r runs] [-o csv-file] [buf-size...]\n", progName);
+    fprintf(stderr, "  -m input-MiB: size of the generated input (default 64)\n");
+    fprintf(stderr, "  -r runs: runs per variant and size, best one kept (default 3)\n");
+    fprintf(stderr, "  -o csv-file: where to write the results (default xfr_bench.csv)\n");
+    fprintf(stderr, "  buf-size: buffer sizes to try (default 1024 4096 16384 65536)\n");
+    exit(EXIT_FAILURE);
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// FNV-1a over 8-byte words, then the tail bytes; 'h' carries over from call to call
+static uint64_t
+checksum(uint64_t h, const char *buf, size_t cnt)
+{
+    uint64_t w;
+    size_t i;
+    for (i = 0; i + 8 <= cnt; i += 8) {
+        memcpy(&w, buf + i, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+    }
+    for (; i < cnt; i++)
+        h = (h ^ (unsigned char) buf[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+#define CHUNK (1 << 20)
+#define CHECKSUM_INIT 0xcbf29ce484222325ULL
+
+// fill IN_FILE with 'mib' MiB of pseudo-random bytes; returns their checksum
+static uint64_t
+make_input(long mib)
+{
+    static char buf[CHUNK];
+    uint64_t h = CHECKSUM_INIT, x = 88172645463325252ULL;
+
+    int fd = open(IN_FILE, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    if (fd == -1)
+        errExit("open %s", IN_FILE);
+    for (long i = 0; i < mib; i++) {
+        for (int j = 0; j < CHUNK; j += 8) {
+            x ^= x << 13;       // xorshift64
+            x ^= x >> 7;
+            x ^= x << 17;
+            memcpy(buf + j, &x, 8);
+        }
+        if (write(fd, buf, CHUNK) != CHUNK)
+            fatal("write %s", IN_FILE);
+        h = checksum(h, buf, CHUNK);
+    }
+    close(fd);
+    return h;
+}
+
+static uint64_t
+file_checksum(const char *path, long *size)
+{
+    static char buf[CHUNK];
+    uint64_t h = CHECKSUM_INIT;
+    ssize_t n;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        errExit("open %s", path);
+    *size = 0;
+    while ((n = read(fd, buf, CHUNK)) > 0) {
+        h = checksum(h, buf, n);
+        *size += n;
+    }
+    if (n == -1)
+        errExit("read %s", path);
+    close(fd);
+    return h;
+}
+
+// run 'make' for the programs of 'v', with BUF_SIZE 'size' (0 for the default)
+static void
+build(const Variant *v, int size)
+{
+    char cmd[512];
+    int n = snprintf(cmd, sizeof(cmd), "make -s -B -C %s", v->dir);
+    if (size > 0)
+        n += snprintf(cmd + n, sizeof(cmd) - n, " CPPFLAGS=-DBUF_SIZE=%d", size);
+    snprintf(cmd + n, sizeof(cmd) - n, " %s %s > /dev/null", v->writer, v->reader ? v->reader : "");
+    if (system(cmd) != 0)
+        fatal("%s failed", cmd);
+}
+
+// remove whatever an earlier run (or a killed one) left behind
+static void
+remove_ipc(void)
+{
+    int id;
+    if ((id = semget(SEM_KEY, 0, 0)) != -1)
+        semctl(id, 0, IPC_RMID);
+    if ((id = shmget(SHM_KEY, 0, 0)) != -1)
+        shmctl(id, IPC_RMID, NULL);
+    unlink(MMAP_FILE);
+    shm_unlink(PSHM_NAME);
+}
+
+static int
+file_ready(const char *path, enum ready ready)
+{
+    struct stat sb;
+    uint32_t magic;
+
+    if (ready == READY_BCAST) {
+        int fd = open(path, O_RDONLY);
+        if (fd == -1)
+            return 0;
+        int ok = pread(fd, &magic, sizeof(magic), 0) == sizeof(magic) && magic == BCAST_MAGIC;
+        close(fd);
+        return ok;
+    }
+    return stat(path, &sb) == 0 && sb.st_size > 0;
+}
+
+static int
+writer_ready(enum ready ready)
+{
+    switch (ready) {
+    case READY_SYSV:  return semget(SEM_KEY, 0, 0) != -1 && shmget(SHM_KEY, 0, 0) != -1;
+    case READY_MMAP:  return semget(SEM_KEY, 0, 0) != -1 && file_ready(MMAP_FILE, ready);
+    case READY_PSHM:  return semget(SEM_KEY, 0, 0) != -1 && file_ready(PSHM_FILE, ready);
+    case READY_BCAST: return file_ready(MMAP_FILE, ready);
+    default:          return 1;
+    }
+}
+
+// fork and exec 'dir'/'prog' with 'args' (split at spaces), stdin from 'in' and stdout to 'out'
+static pid_t
+spawn(const char *dir, const char *prog, const char *args, const char *in, const char *out)
+{
+    char path[256], argbuf[128];
+    char *argv[16];
+    int argc = 0;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, prog);
+    argv[argc++] = path;
+    if (args != NULL) {
+        snprintf(argbuf, sizeof(argbuf), "%s", args);
+        for (char *tok = strtok(argbuf, " "); tok != NULL && argc < 15; tok = strtok(NULL, " "))
+            argv[argc++] = tok;
+    }
+    argv[argc] = NULL;
+
+    pid_t pid = fork();
+    if (pid == -1)
+        errExit("fork");
+    if (pid == 0) {
+        int ifd = open(in, O_RDONLY);
+        int ofd = open(out, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        int efd = open("/dev/null", O_WRONLY);
+        if (ifd == -1 || ofd == -1 || efd == -1)
+            _exit(127);
+        dup2(ifd, STDIN_FILENO);
+        dup2(ofd, STDOUT_FILENO);
+        dup2(efd, STDERR_FILENO);                   // the programs' own statistics
+        execv(path, argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static void
+reap(pid_t pid, const char *prog, Sample *s)
+{
+    struct rusage ru;
+    int status;
+
+    if (wait4(pid, &status, 0, &ru) == -1)
+        errExit("wait4");
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        fatal("%s failed (status %#x)", prog, status);
+    s->user += ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    s->sys += ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    s->vcsw += ru.ru_nvcsw;
+    s->ivcsw += ru.ru_nivcsw;
+}
+
+// one transfer of IN_FILE to OUT_FILE; returns 0 if the output's checksum is right
+static int
+run(const Variant *v, int size, uint64_t in_sum, long in_size, Sample *s)
+{
+    struct timespec poll = { 0, 100000 };          // 100us
+    char args[64] = "";
+    pid_t writer, reader = -1;
+    long out_size;
+
+    if (!v->built_in_size)
+        snprintf(args, sizeof(args), v->size_args, size);
+
+    remove_ipc();
+    memset(s, 0, sizeof(Sample));
+    double start = now();
+
+    if (v->reader == NULL) {
+        writer = spawn(v->dir, v->writer, args, IN_FILE, OUT_FILE);
+    } else {
+        writer = spawn(v->dir, v->writer, args, IN_FILE, "/dev/null");
+        while (!writer_ready(v->ready)) {
+            if (waitpid(writer, NULL, WNOHANG) == writer)
+                fatal("%s exited before setting up", v->writer);
+            nanosleep(&poll, NULL);
+        }
+        reader = spawn(v->dir, v->reader, NULL, "/dev/null", OUT_FILE);
+    }
+
+    reap(writer, v->writer, s);
+    if (reader != -1)
+        reap(reader, v->reader, s);
+    s->wall = now() - start;
+
+    remove_ipc();
+    return file_checksum(OUT_FILE, &out_size) == in_sum && out_size == in_size ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+    long mib = 64;
+    int runs = 3, opt;
+    const char *csv_path = "xfr_bench.csv";
+
+    while ((opt = getopt(argc, argv, "m:r:o:")) != -1) {
+        switch (opt) {
+        case 'm': mib = getLong(optarg, GN_GT_0, "input-MiB"); break;
+        case 'r': runs = getInt(optarg, GN_GT_0, "runs"); break;
+        case 'o': csv_path = optarg; break;
+        default: usageError(argv[0]);
+        }
+    }
+
+    int default_sizes[] = { 1024, 4096, 16384, 65536 };
+    int num_sizes = optind < argc ? argc - optind : 4;
+    int sizes[num_sizes];
+    for (int i = 0; i < num_sizes; i++)
+        sizes[i] = optind < argc ? getInt(argv[optind + i], GN_GT_0, "buf-size") : default_sizes[i];
+
+    FILE *csv = fopen(csv_path, "w");
+    if (csv == NULL)
+        errExit("fopen %s", csv_path);
+    fprintf(csv, "variant,buf_size,bytes,wall_s,user_s,sys_s,cpu_s,vol_ctxt_sw,invol_ctxt_sw,mb_per_s,checksum\n");
+
+    uint64_t in_sum = make_input(mib);
+    long in_size = mib * CHUNK;
+
+    printf("%s: %ld MiB input, best of %d runs, %ld CPUs\n\n", argv[0], mib, runs,
+           sysconf(_SC_NPROCESSORS_ONLN));
+    printf("| %-16s | %8s | %7s | %7s | %8s | %8s |\n", "Variant", "Buf size", "MB/s", "CPU s", "Vol cs",
+           "Invol cs");
+    printf("|------------------|----------|---------|---------|----------|----------|\n");
+
+    int failures = 0;
+    for (int i = 0; i < num_sizes; i++) {
+        for (int j = 0; j < NUM_VARIANTS; j++) {
+            const Variant *v = &variants[j];
+            Sample best = { 0 }, s;
+            int ok = 1;
+
+            if (v->built_in_size)
+                build(v, sizes[i]);
+            for (int r = 0; r < runs; r++) {
+                if (run(v, sizes[i], in_sum, in_size, &s) == -1)
+                    ok = 0;
+                if (r == 0 || s.wall < best.wall)
+                    best = s;
+            }
+            if (!ok) {
+                fprintf(stderr, "%s, buffer size %d: output differs from input\n", v->name, sizes[i]);
+                failures++;
+            }
+
+            double mbs = in_size / 1e6 / best.wall;
+            fprintf(csv, "%s,%d,%ld,%.4f,%.4f,%.4f,%.4f,%ld,%ld,%.1f,%s\n", v->name, sizes[i], in_size,
+                    best.wall, best.user, best.sys, best.user + best.sys, best.vcsw, best.ivcsw, mbs,
+                    ok ? "ok" : "FAIL");
+            fflush(csv);
+            printf("| %-16s | %8d | %7.1f | %7.3f | %8ld | %8ld |\n", v->name, sizes[i], mbs,
+                   best.user + best.sys, best.vcsw, best.ivcsw);
+            fflush(stdout);
+        }
+    }
+
+    // put the programs with BUF_SIZE built in back to their default
+    for (int j = 0; j < NUM_VARIANTS; j++)
+        if (variants[j].built_in_size)
+            build(&variants[j], 0);
+
+    fclose(csv);
+    unlink(IN_FILE);
+    unlink(OUT_FILE);
+    printf("\nResults in %s\n", csv_path);
+    exit(failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}